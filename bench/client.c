@@ -1,6 +1,9 @@
 #define _GNU_SOURCE
 #include <arpa/inet.h>
 #include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,18 +13,55 @@
 #include <unistd.h>
 
 #include "net_map.h"
+#include "proto.h"
 #include "rdma.h"
 
-struct request_msg {
-    uint8_t op_type;
-    uint32_t slot;
+/* Frames of one connection in flight and their send times */
+struct conn {
+    int fd;
+    int inflight;
+    int nfree;
+    uint32_t *free_ids;  // ids not in flight
+    uint64_t *sent_at;   // by id
+    uint8_t buf[4096];   // response bytes not yet parsed
+    uint32_t len;
 };
 
 struct client_thread_args {
     int thread_id;
     int num_requests;
+    int depth;  // frames in flight per connection
+    int batch;  // FAAs per frame
+    uint64_t completed;
+    uint64_t latency_us;  // summed over the frames
+    uint64_t frames;
 };
 
+/* Parse the whole responses received on conn. Returns -1 once the node
+ * hands out no more slots */
+static int __responses(struct client_thread_args *args, struct conn *conn) {
+    uint32_t off = 0;
+    int ret = 0;
+    while (conn->len - off >= sizeof(struct proto_resp)) {
+        struct proto_resp resp;
+        memcpy(&resp, conn->buf + off, sizeof(resp));
+        uint32_t len = sizeof(resp) + resp.count * sizeof(int64_t);
+        if (conn->len - off < len) break;
+        off += len;
+        if (resp.id >= (uint32_t)args->depth) continue;
+
+        args->latency_us += ts_us() - conn->sent_at[resp.id];
+        ++args->frames;
+        args->completed += resp.count;
+        conn->free_ids[conn->nfree++] = resp.id;
+        --conn->inflight;
+        if (resp.status == -ENOMEM) ret = -1;
+    }
+    memmove(conn->buf, conn->buf + off, conn->len - off);
+    conn->len -= off;
+    return ret;
+}
+
 void *client_thread(void *arg) {
     struct client_thread_args *args = (struct client_thread_args *)arg;
     int num_requests = args->num_requests;
@@ -31,10 +71,12 @@ void *client_thread(void *arg) {
             num_requests);
 
     // Connect to all nodes
-    int sockets[num_nodes];
+    struct conn conns[num_nodes];
+    struct pollfd fds[num_nodes];
+    memset(conns, 0, sizeof(conns));
     for (int i = 0; i < num_nodes; i++) {
-        sockets[i] = socket(AF_INET, SOCK_STREAM, 0);
-        if (sockets[i] < 0) {
+        conns[i].fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (conns[i].fd < 0) {
             perror("socket");
             return NULL;
         }
@@ -44,60 +86,121 @@ void *client_thread(void *arg) {
             .sin_addr.s_addr = htonl(net_cfg[i].v),
             .sin_port = htons(CLIENT_SERVICE_PORT)};
 
-        if (connect(sockets[i], (struct sockaddr *)&server_addr,
+        if (connect(conns[i].fd, (struct sockaddr *)&server_addr,
                     sizeof(server_addr)) < 0) {
             perror("connect");
-            close(sockets[i]);
+            close(conns[i].fd);
             return NULL;
         }
+        int one = 1;
+        setsockopt(conns[i].fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        conns[i].free_ids = malloc(sizeof(uint32_t) * args->depth);
+        conns[i].sent_at = malloc(sizeof(uint64_t) * args->depth);
+        if (!conns[i].free_ids || !conns[i].sent_at) {
+            perror("malloc");
+            return NULL;
+        }
+        for (int id = 0; id < args->depth; ++id)
+            conns[i].free_ids[conns[i].nfree++] = id;
+        fds[i] = (struct pollfd){.fd = conns[i].fd, .events = POLLIN};
     }
 
     FAA_LOG("Client thread %d: connected to all nodes", args->thread_id);
 
-    int completed = 0;
-    for (int i = 0; i < num_requests; ++i) {
-        int target_node = i % num_nodes;
-        struct request_msg req = {.op_type = 0, .slot = 0};
-        if (send(sockets[target_node], &req, sizeof(req), 0) < 0) {
-            perror("send");
-            break;
+    // Frames go round robin over the nodes, up to depth on each
+    int issued = 0, inflight = 0, stop = 0, target_node = 0;
+    uint64_t report = 10000;
+    while (!stop && (issued < num_requests || inflight)) {
+        for (int tries = 0; issued < num_requests && tries < num_nodes;
+             ++tries, target_node = (target_node + 1) % num_nodes) {
+            struct conn *conn = conns + target_node;
+            if (!conn->nfree) continue;
+            uint32_t id = conn->free_ids[--conn->nfree];
+            int count = num_requests - issued < args->batch
+                            ? num_requests - issued
+                            : args->batch;
+            struct proto_req req = {.version = PROTO_VERSION,
+                                    .op = PROTO_FAA,
+                                    .count = count,
+                                    .id = id};
+            conn->sent_at[id] = ts_us();
+            if (send(conn->fd, &req, sizeof(req), MSG_NOSIGNAL) < 0) {
+                perror("send");
+                stop = 1;
+                break;
+            }
+            issued += count;
+            ++conn->inflight;
+            ++inflight;
         }
-        int64_t result;
-        ssize_t n =
-            recv(sockets[target_node], &result, sizeof(result), MSG_WAITALL);
-        if (n != sizeof(result)) {
-            perror("recv");
+        if (stop || !inflight) break;
+
+        if (poll(fds, num_nodes, -1) < 0) {
+            perror("poll");
             break;
         }
-        if (result == -ENOMEM) break;
-        if (++completed % 10000 == 0)
-            FAA_LOG("Client thread %d: %d requests completed", args->thread_id,
-                    completed);
+        for (int i = 0; i < num_nodes; ++i) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            struct conn *conn = conns + i;
+            ssize_t n = recv(conn->fd, conn->buf + conn->len,
+                             sizeof(conn->buf) - conn->len, 0);
+            if (n <= 0) {
+                if (n < 0) perror("recv");
+                stop = 1;
+                break;
+            }
+            conn->len += n;
+            int before = conn->inflight;
+            if (__responses(args, conn)) stop = 1;
+            inflight -= before - conn->inflight;
+        }
+        if (args->completed >= report) {
+            FAA_LOG("Client thread %d: %lu requests completed",
+                    args->thread_id, args->completed);
+            report += 10000;
+        }
     }
 
     // Close connections
-    for (int i = 0; i < num_nodes; ++i) close(sockets[i]);
-    FAA_LOG("Client thread %d: finished (%d/%d requests)", args->thread_id,
-            completed, num_requests);
+    for (int i = 0; i < num_nodes; ++i) {
+        close(conns[i].fd);
+        free(conns[i].free_ids);
+        free(conns[i].sent_at);
+    }
+    FAA_LOG("Client thread %d: finished (%lu/%d requests)", args->thread_id,
+            args->completed, num_requests);
 
     return NULL;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <num_threads> <requests_per_thread>\n",
+    if (argc < 3 || argc > 5) {
+        fprintf(stderr,
+                "Usage: %s <num_threads> <requests_per_thread> "
+                "[frames in flight per node, default 1] "
+                "[requests per frame, default 1]\n",
                 argv[0]);
         return 1;
     }
 
     int num_threads = atoi(argv[1]);
     int requests_per_thread = atoi(argv[2]);
+    int depth = argc > 3 ? atoi(argv[3]) : 1;
+    int batch = argc > 4 ? atoi(argv[4]) : 1;
     int num_nodes = sizeof(net_cfg) / sizeof(net_cfg[0]);
+    if (depth < 1 || depth > PROTO_MAX_PIPELINE || batch < 1 ||
+        batch > PROTO_MAX_OPS) {
+        fprintf(stderr, "Depth must be 1-%d, batch 1-%d\n",
+                PROTO_MAX_PIPELINE, PROTO_MAX_OPS);
+        return 1;
+    }
 
     printf("================================\n\n");
     printf("Cluster nodes: %d\n", num_nodes);
     printf("Client threads: %d\n", num_threads);
     printf("Requests per thread: %d\n", requests_per_thread);
+    printf("Frames in flight per node: %d, requests per frame: %d\n", depth,
+           batch);
     printf("Total requests: %d\n", num_threads * requests_per_thread);
     printf("================================\n\n");
 
@@ -108,8 +211,11 @@ int main(int argc, char *argv[]) {
     uint64_t start_time = ts_us();
 
     for (int i = 0; i < num_threads; ++i) {
-        args[i].thread_id = i;
-        args[i].num_requests = requests_per_thread;
+        args[i] = (struct client_thread_args){.thread_id = i,
+                                              .num_requests =
+                                                  requests_per_thread,
+                                              .depth = depth,
+                                              .batch = batch};
         if (pthread_create(&threads[i], NULL, client_thread, args + i)) {
             perror("pthread_create");
             return -errno;
@@ -119,12 +225,19 @@ int main(int argc, char *argv[]) {
     for (int i = 0; i < num_threads; i++) pthread_join(threads[i], NULL);
 
     uint64_t total_time = ts_us() - start_time;
-    double throughput =
-        (num_threads * requests_per_thread) / (total_time / 1000000.0);
+    uint64_t completed = 0, frames = 0, latency_us = 0;
+    for (int i = 0; i < num_threads; ++i) {
+        completed += args[i].completed;
+        frames += args[i].frames;
+        latency_us += args[i].latency_us;
+    }
+    double throughput = completed / (total_time / 1000000.0);
 
     printf("===============\n");
     printf("Total time: %.2f seconds\n", total_time / 1000000.0);
     printf("Throughput: %.2f ops/sec\n", throughput);
+    printf("Mean frame latency: %.1f us\n",
+           frames ? (double)latency_us / frames : 0.0);
     printf("===============\n");
 
     free(threads);
@@ -0,0 +1,432 @@
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <math.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "net_map.h"
+#include "node.h"
+#include "proto.h"
+
+/* Open-loop load generator. Requests arrive on a schedule of their own,
+ * Poisson or evenly spaced, whether or not earlier ones were answered, and
+ * a request's latency runs from the time it was due, not the time it went
+ * out. A server that falls behind is charged for the whole queue it built
+ * up, which a closed-loop client would hide */
+#define LG_IDS (PROTO_MAX_PIPELINE) // requests of a connection in flight
+#define LG_OUT (16384)      // frames coalesced into one send
+#define LG_IN (16384)
+#define LG_SETUP_NS (100000000ULL)  // between the threads' start and load
+#define LG_DRAIN_NS (2000000000ULL) // to wait for the last responses
+#define SWEEP_POINTS (64)
+
+/* A sweep point is past the knee once it misses its offered load by more
+ * than KNEE_MISS, or its p99 exceeds KNEE_P99 times the first point's */
+#define KNEE_MISS (0.05)
+#define KNEE_P99 (10)
+
+enum arrival { ARRIVAL_POISSON, ARRIVAL_FIXED };
+
+static const char *__ops[PROTO_OPS] = {"FAA", "TAS", "LL", "SC"};
+
+static struct {
+    int threads;
+    int depth;  // requests of a connection in flight, at most LG_IDS
+    enum arrival arrival;
+    uint64_t duration_ns;  // of each load point
+    uint32_t mix[PROTO_OPS];
+    uint32_t mix_total;
+    int num_nodes;
+} lg;
+
+struct lg_conn {
+    int fd;
+    int nfree;
+    uint32_t free_ids[LG_IDS];
+    uint64_t due[LG_IDS];  // by id, in ns
+    uint8_t op[LG_IDS];
+    uint32_t outlen, inlen;
+    uint8_t out[LG_OUT];
+    uint8_t in[LG_IN];
+};
+
+/* One thread's share of a load point, and what it measured */
+struct lg_thread {
+    int thread_id;
+    double rate;  // ops/sec
+    uint64_t start_ns, end_ns;
+    uint64_t sent;
+    uint64_t answered;  // before end_ns
+    uint64_t failed;    // answered with an error or a lost TAS/SC
+    uint64_t unanswered;
+    struct rdma_hist h[PROTO_OPS];
+};
+
+static void __record(struct rdma_hist *h, uint64_t ns) {
+    ++h->buckets[rdma_hist_bucket(ns)];
+    ++h->count;
+    h->sum_ns += ns;
+    if (ns > h->max_ns) h->max_ns = ns;
+}
+
+static void __merge(struct rdma_hist *to, const struct rdma_hist *h) {
+    for (int b = 0; b < HIST_BUCKETS; ++b) to->buckets[b] += h->buckets[b];
+    to->count += h->count;
+    to->sum_ns += h->sum_ns;
+    if (h->max_ns > to->max_ns) to->max_ns = h->max_ns;
+}
+
+/* Time to the next arrival */
+static uint64_t __gap(struct lg_thread *t, unsigned *seed) {
+    double mean = 1e9 / t->rate;
+    if (lg.arrival == ARRIVAL_FIXED) return mean;
+    double u = rand_r(seed) / (RAND_MAX + 1.0);
+    return -log(1.0 - u) * mean;
+}
+
+static int __pick_op(unsigned *seed) {
+    uint32_t r = rand_r(seed) % lg.mix_total;
+    int op = 0;
+    while (r >= lg.mix[op]) r -= lg.mix[op++];
+    return op;
+}
+
+static int __connect(const struct node_config *node) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+    struct sockaddr_in addr = {.sin_family = AF_INET,
+                               .sin_addr.s_addr = htonl(node->v),
+                               .sin_port = htons(CLIENT_SERVICE_PORT)};
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("connect");
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+static int __flush(struct lg_conn *c) {
+    for (uint32_t off = 0; off < c->outlen;) {
+        ssize_t n = send(c->fd, c->out + off, c->outlen - off, MSG_NOSIGNAL);
+        if (n < 0) {
+            perror("send");
+            return -1;
+        }
+        off += n;
+    }
+    c->outlen = 0;
+    return 0;
+}
+
+/* Queue one request of kind op, due at due, as a frame of its own */
+static int __issue(struct lg_conn *c, int op, uint64_t due, uint64_t arg) {
+    int body = proto_req_body(&(struct proto_req){.op = op, .count = 1});
+    if (c->outlen + sizeof(struct proto_req) + body > LG_OUT && __flush(c))
+        return -1;
+    uint32_t id = c->free_ids[--c->nfree];
+    struct proto_req req = {
+        .version = PROTO_VERSION, .op = op, .count = 1, .id = id};
+    memcpy(c->out + c->outlen, &req, sizeof(req));
+    if (body) memcpy(c->out + c->outlen + sizeof(req), &arg, sizeof(arg));
+    c->outlen += sizeof(req) + body;
+    c->due[id] = due;
+    c->op[id] = op;
+    return 0;
+}
+
+/* Account for the whole responses received on c. Returns the number */
+static int __responses(struct lg_thread *t, struct lg_conn *c,
+                       uint64_t *faa_high) {
+    uint64_t now = ts_ns();
+    uint32_t off = 0;
+    int n = 0;
+    while (c->inlen - off >= sizeof(struct proto_resp)) {
+        struct proto_resp resp;
+        memcpy(&resp, c->in + off, sizeof(resp));
+        uint32_t len = sizeof(resp) + resp.count * sizeof(int64_t);
+        if (c->inlen - off < len) break;
+        int64_t result = -EIO;
+        if (resp.count) memcpy(&result, c->in + off + sizeof(resp), 8);
+        off += len;
+        if (resp.id >= LG_IDS) continue;
+
+        int op = c->op[resp.id];
+        __record(t->h + op, now - c->due[resp.id]);
+        if (now < t->end_ns) ++t->answered;
+        if (resp.status || result < 0 ||
+            (op != PROTO_FAA && op != PROTO_LL && result))
+            ++t->failed;
+        if (op == PROTO_FAA && result > (int64_t)*faa_high) *faa_high = result;
+        c->free_ids[c->nfree++] = resp.id;
+        ++n;
+    }
+    memmove(c->in, c->in + off, c->inlen - off);
+    c->inlen -= off;
+    return n;
+}
+
+void *lg_thread(void *arg) {
+    struct lg_thread *t = (struct lg_thread *)arg;
+    int n = lg.num_nodes;
+    struct lg_conn *conns = calloc(n, sizeof(*conns));
+    struct pollfd fds[n];
+    if (!conns) {
+        perror("calloc");
+        return NULL;
+    }
+    int nconn = 0;
+    int64_t inflight = 0;
+    for (; nconn < n; ++nconn) {
+        struct lg_conn *c = conns + nconn;
+        if ((c->fd = __connect(net_cfg + nconn)) < 0) goto exit;
+        for (int id = 0; id < lg.depth; ++id) c->free_ids[c->nfree++] = id;
+        fds[nconn] = (struct pollfd){.fd = c->fd, .events = POLLIN};
+    }
+
+    unsigned seed = ts_ns() ^ t->thread_id;
+    // TASes go just past the highest FAA slot seen, where FAAs race them
+    uint64_t faa_high = 0, tas_next = 0;
+    uint64_t due = t->start_ns + __gap(t, &seed);
+    int target = t->thread_id % n;
+    while (1) {
+        // every arrival due by now, including those waiting for an id
+        uint64_t now = ts_ns();
+        for (; due <= now && due < t->end_ns; due += __gap(t, &seed)) {
+            struct lg_conn *c = conns + target;
+            // past the depth, the arrival waits and its latency keeps
+            // counting meanwhile
+            if (!c->nfree) break;
+            int op = __pick_op(&seed);
+            uint64_t arg = 0;
+            if (op == PROTO_TAS) {
+                if (tas_next <= faa_high) tas_next = faa_high + 1;
+                arg = tas_next++;
+            } else if (op == PROTO_SC)
+                arg = rand_r(&seed);
+            if (__issue(c, op, due, arg)) goto exit;
+            ++t->sent;
+            ++inflight;
+            target = (target + 1) % n;
+        }
+        for (int i = 0; i < n; ++i)
+            if (conns[i].outlen && __flush(conns + i)) goto exit;
+
+        if (due >= t->end_ns && !inflight) break;
+        if (now > t->end_ns + LG_DRAIN_NS) break;
+
+        // sleep until the next arrival, or for the stragglers
+        uint64_t wake = due < t->end_ns ? due : t->end_ns + LG_DRAIN_NS;
+        uint64_t wait = wake > now ? wake - now : 0;
+        if (!conns[target].nfree) wait = LG_DRAIN_NS;
+        struct timespec ts = {.tv_sec = wait / 1000000000,
+                              .tv_nsec = wait % 1000000000};
+        if (ppoll(fds, n, &ts, NULL) < 0) {
+            perror("ppoll");
+            goto exit;
+        }
+        for (int i = 0; i < n; ++i) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            struct lg_conn *c = conns + i;
+            ssize_t got =
+                recv(c->fd, c->in + c->inlen, LG_IN - c->inlen, 0);
+            if (got <= 0) {
+                if (got < 0) perror("recv");
+                goto exit;
+            }
+            c->inlen += got;
+            inflight -= __responses(t, c, &faa_high);
+        }
+    }
+
+exit:
+    t->unanswered = inflight;
+    for (int i = 0; i < nconn; ++i) close(conns[i].fd);
+    free(conns);
+    return NULL;
+}
+
+/* Offer rate ops/sec for one point. Returns 0 and fills the merged
+ * measurements of the threads in *sum */
+static int __run_point(double rate, struct lg_thread *sum) {
+    pthread_t threads[lg.threads];
+    struct lg_thread *t = calloc(lg.threads, sizeof(*t));
+    if (!t) return -ENOMEM;
+    uint64_t start = ts_ns() + LG_SETUP_NS;
+    for (int i = 0; i < lg.threads; ++i) {
+        t[i].thread_id = i;
+        t[i].rate = rate / lg.threads;
+        t[i].start_ns = start;
+        t[i].end_ns = start + lg.duration_ns;
+        if (pthread_create(threads + i, NULL, lg_thread, t + i)) {
+            perror("pthread_create");
+            for (int j = 0; j < i; ++j) pthread_join(threads[j], NULL);
+            free(t);
+            return -errno;
+        }
+    }
+
+    memset(sum, 0, sizeof(*sum));
+    for (int i = 0; i < lg.threads; ++i) {
+        pthread_join(threads[i], NULL);
+        sum->sent += t[i].sent;
+        sum->answered += t[i].answered;
+        sum->failed += t[i].failed;
+        sum->unanswered += t[i].unanswered;
+        for (int op = 0; op < PROTO_OPS; ++op)
+            __merge(sum->h + op, t[i].h + op);
+    }
+    free(t);
+    return 0;
+}
+
+static void __report(double offered, struct lg_thread *s, struct rdma_hist *all,
+                     double achieved) {
+    printf("%12.0f %12.0f %9.1f %9.1f %9.1f %9.1f %9.1f %8lu %8lu\n", offered,
+           achieved, node_stats_quantile(all, 0.5) / 1e3,
+           node_stats_quantile(all, 0.9) / 1e3,
+           node_stats_quantile(all, 0.99) / 1e3,
+           node_stats_quantile(all, 0.999) / 1e3, all->max_ns / 1e3,
+           s->failed, s->unanswered);
+    for (int op = 0; op < PROTO_OPS; ++op)
+        if (lg.mix[op] != lg.mix_total && s->h[op].count)
+            printf("%12s %12lu %9.1f %9s %9.1f %9.1f %9.1f\n", __ops[op],
+                   s->h[op].count, node_stats_quantile(s->h + op, 0.5) / 1e3,
+                   "", node_stats_quantile(s->h + op, 0.99) / 1e3,
+                   node_stats_quantile(s->h + op, 0.999) / 1e3,
+                   s->h[op].max_ns / 1e3);
+}
+
+/* FAA:TAS:LL:SC weights, e.g. 90:10 or 50:0:25:25 */
+static int __parse_mix(const char *s) {
+    char *end;
+    lg.mix_total = 0;
+    for (int op = 0; op < PROTO_OPS; ++op) lg.mix[op] = 0;
+    for (int op = 0; op < PROTO_OPS && *s; ++op) {
+        lg.mix[op] = strtoul(s, &end, 10);
+        lg.mix_total += lg.mix[op];
+        if (end == s || (*end && *end != ':')) return -1;
+        s = *end ? end + 1 : end;
+    }
+    return *s || !lg.mix_total ? -1 : 0;
+}
+
+static void __usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-t threads] [-r ops/sec] [-d seconds per point]\n"
+            "          [-q depth] [-a poisson|fixed] [-m FAA:TAS:LL:SC]\n"
+            "          [-s [-f factor]]\n"
+            "  -q caps the requests in flight per connection, 1-%d\n"
+            "  -s sweeps the offered load up from -r by -f (default 1.5) "
+            "per point\n     until past the saturation knee\n",
+            prog, LG_IDS);
+}
+
+int main(int argc, char *argv[]) {
+    double rate = 10000, factor = 1.5;
+    int sweep = 0, opt;
+    lg.threads = 4;
+    lg.depth = LG_IDS;
+    lg.arrival = ARRIVAL_POISSON;
+    lg.duration_ns = 5000000000ULL;
+    lg.num_nodes = sizeof(net_cfg) / sizeof(net_cfg[0]);
+    __parse_mix("1");
+
+    while ((opt = getopt(argc, argv, "t:r:d:q:a:m:sf:")) != -1) {
+        switch (opt) {
+        case 't':
+            lg.threads = atoi(optarg);
+            break;
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 'd':
+            lg.duration_ns = atof(optarg) * 1e9;
+            break;
+        case 'q':
+            lg.depth = atoi(optarg);
+            break;
+        case 'a':
+            if (!strcmp(optarg, "fixed"))
+                lg.arrival = ARRIVAL_FIXED;
+            else if (strcmp(optarg, "poisson"))
+                goto usage;
+            break;
+        case 'm':
+            if (__parse_mix(optarg)) goto usage;
+            break;
+        case 's':
+            sweep = 1;
+            break;
+        case 'f':
+            factor = atof(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc || lg.threads < 1 || lg.depth < 1 ||
+        lg.depth > LG_IDS || rate <= 0 || factor <= 1 || !lg.duration_ns) {
+    usage:
+        __usage(argv[0]);
+        return 1;
+    }
+
+    printf("================================\n\n");
+    printf("Cluster nodes: %d\n", lg.num_nodes);
+    printf("Threads: %d, %s arrivals, %.1f s per point\n", lg.threads,
+           lg.arrival == ARRIVAL_FIXED ? "fixed-rate" : "Poisson",
+           lg.duration_ns / 1e9);
+    printf("Requests in flight per connection: %d\n", lg.depth);
+    printf("Mix FAA:TAS:LL:SC %u:%u:%u:%u\n", lg.mix[0], lg.mix[1], lg.mix[2],
+           lg.mix[3]);
+    printf("================================\n\n");
+    printf("Latency in us from the time each request was due\n");
+    printf("%12s %12s %9s %9s %9s %9s %9s %8s %8s\n", "offered", "achieved",
+           "p50", "p90", "p99", "p99.9", "max", "failed", "unanswd");
+
+    static struct lg_thread s;
+    static struct rdma_hist all;
+    uint64_t base_p99 = 0;
+    double knee = 0, knee_achieved = 0;
+    for (int point = 0; point < (sweep ? SWEEP_POINTS : 1); ++point) {
+        if (__run_point(rate, &s)) return 1;
+        memset(&all, 0, sizeof(all));
+        for (int op = 0; op < PROTO_OPS; ++op) __merge(&all, s.h + op);
+        double achieved = s.answered / (lg.duration_ns / 1e9);
+        __report(rate, &s, &all, achieved);
+
+        uint64_t p99 = node_stats_quantile(&all, 0.99);
+        if (!point) base_p99 = p99;
+        if (achieved < rate * (1 - KNEE_MISS) || s.unanswered ||
+            p99 > KNEE_P99 * base_p99)
+            break;
+        knee = rate;
+        knee_achieved = achieved;
+        rate *= factor;
+    }
+
+    if (sweep) {
+        printf("===============\n");
+        if (knee)
+            printf("Knee: %.0f ops/sec offered, %.0f achieved\n", knee,
+                   knee_achieved);
+        else
+            printf("Saturated at the first point: lower -r\n");
+        printf("===============\n");
+    }
+    return 0;
+}
@@ -0,0 +1,55 @@
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+/* Client wire protocol.
+ * A client pipelines request frames on a connection, each with an id of
+ * its choosing, and the server answers them in any order. A frame carries
+ * up to PROTO_MAX_OPS operations of one kind, run as one batched call.
+ * Every frame starts with the version: a server closes the connection on
+ * a version or frame it does not know */
+#define PROTO_VERSION (2)
+#define PROTO_MAX_OPS (MAX_BATCH)
+/* Unanswered frames a client may have on a connection: a server closes a
+ * connection that sends more */
+#define PROTO_MAX_PIPELINE (256)
+
+enum proto_op {
+  PROTO_FAA, // count slots from the FAA region
+  PROTO_TAS, // TAS of each of the count slots that follow
+  PROTO_LL,  // count Load-Links of the node's register
+  PROTO_SC,  // Load-Link then Store-Conditional of each value that follows
+  PROTO_OPS
+};
+
+struct proto_req {
+  uint8_t version; // PROTO_VERSION
+  uint8_t op;      // enum proto_op
+  uint16_t count;  // operations, 1 to PROTO_MAX_OPS
+  uint32_t id;     // echoed by the response
+  // PROTO_TAS, PROTO_SC: followed by count uint64_t slots or values
+};
+
+struct proto_resp {
+  uint32_t id;
+  uint16_t count;  // results that follow, as int64_t
+  int16_t status;  // 0, or the -errno that cut the frame short
+  // FAA: the slots. TAS: 0 won, 1 lost, or -errno, per slot. LL: the
+  // values. SC: 0 stored, else failed
+};
+
+/* Bytes of a request frame after its header */
+static inline uint32_t proto_req_body(const struct proto_req *req) {
+  int body = req->op == PROTO_TAS || req->op == PROTO_SC;
+  return body ? req->count * sizeof(uint64_t) : 0;
+}
+
+static inline int proto_req_valid(const struct proto_req *req) {
+  return req->version == PROTO_VERSION && req->op < PROTO_OPS &&
+         req->count && req->count <= PROTO_MAX_OPS;
+}
+
+#endif /* PROTO_H */
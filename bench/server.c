@@ -2,94 +2,512 @@
 #include <arpa/inet.h>
 #include <assert.h>
 #include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <pthread.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <unistd.h>
 
 #include "net_map.h"
 #include "node.h"
+#include "proto.h"
+#include "uring.h"
+
+/* RDMA lanes per node, one per worker */
+#define NUM_LANES (32)
+
+/* Local endpoint of the stats, one per node. Every connection gets one
+ * snapshot as text, e.g. socat - UNIX-CONNECT:/tmp/libatomic-0.sock */
+#define STATS_SOCKET "/tmp/libatomic-%d.sock"
+
+/* Client service: NUM_LOOPS io_uring event loops hold every connection,
+ * with multishot accept and multishot recv into provided buffers. Parsed
+ * frames (bench/proto.h) go through a bounded handoff to NUM_WORKERS
+ * threads, each on a lane of its own, which hand the responses back to
+ * the connection's loop. A connection has up to depth frames with the
+ * workers and gets their responses as they finish, batched into one send */
+#define NUM_LOOPS (2)
+#define NUM_WORKERS (NUM_LANES)
+#define HANDOFF_DEPTH (4096)  // frames queued for the workers
+#define RING_ENTRIES (1024)
+#define RECV_BUFS (1024)      // provided receive buffers per loop
+#define RECV_BUF_SIZE (512)
+#define CONN_QUEUE (PROTO_MAX_PIPELINE) // frames waiting their turn
+#define PIPELINE_DEPTH (16)   // default frames of a connection in the workers
+#define SEND_BUF (8192)
+
+/* Completion kinds, in the low bits of the user data pointer */
+enum { EV_ACCEPT, EV_RECV, EV_SEND, EV_WAKE };
+#define EV_TAG(p, ev) ((uint64_t)(uintptr_t)(p) | (ev))
+#define EV_PTR(data) ((void *)(uintptr_t)((data) & ~3ULL))
+
+/* Frames of a connection in flight at once (-d) */
+static int pipeline_depth = PIPELINE_DEPTH;
+
+struct loop;
+struct conn;
+
+/* A frame and its response */
+struct job {
+    struct job *next;  // on the connection's queue or done list
+    struct conn *conn;
+    struct proto_req req;
+    uint64_t slots[PROTO_MAX_OPS];  // or SC values
+    struct proto_resp resp;
+    int64_t results[PROTO_MAX_OPS];
+};
+/* Frames are received straight into req and the slots after it */
+_Static_assert(offsetof(struct job, slots) ==
+                   offsetof(struct job, req) + sizeof(struct proto_req),
+               "slots must follow the request header");
+
+struct conn {
+    int fd;
+    struct loop *loop;
+    struct conn *next;   // on the loop's stalled list
+    struct job *parsing; // frame being received
+    uint32_t nparsed;    // its bytes so far
+    struct job *qhead, *qtail; // frames waiting their turn
+    struct job *out;     // answered frames waiting for the send
+    uint32_t queued;
+    uint32_t inflight;   // frames with the workers
+    uint8_t sending;
+    uint8_t closing;     // no more frames: closed once idle
+    uint8_t dropped;     // shut down while parsing: ignore the rest
+    uint8_t stalled;     // on the stalled list
+    uint8_t ready;       // on a wake's list of answered connections
+    struct conn *ready_next;
+    uint32_t sendlen, sent;
+    uint8_t sendbuf[SEND_BUF];
+};
 
-struct request_msg {
-    uint8_t op_type;  // 0 = FAA, 1 = TAS
-    uint32_t slot;    // For TAS: which slot to test-and-set
+struct loop {
+    struct node_ctx *ctx;
+    struct uring u;
+    struct uring_bufs bufs;
+    int listen_fd;
+    int wake_fd;              // eventfd the workers signal
+    uint64_t wake_buf;
+    pthread_mutex_t lock;
+    struct job *done;         // answered by the workers, under lock
+    struct conn *stalled;     // waiting for room in the handoff
 };
 
-struct client_handler_args {
-    int client_fd;
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+    struct job *jobs[HANDOFF_DEPTH];
+    uint32_t head, tail;
+} handoff = {.lock = PTHREAD_MUTEX_INITIALIZER,
+             .nonempty = PTHREAD_COND_INITIALIZER};
+
+struct worker_args {
     struct node_ctx *ctx;
-    int client_id;
-    int node_id;
+    int worker_id;
 };
 
-void *handle_client(void *arg) {
-    struct client_handler_args *args = (struct client_handler_args *)arg;
-    int client_fd = args->client_fd;
+/* Run a frame as one batched call: a batched FAA, or TASes submitted
+ * together and posted with one doorbell per peer. LL/SC run one by one */
+static void __run(struct node_ctx *ctx, struct job *job) {
+    struct proto_req *req = &job->req;
+    struct proto_resp *resp = &job->resp;
+    resp->id = req->id;
+    resp->status = 0;
+    resp->count = req->count;
+
+    if (req->op == PROTO_FAA) {
+        int got = fetch_and_add_n(ctx, req->count, job->results);
+        resp->count = got < 0 ? 0 : got;
+        if (got < req->count) resp->status = -ENOMEM;
+        return;
+    }
+
+    if (req->op == PROTO_LL || req->op == PROTO_SC) {
+        // the worker serving the next frame may be on another lane, so an
+        // SC links anew within its frame
+        for (int i = 0; i < req->count; ++i) {
+            uint64_t value;
+            int ret = load_link(ctx, &value);
+            if (req->op == PROTO_LL)
+                job->results[i] = ret ? ret : (int64_t)value;
+            else
+                job->results[i] = ret ? ret
+                                      : store_conditional(ctx, job->slots[i]);
+        }
+        return;
+    }
+
+    struct rdma_op *ops[PROTO_MAX_OPS];
+    for (int i = 0; i < req->count; ++i)
+        ops[i] = tas_submit(ctx, job->slots[i], NULL, NULL);
+    for (int i = 0; i < req->count; ++i) {
+        if (!ops[i]) {  // no room on the lane: a blocking TAS
+            job->results[i] = test_and_set(ctx, job->slots[i]);
+            continue;
+        }
+        while (node_op_test(ops[i], job->results + i) == -EINPROGRESS)
+            node_progress(ctx, PROTO_MAX_OPS);
+    }
+}
+
+void *worker_thread(void *arg) {
+    struct worker_args *args = (struct worker_args *)arg;
     struct node_ctx *ctx = args->ctx;
-    int client_id = args->client_id;
-    int node_id = args->node_id;
+    int node_id = ctx->r.c->host_id;
 
     char filename[256];
-    snprintf(filename, sizeof(filename), "latency_node%d_client%d.csv", node_id,
-             client_id);
+    snprintf(filename, sizeof(filename), "latency_node%d_worker%d.csv",
+             node_id, args->worker_id);
     FILE *log = fopen(filename, "w");
     if (log) fprintf(log, "Node,Slot,Latency_us,OpType\n");
-
-    int request_count = 0;
+    int lane = node_lane_acquire(ctx);
 
     while (1) {
-        // Read request
-        struct request_msg req;
-        ssize_t n = recv(client_fd, &req, sizeof(req), MSG_WAITALL);
-        if (n <= 0) break;
-
-        uint64_t start, elapsed;
-        int64_t result;
-        if (req.op_type == 0) {
-            // FAA
-            start = ts_us();
-            result = fetch_and_add(ctx);
-            elapsed = ts_us() - start;
-        } else if (req.op_type == 1) {
-            // TAS
-            start = ts_us();
-            result = test_and_set(ctx, req.slot);
-            elapsed = ts_us() - start;
-        } else
-            continue;
-
-        if (log && result >= 0) {
-            fprintf(log, "%d,%ld,%lu,%d\n", node_id, result, elapsed,
-                    req.op_type);
-            fflush(log);
+        pthread_mutex_lock(&handoff.lock);
+        if (handoff.head == handoff.tail && log) {
+            pthread_mutex_unlock(&handoff.lock);
+            fflush(log);  // idle: nothing waits on the flush
+            pthread_mutex_lock(&handoff.lock);
         }
-
-        // Send response
-        send(client_fd, &result, sizeof(result), 0);
-        ++request_count;
-        if (result == -ENOMEM) break;
+        while (handoff.head == handoff.tail)
+            pthread_cond_wait(&handoff.nonempty, &handoff.lock);
+        struct job *job = handoff.jobs[handoff.head++ % HANDOFF_DEPTH];
+        pthread_mutex_unlock(&handoff.lock);
+
+        uint64_t start = ts_us();
+        __run(ctx, job);
+        uint64_t elapsed = ts_us() - start;
+        for (int i = 0; log && i < job->resp.count; ++i)
+            if (job->results[i] >= 0)
+                fprintf(log, "%d,%ld,%lu,%d\n", node_id,
+                        job->req.op == PROTO_TAS ? (int64_t)job->slots[i]
+                                                 : job->results[i],
+                        elapsed, job->req.op);
+
+        // the loop drains its whole list on a wake: only an empty one
+        // needs a new one
+        struct loop *lp = job->conn->loop;
+        pthread_mutex_lock(&lp->lock);
+        int wake = !lp->done;
+        job->next = lp->done;
+        lp->done = job;
+        pthread_mutex_unlock(&lp->lock);
+        uint64_t one = 1;
+        if (wake && write(lp->wake_fd, &one, sizeof(one)) < 0)
+            perror("write");
     }
 
+    if (lane >= 0) node_lane_release(ctx);
     if (log) fclose(log);
-    close(client_fd);
-    free(args);
     return NULL;
 }
 
-void *client_service_thread(void *arg) {
-    struct node_ctx *ctx = (struct node_ctx *)arg;
-    struct config *c = ctx->r.c;
-    int host_id = c->host_id;
+static void __arm_accept(struct loop *lp) {
+    struct io_uring_sqe *sqe = uring_sqe(&lp->u);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = lp->listen_fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->user_data = EV_TAG(lp, EV_ACCEPT);
+}
+
+/* Give up on a connection the ring has no room for: shut it down and drop
+ * the frames no worker holds, so it closes once its receive has ended */
+static void __abort(struct conn *conn) {
+    conn->dropped = 1;
+    shutdown(conn->fd, SHUT_RDWR);
+    for (struct job *next; conn->qhead; conn->qhead = next) {
+        next = conn->qhead->next;
+        free(conn->qhead);
+    }
+    conn->qtail = NULL;
+    conn->queued = 0;
+    for (struct job *next; conn->out; conn->out = next) {
+        next = conn->out->next;
+        free(conn->out);
+    }
+    conn->sent = conn->sendlen;
+}
+
+static void __arm_recv(struct conn *conn) {
+    struct io_uring_sqe *sqe = uring_sqe(&conn->loop->u);
+    if (!sqe) {
+        __abort(conn);
+        conn->closing = 1;  // no receive left to end it
+        return;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = conn->loop->bufs.bgid;
+    sqe->user_data = EV_TAG(conn, EV_RECV);
+}
+
+static void __arm_wake(struct loop *lp) {
+    struct io_uring_sqe *sqe = uring_sqe(&lp->u);
+    if (!sqe) return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = lp->wake_fd;
+    sqe->addr = (uint64_t)&lp->wake_buf;
+    sqe->len = sizeof(lp->wake_buf);
+    sqe->user_data = EV_TAG(lp, EV_WAKE);
+}
+
+/* Send what is left of the send buffer, refilled with the answered frames
+ * once empty */
+static void __send(struct conn *conn) {
+    if (conn->sent == conn->sendlen) {
+        conn->sendlen = conn->sent = 0;
+        while (conn->out) {
+            struct job *job = conn->out;
+            uint32_t body = job->resp.count * sizeof(int64_t);
+            uint8_t *to = conn->sendbuf + conn->sendlen;
+            if (conn->sendlen + sizeof(job->resp) + body > SEND_BUF) break;
+            memcpy(to, &job->resp, sizeof(job->resp));
+            memcpy(to + sizeof(job->resp), job->results, body);
+            conn->sendlen += sizeof(job->resp) + body;
+            conn->out = job->next;
+            free(job);
+        }
+        if (!conn->sendlen) return;
+    }
+    struct io_uring_sqe *sqe = uring_sqe(&conn->loop->u);
+    if (!sqe) {
+        __abort(conn);
+        return;
+    }
+    conn->sending = 1;
+    sqe->opcode = IORING_OP_SEND;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t)(conn->sendbuf + conn->sent);
+    sqe->len = conn->sendlen - conn->sent;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = EV_TAG(conn, EV_SEND);
+}
+
+/* Hand the connection's queued frames to the workers, up to the depth */
+static void __dispatch(struct conn *conn) {
+    if (conn->stalled) return;
+    while (conn->qhead && conn->inflight < (uint32_t)pipeline_depth) {
+        // the worker reuses next once it has the job
+        struct job *job = conn->qhead, *next = job->next;
+        pthread_mutex_lock(&handoff.lock);
+        int full = handoff.tail - handoff.head == HANDOFF_DEPTH;
+        if (!full) {
+            handoff.jobs[handoff.tail++ % HANDOFF_DEPTH] = job;
+            pthread_cond_signal(&handoff.nonempty);
+        }
+        pthread_mutex_unlock(&handoff.lock);
+        if (full) {
+            // retried once a worker answers, which frees room
+            conn->stalled = 1;
+            conn->next = conn->loop->stalled;
+            conn->loop->stalled = conn;
+            return;
+        }
+        if (!(conn->qhead = next)) conn->qtail = NULL;
+        --conn->queued;
+        ++conn->inflight;
+    }
+}
+
+/* Close a connection whose receives ended once its frames are answered */
+static void __maybe_close(struct conn *conn) {
+    if (!conn->closing || conn->inflight || conn->sending || conn->stalled ||
+        conn->qhead || conn->out)
+        return;
+    free(conn->parsing);
+    close(conn->fd);
+    free(conn);
+}
+
+/* Split received bytes into frames. A malformed one, or one too many,
+ * ends the connection */
+static void __parse(struct conn *conn, const uint8_t *data, uint32_t len) {
+    while (len && !conn->dropped) {
+        if (!conn->parsing && !(conn->parsing = malloc(sizeof(struct job)))) {
+            conn->dropped = 1;
+            shutdown(conn->fd, SHUT_RDWR);
+            return;
+        }
+        struct job *job = conn->parsing;
+        uint32_t need = sizeof(job->req);
+        if (conn->nparsed >= need) need += proto_req_body(&job->req);
+        uint32_t n = need - conn->nparsed;
+        if (n > len) n = len;
+        // the slots follow the header in the job
+        memcpy((uint8_t *)&job->req + conn->nparsed, data, n);
+        conn->nparsed += n;
+        data += n;
+        len -= n;
+        if (conn->nparsed < need) continue;
+        if (need == sizeof(job->req)) {  // the header is in
+            if (!proto_req_valid(&job->req)) {
+                FAA_LOG("Bad frame from a client");
+                conn->dropped = 1;
+                shutdown(conn->fd, SHUT_RDWR);
+                return;
+            }
+            if (proto_req_body(&job->req)) continue;
+        }
+
+        if (conn->queued == CONN_QUEUE) {
+            FAA_LOG("Client overran its frame queue");
+            conn->dropped = 1;
+            shutdown(conn->fd, SHUT_RDWR);
+            return;
+        }
+        job->conn = conn;
+        job->next = NULL;
+        if (conn->qtail)
+            conn->qtail->next = job;
+        else
+            conn->qhead = job;
+        conn->qtail = job;
+        ++conn->queued;
+        conn->parsing = NULL;
+        conn->nparsed = 0;
+    }
+}
+
+static void __on_cqe(struct loop *lp, uint64_t data, int res,
+                     uint32_t flags) {
+    int more = flags & IORING_CQE_F_MORE;
+    switch (data & 3) {
+    case EV_ACCEPT:
+        if (res >= 0) {
+            struct conn *conn = calloc(1, sizeof(*conn));
+            if (!conn) {
+                close(res);
+            } else {
+                int one = 1;
+                setsockopt(res, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                conn->fd = res;
+                conn->loop = lp;
+                __arm_recv(conn);
+                __maybe_close(conn);
+            }
+        } else
+            FAA_LOG("accept: %s", strerror(-res));
+        if (!more) __arm_accept(lp);
+        break;
+
+    case EV_RECV: {
+        struct conn *conn = EV_PTR(data);
+        if (flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            if (res > 0) __parse(conn, uring_buf(&lp->bufs, bid), res);
+            uring_buf_recycle(&lp->bufs, bid);
+        }
+        if (!more) {
+            if (res > 0 || res == -ENOBUFS)
+                __arm_recv(conn);  // out of buffers: they were recycled
+            else
+                conn->closing = 1;
+        }
+        __dispatch(conn);
+        __maybe_close(conn);
+        break;
+    }
 
+    case EV_SEND: {
+        struct conn *conn = EV_PTR(data);
+        conn->sending = 0;
+        if (res < 0) {
+            // the peer is gone: drop what it would have received
+            for (struct job *next; conn->out; conn->out = next) {
+                next = conn->out->next;
+                free(conn->out);
+            }
+            conn->sent = conn->sendlen;
+            shutdown(conn->fd, SHUT_RDWR);
+        } else
+            conn->sent += res;
+        __send(conn);
+        __maybe_close(conn);
+        break;
+    }
+
+    case EV_WAKE: {
+        pthread_mutex_lock(&lp->lock);
+        struct job *done = lp->done;
+        lp->done = NULL;
+        pthread_mutex_unlock(&lp->lock);
+        struct conn *ready = NULL;
+        for (struct job *next; done; done = next) {
+            next = done->next;
+            struct conn *conn = done->conn;
+            done->next = conn->out;  // responses go in any order
+            conn->out = done;
+            --conn->inflight;
+            // the ring stayed full: the node hands out no more slots
+            if (done->resp.status == -ENOMEM) shutdown(conn->fd, SHUT_RDWR);
+            if (!conn->ready) {
+                conn->ready = 1;
+                conn->ready_next = ready;
+                ready = conn;
+            }
+        }
+        // one send per connection for all its answers
+        for (struct conn *next; ready; ready = next) {
+            next = ready->ready_next;
+            ready->ready = 0;
+            if (!ready->sending) __send(ready);
+            __dispatch(ready);
+            __maybe_close(ready);
+        }
+        struct conn *stalled = lp->stalled;
+        lp->stalled = NULL;
+        for (struct conn *next; stalled; stalled = next) {
+            next = stalled->next;
+            stalled->stalled = 0;
+            __dispatch(stalled);
+            __maybe_close(stalled);
+        }
+        __arm_wake(lp);
+        break;
+    }
+    }
+}
+
+void *event_loop_thread(void *arg) {
+    struct loop *lp = (struct loop *)arg;
+    __arm_accept(lp);
+    __arm_wake(lp);
+    while (1) {
+        int ret = uring_submit(&lp->u, 1);
+        if (ret < 0 && ret != -EBUSY) {
+            fprintf(stderr, "io_uring_enter: %s\n", strerror(-ret));
+            break;
+        }
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_cqe(&lp->u))) {
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            uint32_t flags = cqe->flags;
+            uring_cqe_seen(&lp->u);
+            __on_cqe(lp, data, res, flags);
+        }
+    }
+    return NULL;
+}
+
+static int __listen(struct config *c) {
     uint16_t service_port = CLIENT_SERVICE_PORT;
-    uint32_t host_ip = c->c[host_id].v;
+    uint32_t host_ip = c->c[c->host_id].v;
 
     int serverfd = socket(AF_INET, SOCK_STREAM, 0);
     if (serverfd < 0) {
         perror("socket");
-        return NULL;
+        return -1;
     }
 
     int optval = 1;
@@ -103,53 +521,150 @@ void *client_service_thread(void *arg) {
         0) {
         perror("bind");
         close(serverfd);
-        return NULL;
+        return -1;
     }
 
-    if (listen(serverfd, 100) < 0) {
+    if (listen(serverfd, 4096) < 0) {
         perror("listen");
         close(serverfd);
-        return NULL;
+        return -1;
     }
 
-    FAA_LOG("Node %d: Client service listening on %s:%d", host_id,
+    FAA_LOG("Node %d: Client service listening on %s:%d", c->host_id,
             inet_ntoa(server_addr.sin_addr), service_port);
+    return serverfd;
+}
 
-    int client_count = 0;
-    while (1) {
-        struct sockaddr_in client_addr;
-        socklen_t client_len = sizeof(client_addr);
+static int __loop_init(struct loop *lp, struct node_ctx *ctx, int listen_fd) {
+    memset(lp, 0, sizeof(*lp));
+    lp->ctx = ctx;
+    lp->listen_fd = listen_fd;
+    pthread_mutex_init(&lp->lock, 0);
+    int ret = uring_init(&lp->u, RING_ENTRIES);
+    if (!ret) ret = uring_bufs_init(&lp->u, &lp->bufs, 0, RECV_BUFS,
+                                    RECV_BUF_SIZE);
+    if (ret) {
+        fprintf(stderr, "io_uring: %s\n", strerror(-ret));
+        return ret;
+    }
+    if ((lp->wake_fd = eventfd(0, EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        return -errno;
+    }
+    return 0;
+}
 
-        int client_fd =
-            accept(serverfd, (struct sockaddr *)&client_addr, &client_len);
-        if (client_fd < 0) {
-            perror("accept");
-            continue;
+/* Write the node's counters and FAA/TAS latencies as "name value" lines */
+static void write_stats(struct node_ctx *ctx, int fd) {
+    static const char *paths[] = {"fast_win", "fast_loss", "slow", "retried",
+                                  "recovery"};
+    struct rdma_stats *s = malloc(sizeof(*s));
+    if (!s) return;
+    node_stats_snapshot(ctx, s);
+
+    char buf[4096];
+    int len = snprintf(
+        buf, sizeof(buf),
+        "fast %lu\nundecided %lu\nslow %lu\ngave_up %lu\nwc_errors %lu\n"
+        "posted %lu\ndoorbells %lu\npolls %lu\nempty_polls %lu\n",
+        s->c.fast, s->c.undecided, s->c.slow, s->c.gave_up, s->c.wc_errors,
+        s->c.posted, s->c.doorbells, s->c.polls, s->c.empty_polls);
+    for (int p = 0; p < STAT_PATHS; ++p)
+        for (int k = 0; k < 2; ++k) {
+            struct rdma_hist *h = &s->h[k ? STAT_TAS : STAT_FAA][p];
+            if (!h->count || len >= (int)sizeof(buf)) continue;
+            len += snprintf(buf + len, sizeof(buf) - len,
+                            "%s_%s count %lu p50_ns %lu p99_ns %lu max_ns %lu\n",
+                            k ? "tas" : "faa", paths[p], h->count,
+                            node_stats_quantile(h, 0.5),
+                            node_stats_quantile(h, 0.99), h->max_ns);
         }
+    free(s);
+    if (len > (int)sizeof(buf)) len = sizeof(buf);
+    for (int off = 0, n; off < len; off += n)
+        if ((n = send(fd, buf + off, len - off, MSG_NOSIGNAL)) <= 0) break;
+}
+
+void *stats_service_thread(void *arg) {
+    struct node_ctx *ctx = (struct node_ctx *)arg;
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), STATS_SOCKET,
+             ctx->r.c->host_id);
 
-        // Spawn thread to handle this client
-        pthread_t thread;
-        struct client_handler_args *args = malloc(sizeof(*args));
-        args->client_fd = client_fd;
-        args->ctx = ctx;
-        args->client_id = client_count++;
-        args->node_id = host_id;
+    int serverfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (serverfd < 0) {
+        perror("socket");
+        return NULL;
+    }
+    unlink(addr.sun_path);  // left over by an earlier run
+    if (bind(serverfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(serverfd, 8) < 0) {
+        perror("stats socket");
+        close(serverfd);
+        return NULL;
+    }
+    FAA_LOG("Stats on %s", addr.sun_path);
 
-        pthread_create(&thread, NULL, handle_client, args);
-        pthread_detach(thread);
+    while (1) {
+        int fd = accept(serverfd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            perror("accept");
+            break;
+        }
+        write_stats(ctx, fd);
+        close(fd);
     }
 
     close(serverfd);
+    unlink(addr.sun_path);
+    return NULL;
+}
+
+/* Dump the traces on every SIGUSR1, blocked in every other thread */
+void *trace_dump_thread(void *arg) {
+    struct node_ctx *ctx = (struct node_ctx *)arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+
+    char path[64];
+    snprintf(path, sizeof(path), "trace_node%d.json", ctx->r.c->host_id);
+    int sig;
+    while (!sigwait(&set, &sig)) {
+        int ret = node_trace_dump(ctx, path);
+        if (ret)
+            fprintf(stderr, "Trace dump failed: %s\n", strerror(-ret));
+        else
+            FAA_LOG("Traces written to %s", path);
+    }
     return NULL;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <host id>\n", argv[0]);
+    int trace_every = 0, opt;
+    while ((opt = getopt(argc, argv, "t:d:")) != -1) {
+        switch (opt) {
+        case 't':
+            trace_every = atoi(optarg);
+            break;
+        case 'd':
+            pipeline_depth = atoi(optarg);
+            break;
+        default:
+            goto usage;
+        }
+    }
+    if (optind != argc - 1 || pipeline_depth < 1) {
+    usage:
+        fprintf(stderr,
+                "Usage: %s <host id> [-t trace one op in N] "
+                "[-d frames in flight per client, default %d]\n",
+                argv[0], PIPELINE_DEPTH);
         return 1;
     }
 
-    int host_id = atoi(argv[1]);
+    int host_id = atoi(argv[optind]);
     int num_nodes = sizeof(net_cfg) / sizeof(net_cfg[0]);
 
     if (host_id < 0 || host_id >= num_nodes) {
@@ -165,9 +680,17 @@ int main(int argc, char *argv[]) {
         .n = num_nodes,
         .host_id = host_id,
         .rdma_device = 0,
+        .lanes = NUM_LANES,
+        .trace_every = trace_every,
         .c = (struct node_config *)net_cfg,
     };
 
+    // every thread started from here on leaves SIGUSR1 to the dumper
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
     if (node_init(&ctx, &c) != 0) {
         FAA_LOG("Node %d: node_init failed", host_id);
         return 1;
@@ -175,20 +698,44 @@ int main(int argc, char *argv[]) {
 
     FAA_LOG("Node %d: RDMA cluster initialized", host_id);
 
-    // Start client service thread
-    pthread_t service_thread;
-    if (pthread_create(&service_thread, NULL, client_service_thread, &ctx) !=
-        0) {
-        perror("pthread_create");
-        node_destroy(&ctx);
-        return 1;
+    // the stats are best effort: the benchmark runs without them
+    pthread_t stats_thread;
+    if (!pthread_create(&stats_thread, NULL, stats_service_thread, &ctx))
+        pthread_detach(stats_thread);
+    pthread_t trace_thread;
+    if (c.trace_every &&
+        !pthread_create(&trace_thread, NULL, trace_dump_thread, &ctx))
+        pthread_detach(trace_thread);
+
+    // Start the client service: workers, then the loops feeding them
+    static struct loop loops[NUM_LOOPS];
+    static struct worker_args workers[NUM_WORKERS];
+    pthread_t threads[NUM_LOOPS];
+    int listen_fd = __listen(&c);
+    if (listen_fd < 0) goto exit;
+    for (int i = 0; i < NUM_LOOPS; ++i)
+        if (__loop_init(loops + i, &ctx, listen_fd)) goto exit;
+    for (int i = 0; i < NUM_WORKERS; ++i) {
+        pthread_t worker;
+        workers[i] = (struct worker_args){.ctx = &ctx, .worker_id = i};
+        if (pthread_create(&worker, NULL, worker_thread, workers + i)) {
+            perror("pthread_create");
+            goto exit;
+        }
+        pthread_detach(worker);
     }
+    for (int i = 0; i < NUM_LOOPS; ++i)
+        if (pthread_create(threads + i, NULL, event_loop_thread, loops + i)) {
+            perror("pthread_create");
+            goto exit;
+        }
 
     FAA_LOG("Node %d: Client service started", host_id);
 
-    // Wait for service thread
-    pthread_join(service_thread, NULL);
+    // Wait for the loops
+    for (int i = 0; i < NUM_LOOPS; ++i) pthread_join(threads[i], NULL);
 
+exit:
     node_destroy(&ctx);
-    return 0;
+    return 1;
 }
@@ -0,0 +1,172 @@
+#ifndef URING_H
+#define URING_H
+
+/* Minimal io_uring on the raw syscalls: one submission and completion
+ * queue pair, and provided buffer rings for multishot receives.
+ * Multishot accept and recv need Linux 6.0 */
+
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+struct uring {
+  int fd;
+  unsigned *sq_head, *sq_tail, *sq_array, sq_mask;
+  unsigned *cq_head, *cq_tail, cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  unsigned sq_queued; // SQEs filled since the last submit
+  void *sq_ptr, *cq_ptr;
+  size_t sq_len, cq_len, sqes_len;
+};
+
+/* Provided buffer ring: count buffers of size bytes for group bgid */
+struct uring_bufs {
+  struct io_uring_buf_ring *ring;
+  uint8_t *base;
+  uint32_t count;
+  uint32_t size;
+  uint16_t bgid;
+};
+
+static inline int uring_init(struct uring *u, unsigned entries) {
+  struct io_uring_params p;
+  memset(&p, 0, sizeof(p));
+  memset(u, 0, sizeof(*u));
+  u->fd = syscall(__NR_io_uring_setup, entries, &p);
+  if (u->fd < 0) return -errno;
+
+  u->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+  u->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP && u->cq_len > u->sq_len)
+    u->sq_len = u->cq_len;
+  u->sq_ptr = mmap(0, u->sq_len, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+  if (u->sq_ptr == MAP_FAILED) goto err;
+  u->cq_ptr = u->sq_ptr;
+  if (!(p.features & IORING_FEAT_SINGLE_MMAP)) {
+    u->cq_ptr = mmap(0, u->cq_len, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+    if (u->cq_ptr == MAP_FAILED) goto err;
+  }
+  u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+  u->sqes = mmap(0, u->sqes_len, PROT_READ | PROT_WRITE,
+                 MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+  if (u->sqes == MAP_FAILED) goto err;
+
+  uint8_t *sq = u->sq_ptr, *cq = u->cq_ptr;
+  u->sq_head = (unsigned *)(sq + p.sq_off.head);
+  u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+  u->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+  u->sq_array = (unsigned *)(sq + p.sq_off.array);
+  u->cq_head = (unsigned *)(cq + p.cq_off.head);
+  u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+  u->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+  u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+  return 0;
+
+err:
+  close(u->fd);
+  return -errno;
+}
+
+/* Submit the queued SQEs and wait for at least wait completions */
+static inline int uring_submit(struct uring *u, unsigned wait) {
+  unsigned n = u->sq_queued;
+  u->sq_queued = 0;
+  while (n || wait) {
+    int ret = syscall(__NR_io_uring_enter, u->fd, n, wait,
+                      wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      return -errno;
+    }
+    if (!ret && n) return -EBUSY;  // no SQE taken: completions pending
+    n -= ret;
+    wait = 0;
+  }
+  return 0;
+}
+
+/* Next free SQE, zeroed. Submits the queued ones when the ring is full */
+static inline struct io_uring_sqe *uring_sqe(struct uring *u) {
+  unsigned tail = *u->sq_tail;
+  if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > u->sq_mask) {
+    if (uring_submit(u, 0)) return NULL;
+    if (tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) > u->sq_mask)
+      return NULL;
+  }
+  struct io_uring_sqe *sqe = u->sqes + (tail & u->sq_mask);
+  memset(sqe, 0, sizeof(*sqe));
+  u->sq_array[tail & u->sq_mask] = tail & u->sq_mask;
+  __atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+  ++u->sq_queued;
+  return sqe;
+}
+
+/* Oldest unseen completion, or NULL */
+static inline struct io_uring_cqe *uring_cqe(struct uring *u) {
+  unsigned head = *u->cq_head;
+  if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+  return u->cqes + (head & u->cq_mask);
+}
+
+static inline void uring_cqe_seen(struct uring *u) {
+  __atomic_store_n(u->cq_head, *u->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+/* Register count buffers of size bytes (count a power of two) as group
+ * bgid. Receives with IOSQE_BUFFER_SELECT pick one and name it in the CQE */
+static inline int uring_bufs_init(struct uring *u, struct uring_bufs *b,
+                                  uint16_t bgid, uint32_t count,
+                                  uint32_t size) {
+  size_t ring_len = count * sizeof(struct io_uring_buf);
+  b->ring = mmap(0, ring_len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (b->ring == MAP_FAILED) return -errno;
+  if (!(b->base = malloc((size_t)count * size))) {
+    munmap(b->ring, ring_len);
+    return -ENOMEM;
+  }
+  b->count = count;
+  b->size = size;
+  b->bgid = bgid;
+
+  struct io_uring_buf_reg reg = {
+      .ring_addr = (uint64_t)b->ring, .ring_entries = count, .bgid = bgid};
+  if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING, &reg,
+              1)) {
+    free(b->base);
+    munmap(b->ring, ring_len);
+    return -errno;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    struct io_uring_buf *buf = b->ring->bufs + i;
+    buf->addr = (uint64_t)(b->base + (size_t)i * size);
+    buf->len = size;
+    buf->bid = i;
+  }
+  __atomic_store_n(&b->ring->tail, (uint16_t)count, __ATOMIC_RELEASE);
+  return 0;
+}
+
+static inline uint8_t *uring_buf(struct uring_bufs *b, uint16_t bid) {
+  return b->base + (size_t)bid * b->size;
+}
+
+/* Give buffer bid back to the kernel */
+static inline void uring_buf_recycle(struct uring_bufs *b, uint16_t bid) {
+  uint16_t tail = b->ring->tail;
+  struct io_uring_buf *buf = b->ring->bufs + (tail & (b->count - 1));
+  buf->addr = (uint64_t)uring_buf(b, bid);
+  buf->len = b->size;
+  buf->bid = bid;
+  __atomic_store_n(&b->ring->tail, (uint16_t)(tail + 1), __ATOMIC_RELEASE);
+}
+
+#endif /* URING_H */
@@ -1,6 +1,8 @@
 #ifndef ARCH_H
 #define ARCH_H
 
+#include <stdint.h>
+
 /* Architecture-specific CPU pause/yield */
 #if defined(__x86_64__) || defined(__i386__)
     #include <immintrin.h>
@@ -11,4 +13,22 @@
     #define cpu_relax() do {} while (0)
 #endif
 
+/* Architecture-specific cycle counter */
+#if defined(__x86_64__) || defined(__i386__)
+    #define cpu_cycles() __rdtsc()
+#elif defined(__aarch64__)
+    static inline uint64_t cpu_cycles(void) {
+        uint64_t v;
+        __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(v));
+        return v;
+    }
+#else
+    #include <time.h>
+    static inline uint64_t cpu_cycles(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+#endif
+
 #endif /* ARCH_H */
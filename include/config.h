@@ -3,21 +3,30 @@
 
 #include <stdint.h>
 
-#define MAX_SLOTS (1000000)
+#define MAX_SLOTS (1000000) // default slot capacity of a region
+#define CHUNK_SLOTS (1 << 18) // default slots registered at a time
 #define FRONTIER_NODE (0)
+#define MAX_BATCH (64) // max slots reserved by one batched FAA
+#define MAX_OPS (256)   // max in-flight asynchronous ops per lane
+#define SPIN_BUDGET (1 << 14) // default empty polls before blocking
+#define STRIPE_SLOTS (MAX_BATCH) // consecutive slots per striped block
+#define MAX_OBJECTS (256) // max named objects per node
+#define OBJ_SLOTS (1 << 16) // default slot capacity of a named object
+#define OBJ_NAME_LEN (32) // including the terminating NUL
+#define BACKOFF_MAX_US (1000) // default longest contention backoff
+#define TRACE_EVENTS (1 << 14) // trace events kept per lane
 // #define DEBUG (1)
 
 #ifdef DEBUG
 #include <stdio.h>
+#include <time.h>
+/* Stamped with the monotonic clock of the traces, in s */
 #define __FAA_LOG(fmt, ...)                                                    \
   do {                                                                         \
-    time_t _now = time(NULL);                                                  \
-    struct tm _tm;                                                             \
-    localtime_r(&_now, &_tm);                                                  \
-    char _buf[20];                                                             \
-    strftime(_buf, sizeof(_buf), "%Y-%m-%d %H:%M:%S", &_tm);                   \
-    fprintf(stderr, "[%s][%s:%d] " fmt "\n", _buf, __FILE__, __LINE__,         \
-            ##__VA_ARGS__);                                                    \
+    struct timespec _ts;                                                       \
+    clock_gettime(CLOCK_MONOTONIC, &_ts);                                      \
+    fprintf(stderr, "[%ld.%06ld][%s:%d] " fmt "\n", (long)_ts.tv_sec,          \
+            _ts.tv_nsec / 1000, __FILE__, __LINE__, ##__VA_ARGS__);            \
   } while (0)
 #define FAA_LOG(MSG, ...) __FAA_LOG(MSG, ##__VA_ARGS__)
 #else
@@ -38,6 +47,47 @@ struct node_config {
   uint16_t gid_index; // peer ib device global id
 };
 
+/* How blocking calls wait for completions */
+enum poll_mode {
+  POLL_SPIN,     // busy-poll the CQ
+  POLL_BLOCK,    // busy-poll spin_budget times, then sleep on the channel
+  POLL_ADAPTIVE, // as POLL_BLOCK, spinning shorter while waits keep blocking
+};
+
+/* Backing memory of the slot arrays */
+enum mem_mode {
+  MEM_CALLOC,  // heap, faulted in on first touch
+  MEM_HUGE_2M, // pre-faulted 2 MB hugepages, falling back to MEM_CALLOC
+  MEM_HUGE_1G, // pre-faulted 1 GB hugepages, falling back to MEM_CALLOC
+};
+
+/* Who hands out FAA slots */
+enum frontier_mode {
+  FRONTIER_CENTRAL, // remote FAA on FRONTIER_NODE's frontier
+  FRONTIER_STRIPED, // every node hands out its own blocks of slots locally
+  FRONTIER_LEASED,  // remote FAA of a whole range, handed out locally
+};
+
+/* How retries of a conflicting operation back off */
+enum backoff_mode {
+  BACKOFF_EXP,      // doubles per retry, spinning while short
+  BACKOFF_RANDOM,   // uniform up to the exponential bound
+  BACKOFF_ADAPTIVE, // as BACKOFF_RANDOM, bound scaled by the conflict rate
+};
+
+/* When single-slot FAA and TAS go straight to the slow path */
+enum path_mode {
+  PATH_ADAPTIVE, // while the object's fast paths keep ending undecided
+  PATH_FAST,     // never
+  PATH_SLOW,     // always
+};
+
+/* Who decides an LL/SC slot the fast path left undecided */
+enum llsc_recovery {
+  LLSC_COORDINATED, // the coordinator's recovery engine
+  LLSC_LEADERLESS,  // the proposer, with prepare/accept rounds on the slot
+};
+
 /* Node configuration used for network discovery
  * during the initial bootstrapping phase.
  * Every node should have a copy of this struct. */
@@ -45,6 +95,23 @@ struct config {
   uint16_t n;            // number of nodes
   uint16_t host_id;      // this node's rank
   uint8_t rdma_device;   // index into rdma device list
+  uint16_t lanes;        // per-thread RDMA lanes (0 = 1). same on all nodes
+  uint8_t poll_mode;     // enum poll_mode
+  uint32_t spin_budget;  // empty polls before blocking (0 = SPIN_BUDGET)
+  uint8_t mem_mode;      // enum mem_mode
+  uint8_t mem_lock;      // mlock hugepage-backed slot arrays
+  const char *huge_path; // hugetlbfs mount to map from (NULL = anonymous)
+  uint64_t max_slots;    // region capacity (0 = MAX_SLOTS). same on all nodes
+  uint32_t chunk_slots;  // slots registered at a time (0 = CHUNK_SLOTS). same
+  uint64_t init_slots;   // slots registered up front (0 = one chunk). same
+  uint8_t frontier_mode; // enum frontier_mode. same on all nodes
+  uint64_t obj_slots;    // named object capacity (0 = OBJ_SLOTS). same
+  uint32_t read_lease_us; // LL/SC read lease length (0 = no leases). same
+  uint8_t llsc_recovery; // enum llsc_recovery. same on all nodes
+  uint8_t backoff_mode;  // enum backoff_mode
+  uint32_t backoff_max_us; // longest backoff (0 = BACKOFF_MAX_US)
+  uint8_t path_mode;     // enum path_mode
+  uint32_t trace_every;  // trace one op in trace_every per lane (0 = off)
   struct node_config *c; // all nodes
 };
 
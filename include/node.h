@@ -8,9 +8,7 @@ struct node_ctx {
   uint16_t id;
   uint32_t seed;
   struct rdma_ctx r;
-  pthread_mutex_t lock;
-  uint32_t my_index;  // LL/SC: Current index from Load-Link
-  uint64_t my_value;  // LL/SC: Current value from Load-Link
+  uint32_t next_lane; // round-robin cursor for threads without a lane
 };
 
 /* Initialize node context */
@@ -19,12 +17,105 @@ int node_init(struct node_ctx *ctx, struct config *c);
 /* Destroy context */
 void node_destroy(struct node_ctx *ctx);
 
+/* Bind a free RDMA lane to the calling thread so its operations never
+ * contend with other threads. Returns the lane index or -EBUSY */
+int node_lane_acquire(struct node_ctx *ctx);
+
+/* Unbind the calling thread's lane */
+void node_lane_release(struct node_ctx *ctx);
+
 /* Distributed atomic operations */
 int64_t fetch_and_add(struct node_ctx *ctx);
-int64_t test_and_set(struct node_ctx *ctx, uint32_t slot);
+/* Decide k slots with one frontier FAA and one fast path round.
+ * Won slots are written to out. Returns the number of slots won, which is
+ * less than k only when the ring stays full or a slot's chunk is not
+ * mapped here, or -ENOMEM and -EAGAIN for those */
+int fetch_and_add_n(struct node_ctx *ctx, uint32_t k, int64_t *out);
+/* -ERANGE when slot is outside the window of node_watermarks(). The FAA
+ * and TAS calls return -EAGAIN for a slot whose chunk is not mapped here */
+int64_t test_and_set(struct node_ctx *ctx, uint64_t slot);
 
-/* LL/SC operations */
+/* LL/SC operations. The link is the calling thread's: a Store-Conditional
+ * uses the thread's last Load-Link, whichever lane either runs on */
 int load_link(struct node_ctx *ctx, uint64_t *out_value);
 int store_conditional(struct node_ctx *ctx, uint64_t value);
+/* Index of the calling thread's last Load-Link */
+uint64_t node_ll_index(struct node_ctx *ctx);
+
+/* Named objects: counters (OBJ_FAA) and LL/SC registers (OBJ_LLSC), each
+ * with its own frontier and slot ring of config.obj_slots slots. Every
+ * node opens an object under the same name and kind; see rdma_obj_open().
+ * The calls above work on the node's own counter and register, these on
+ * obj, and return -EINVAL for an object of the other kind. A Store-
+ * Conditional fails unless the thread's last Load-Link was on obj */
+struct rdma_region *node_obj_open(struct node_ctx *ctx, const char *name,
+                                  enum obj_kind kind);
+int64_t fetch_and_add_obj(struct node_ctx *ctx, struct rdma_region *obj);
+int64_t test_and_set_obj(struct node_ctx *ctx, struct rdma_region *obj,
+                         uint64_t slot);
+int load_link_obj(struct node_ctx *ctx, struct rdma_region *obj,
+                  uint64_t *out_value);
+int store_conditional_obj(struct node_ctx *ctx, struct rdma_region *obj,
+                          uint64_t value);
+
+/* Asynchronous operations.
+ * Submit calls stage the first phase and return an op handle, or NULL when
+ * no lane is free or the lane has MAX_OPS ops in flight. node_progress()
+ * posts everything staged since the last call with one doorbell per peer
+ * and advances the calling thread's ops. With a callback the handle is
+ * released once the callback returns; without one, node_op_test() returns
+ * the result and releases the handle. Threads issuing asynchronous ops are
+ * bound to a lane; their blocking calls advance the ops in flight too, so
+ * callbacks must not issue blocking calls */
+struct rdma_op *faa_submit(struct node_ctx *ctx, rdma_op_cb cb, void *arg);
+struct rdma_op *tas_submit(struct node_ctx *ctx, uint64_t slot, rdma_op_cb cb,
+                           void *arg);
+/* Store-Conditional on the object of the thread's last Load-Link. NULL
+ * too when the thread has no Load-Link */
+struct rdma_op *sc_submit(struct node_ctx *ctx, uint64_t value, rdma_op_cb cb,
+                          void *arg);
+
+/* Drive up to max completions. Returns the number of ops completed */
+int node_progress(struct node_ctx *ctx, int max);
+
+/* Returns 0 and stores the result once op is done, else -EINPROGRESS */
+int node_op_test(struct rdma_op *op, int64_t *result);
+
+/* Cycles blocking calls spent polling and asleep (config.poll_mode), on
+ * every lane, system lanes included */
+void node_wait_stats(struct node_ctx *ctx, struct rdma_wait_stats *s);
+
+/* LL/SC recoveries this node asked for and, on the coordinator, served */
+void node_recovery_stats(struct node_ctx *ctx, struct rdma_recovery_stats *s);
+
+/* Contention manager (config.backoff_mode) shared by every primitive.
+ * Backoff waits before retry attempt (from 0) of an operation on obj, for
+ * callers retrying a failed Store-Conditional. The stats count obj's
+ * operations, those that conflicted and the backoffs they took */
+void node_backoff(struct node_ctx *ctx, struct rdma_region *obj,
+                  uint32_t attempt);
+void node_conflict_stats(struct node_ctx *ctx, struct rdma_region *obj,
+                         struct rdma_conflicts *s);
+
+/* Latency histograms of every primitive (enum stat_prim) and path (enum
+ * stat_path), kept per lane and merged by the snapshot. Blocking calls
+ * are timed from the call, asynchronous ones from their submission.
+ * Quantile returns the latency at q (0.5, 0.99, 0.999...) in ns */
+void node_stats_snapshot(struct node_ctx *ctx, struct rdma_stats *s);
+uint64_t node_stats_quantile(const struct rdma_hist *h, double q);
+
+/* Operation counters of every lane, system lanes included: fast and slow
+ * path rounds, give-ups, completion errors, posted WRs, doorbells and CQ
+ * polls. Lock-free: readers never stall the lanes */
+void node_stats(struct node_ctx *ctx, struct rdma_counters *s);
+
+/* Phase-level traces (config.trace_every): start, posted phases, first
+ * completion, end of the quorum wait and decision of the sampled ops of
+ * every lane, written to path as Chrome trace JSON. Returns 0 or -errno */
+int node_trace_dump(struct node_ctx *ctx, const char *path);
+
+/* Window of the FAA/TAS slot ring. Slots below low are decided and were,
+ * or are being, reset for reuse. Slots from high on wait for that reset */
+void node_watermarks(struct node_ctx *ctx, uint64_t *low, uint64_t *high);
 
 #endif /* NODE_H */
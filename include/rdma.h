@@ -2,15 +2,23 @@
 #define RDMA_H
 
 #include <infiniband/verbs.h>
+#include <pthread.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "config.h"
 
 /* Remote memory attributes.
  * Exchanged over TCP during the RDMA handshake */
 struct remote_attr {
-  uint64_t addr;
+  uint64_t addr;  // FAA/TAS region directory
   uint32_t rkey;
+  uint64_t laddr; // LL/SC region directory
+  uint32_t lrkey;
+  uint64_t raddr; // LL/SC recovery area
+  uint32_t rrkey;
+  uint64_t oaddr; // named object registry
+  uint32_t orkey;
   uint16_t lid;
   uint32_t qpn;
   uint32_t psn;
@@ -25,59 +33,549 @@ struct prep_res {
 
 /* LL/SC slot entry
  * Since RDMA CAS is 64-bit only, we use two fields:
- * - ballot: 64-bit field for atomic CAS [timestamp:48 | thread_id:16]
+ * - ballot: 64-bit field for atomic CAS [lap:12 | 0 | round:35 | id:16]
  * - value: 64-bit payload, written after ballot CAS succeeds
+ * Values that fit in 24 bits are packed into the ballot instead
+ * [lap:12 | 1 | round:11 | value:24 | id:16], so the CAS that decides
+ * the slot also publishes the value and value is not used
  */
 struct llsc_slot {
-  uint64_t ballot;  // CAS target: encodes thread_id in lower 16 bits
+  uint64_t ballot;  // CAS target: the proposer's lane and node below
   uint64_t value;   // Payload, written after winning CAS
 } __attribute__((packed));
 
-/* Recovery request (for RDMA-based coordinated recovery) */
+/* Recovery request (for RDMA-based coordinated recovery). Node j's
+ * request in its response slot s lives at MRc[j * RECOVERY_SLOTS + s] */
 struct recovery_req {
   uint16_t thread_id;
-  uint32_t slot;
+  uint64_t slot;
+  uint32_t obj;       // id of the LL/SC object, 0 for the node's own
+  uint32_t seq;       // echoed by the response
+  uint8_t valid;      // written last
 } __attribute__((packed));
 
 /* Recovery response (for RDMA-based coordinated recovery) */
 struct recovery_resp {
   uint16_t thread_id;
   uint64_t value;
-  uint64_t ballot;
-  uint8_t valid;
+  uint64_t ballot;    // decided slot word, 0 if nothing was decided
+  uint32_t seq;       // of the request answered
+  uint8_t valid;      // written last
 } __attribute__((packed));
 
+/* Recoveries a node may have outstanding at once */
+#define RECOVERY_SLOTS (64)
+
+struct rdma_ctx;
+struct rdma_lane;
+struct rdma_op;
+
+/* Chunk of a slot region, published in its owner's directory */
+struct chunk_ent {
+  uint64_t addr;
+  uint32_t rkey;
+  uint32_t valid; // set once the chunk is registered
+} __attribute__((packed));
+
+/* Last LL/SC slot a winner published to a replica. next is written
+ * along with the slot, so a head whose next matches the frontier holds the
+ * value a Load-Link of that frontier returns */
+struct llsc_head {
+  uint64_t next;         // frontier once the slot was decided, 0 if none
+  struct llsc_slot slot; // its slot, lap included
+} __attribute__((packed));
+
+/* Registered sources of a lane's RDMA writes. Writes may be unsignaled,
+ * so every kind of write has a field of its own that no other overwrites
+ * while the NIC may still read it */
+struct rdma_stage {
+  uint64_t value;          // LL/SC value written where a ballot CAS won
+  struct llsc_head head;   // head an LL/SC winner publishes
+  struct recovery_req req; // request to the recovery coordinator
+  uint64_t want;           // chunk a peer is asked to register
+  uint64_t revoked;        // flag that ends a reader's lease
+};
+
+/* Head of a slot region (RDMA accessible) */
+struct region_dir {
+  uint64_t frontier;        // next slot (FAA/TAS: used on FRONTIER_NODE)
+  uint64_t want;            // chunk a peer found missing here
+  uint64_t low;             // lowest slot this node may still use
+  uint64_t reclaimed;       // slots below were reset for their next lap
+  struct llsc_head last;    // LL/SC: last slot decided
+  uint64_t readers;         // LL/SC: nodes that may hold a read lease
+  uint64_t revoked;         // LL/SC: set by writers to end our read lease
+  struct chunk_ent chunk[]; // max_chunks entries
+};
+
+/* Words of a directory read by peers to agree on the watermarks */
+#define DIR_HEAD_WORDS (4)
+
+/* Words of a directory read by Load-Link: frontier to last. RDMA may tear
+ * the read between words, so only a head whose ballot packs its value is
+ * trusted */
+#define DIR_LL_WORDS (7)
+#define DIR_ALIGN (64)
+
+/* Kinds of slot regions */
+enum obj_kind {
+  OBJ_FAA,  // FAA/TAS slots (uint64_t)
+  OBJ_LLSC, // LL/SC slots (struct llsc_slot)
+};
+
+/* Entry of the named object registry (RDMA readable). An object lives at
+ * the first free entry from id % MAX_OBJECTS on, and peers probe from
+ * there for its directory */
+struct obj_ent {
+  uint32_t id;    // hash of the name, never 0
+  uint32_t kind;  // enum obj_kind
+  uint64_t addr;  // region directory
+  uint32_t rkey;
+  uint32_t valid; // set once the entry is filled
+} __attribute__((packed));
+
+/* Range of FAA slots leased from the frontier (FRONTIER_LEASED).
+ * Slots are handed out with a CAS on next. A new lease moves next before
+ * end, so a stale end never validates a slot past the old lease */
+struct rdma_lease {
+  uint64_t next;        // next slot to hand out
+  uint64_t end;         // end of the lease
+  uint32_t size;        // slots the next lease asks for
+  uint64_t taken_us;    // when the current lease was taken
+  uint64_t used_us;     // last handout
+  pthread_mutex_t lock; // one lease FAA at a time
+};
+
+/* Reserved FAA slots their caller gave up on while the ring was full.
+ * The grower decides them as no-ops once the ring has room */
+#define MAX_HOLES (64)
+struct rdma_holes {
+  uint64_t from[MAX_HOLES];
+  uint64_t end[MAX_HOLES];
+  uint32_t n;
+  pthread_mutex_t lock;
+};
+
+/* Read lease of this node on an LL/SC region (read_lease_us). The node
+ * sets its bit in the readers word of every replica, then serves Load-Link
+ * from a cached quorum Load-Link until the lease runs out or a writer sets
+ * its revoked word. seq is odd while the cache changes */
+struct rdma_rlease {
+  uint64_t until;       // end of the lease, 0 if none
+  uint64_t index;       // cached Load-Link
+  uint64_t value;
+  uint64_t used_us;     // last Load-Link
+  uint64_t registered;  // replicas whose readers word holds this node
+  uint32_t seq;
+  pthread_mutex_t lock; // one renewal at a time
+};
+
+/* Conflict statistics of an object, shared by every primitive on it.
+ * rate follows the share of recent operations that conflicted and
+ * fast_rate that of recent fast paths left undecided, out of
+ * CONFLICT_ONE */
+struct rdma_conflicts {
+  uint64_t ops;        // operations finished
+  uint64_t conflicts;  // of them, those that retried or failed
+  uint64_t retries;    // retries of all of them
+  uint64_t backoffs;   // waits before a retry
+  uint64_t backoff_ns; // total time of the waits
+  uint64_t fast_skips; // FAA/TAS sent straight to the slow path
+  uint32_t rate;
+  uint32_t fast_rate;
+  uint32_t probe;      // skips since the last fast path
+  uint8_t slow;        // fast paths are skipped
+};
+
+#define CONFLICT_ONE (1 << 10)
+
+/* Slot array registered in chunks as it is used. Peers learn the rkey of
+ * a chunk from the owner's directory the first time they miss it.
+ * Slots form a ring: slot s lives at s % capacity in lap s / capacity.
+ * Slots below the cluster's low watermark are reset for their next lap,
+ * and slots at or past the high watermark wait until every replica has
+ * reset their previous lap */
+struct rdma_region {
+  struct rdma_ctx *r;
+  uint32_t id;              // object id, 0 for the node's own regions
+  uint8_t kind;             // enum obj_kind
+  struct region_dir *dir;
+  struct ibv_mr *dir_mr;
+  struct chunk_ent *dirs;   // n: every node's directory, valid once known
+  uint32_t slot_size;
+  uint32_t chunk_slots;
+  uint32_t max_chunks;
+  uint64_t capacity;        // slots in the ring
+  uint32_t touched;         // highest chunk used locally
+  uint8_t **chunks;         // local base of every chunk, NULL until grown
+  struct ibv_mr **mrs;
+  size_t *mapped;           // rdma_mem_free lengths
+  struct chunk_ent *peers;  // n * max_chunks cache of the peers' directories
+  uint32_t *lookup;         // per peer: 1 + chunk to look up, 0 = none
+  pthread_mutex_t grow_lock;
+
+  /* Watermarks, advanced by the grower */
+  uint64_t mine;            // published dir->low
+  uint64_t low;             // min of every node's low
+  uint64_t high;            // min of every node's reclaimed + capacity
+  uint64_t next_reclaim;    // low of the previous tick, reclaimed next
+  uint32_t scan;            // odd while the grower computes mine
+
+  struct rdma_lease lease;  // OBJ_FAA under FRONTIER_LEASED
+  struct rdma_holes holes;  // OBJ_FAA
+  struct rdma_rlease rlease; // OBJ_LLSC with read_lease_us
+  struct rdma_conflicts conflicts;
+};
+
+/* Time an operation waits for the ring to free its slot */
+#define RING_WAIT_US (1000000)
+
+/* Lowest slot of an idle lane or op */
+#define FLOOR_IDLE UINT64_MAX
+
+/* Slot words carry the ring lap they were written in, above the ballot.
+ * An empty slot holds just its lap, so a CAS or a value left from an
+ * earlier lap never matches a reused slot */
+#define LAP_SHIFT (52)
+#define LAP_MASK (0xFFFULL)
+#define BALLOT_MASK ((1ULL << LAP_SHIFT) - 1)
+
+/* WRs staged per QP between doorbells */
+#define POST_DEPTH (32)
+
+/* Signaled WRs that failed to post, reported as error completions */
+#define MAX_LOST (2 * POST_DEPTH)
+
+/* wr_id of blocking calls: [0 | phase:15 | gen:32 | peer:16] */
+enum rdma_phase {
+  PH_FAST,     // fast path CAS
+  PH_PREPARE,  // slow path reads
+  PH_ACCEPT,   // slow path CAS
+  PH_FRONTIER, // frontier FAA
+  PH_LL,       // Load-Link frontier reads
+  PH_SC,       // Store-Conditional ballot CAS
+  PH_SC_FRONT, // Store-Conditional frontier CAS
+  PH_RECOVERY, // LL/SC recovery traffic
+  PH_WRITE,    // value writes nobody waits on
+  PH_LOOKUP,   // peer chunk directory lookups
+  PH_WATERMARK, // peer directory head reads
+  PH_RLEASE,   // LL/SC read lease registration and revocation
+  PH_SIGNAL = 0x7FFF
+};
+#define SYNC_WR_ID(phase, gen, peer)                         \
+  (((uint64_t)(phase) << 48) | ((uint64_t)(uint32_t)(gen) << 16) | \
+   (uint64_t)(peer))
+#define WR_PHASE(id) (((id) >> 48) & 0x7FFF)
+#define WR_GEN(id) ((uint32_t)((id) >> 16))
+#define WR_PEER(id) ((int)((id) & 0xFFFF))
+
+/* Completion of a forced signal on an unsignaled chain. Carries no result */
+#define WR_ID_SIGNAL SYNC_WR_ID(PH_SIGNAL, 0, 0)
+
+/* WRs staged for one QP until the next doorbell */
+struct rdma_chain {
+  struct ibv_qp *qp;
+  uint16_t len;
+  uint16_t unsignaled; // unsignaled WRs since the last signaled one
+  struct ibv_send_wr wr[POST_DEPTH];
+  struct ibv_sge sge[POST_DEPTH];
+};
+
+/* Asynchronous operation kinds */
+enum rdma_op_kind { OP_FAA, OP_TAS, OP_SC };
+
+/* Asynchronous operation states */
+enum rdma_op_state {
+  OP_FREE,
+  OP_SLOT,    // frontier FAA in flight
+  OP_FAST,    // fast path broadcast in flight
+  OP_PREPARE, // slow path prepare reads in flight
+  OP_ACCEPT,  // slow path accept CASes in flight
+  OP_RECOVER, // LL/SC coordinated recovery
+  OP_RING,    // FAA: waiting for the ring (or progress) to start the slot
+  OP_REVOKE,  // SC: revoking read leases, or waiting them out
+  OP_DONE
+};
+
+/* Completion callback. result follows the blocking call's convention */
+typedef void (*rdma_op_cb)(struct rdma_op *op, int64_t result, void *arg);
+
+/* In-flight asynchronous operation.
+ * WRs are tagged with the op index, its generation and the current round,
+ * so completions from earlier phases are only counted, never applied */
+struct rdma_op {
+  struct rdma_lane *l;
+  uint16_t idx;
+  uint16_t gen;        // bumped when the op is recycled
+  uint16_t round;      // bumped on every phase transition
+  uint8_t kind;
+  uint8_t state;
+  uint8_t retries;
+  uint8_t user;        // handle still held by the caller
+  uint8_t waiting;     // OP_RECOVER: waiting for a response slot
+  uint16_t pending;    // posted WRs whose completion is outstanding
+  uint16_t replies;    // replies in the current round
+  uint16_t successes;
+  uint16_t failures;
+  uint64_t slot;
+  uint64_t floor;      // lowest FAA/TAS slot the op may still use
+  struct rdma_region *g; // object the op works on
+  uint64_t ballot;
+  uint64_t mine;       // FAA/TAS: ballot the op decides its slot with
+  uint64_t value;      // SC value
+  uint64_t proposal;   // accept phase proposal
+  uint64_t won;        // SC: peers whose ballot CAS succeeded
+  uint64_t deadline;   // OP_RECOVER, OP_RING and OP_REVOKE timeout (us)
+  uint64_t started;    // OP_RECOVER: when the recovery began (us)
+  int16_t rslot;       // OP_RECOVER: response slot, -1 until taken
+  uint8_t path;        // enum stat_path so far
+  uint8_t first;       // first completion of the round traced
+  uint32_t trace;      // trace id, 0 unless sampled
+  uint64_t submitted;  // ts_ns() of the submission
+  int64_t result;
+  uint64_t *results;   // registered scratch: one entry per peer
+  uint64_t *fresults;  // registered scratch: frontier CAS per peer, FAA or
+                       // SC value, LL/SC head
+  struct prep_res *prepares;
+  rdma_op_cb cb;
+  void *arg;
+};
+
+/* Timestamp function */
+static inline uint64_t ts_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t ts_us(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000ULL;
+}
+
+/* Latency histograms, log-linear as in HDR histograms: latencies below
+ * 2^HIST_SUB_BITS ns have a bucket each, longer ones 2^HIST_SUB_BITS
+ * buckets per power of two (6% apart), up to 2^HIST_MAX_BITS ns */
+#define HIST_SUB_BITS (4)
+#define HIST_MAX_BITS (36)
+#define HIST_BUCKETS ((HIST_MAX_BITS - HIST_SUB_BITS + 2) << HIST_SUB_BITS)
+
+/* Primitives with latency histograms */
+enum stat_prim { STAT_FAA, STAT_TAS, STAT_LL, STAT_SC, STAT_PRIMS };
+
+/* How an operation was decided. An operation counts under the last of
+ * these it went through */
+enum stat_path {
+  STAT_FAST_WIN,  // fast path, won (LL: answered)
+  STAT_FAST_LOSS, // fast path, another node won (LL: no answer)
+  STAT_SLOW,      // slow path (prepare and accept)
+  STAT_RETRIED,   // took another slot or another attempt
+  STAT_RECOVERY,  // LL/SC recovery, coordinated or leaderless
+  STAT_PATHS
+};
+
+struct rdma_hist {
+  uint64_t count;
+  uint64_t sum_ns;
+  uint64_t max_ns;
+  uint64_t buckets[HIST_BUCKETS];
+};
+
+/* Operation counters of a lane, or of a node once merged */
+struct rdma_counters {
+  uint64_t fast;        // fast path rounds, one per slot
+  uint64_t undecided;   // of them, those that left the slot undecided
+  uint64_t slow;        // slow path rounds (prepare and accept)
+  uint64_t gave_up;     // slots or operations given up, out of retries
+  uint64_t wc_errors;   // completions with an error status
+  uint64_t posted;      // WRs posted
+  uint64_t doorbells;   // ibv_post_send calls
+  uint64_t polls;       // CQ polls
+  uint64_t empty_polls; // of them, those that found no completion
+};
+
+/* Every histogram and counter of a lane, or of a node once merged. The
+ * counters sit on a cache line of their own, ahead of the histograms */
+struct rdma_stats {
+  struct rdma_counters c __attribute__((aligned(64)));
+  struct rdma_hist h[STAT_PRIMS][STAT_PATHS] __attribute__((aligned(64)));
+};
+
+/* Trace events. Phases are numbered as the asynchronous op states */
+enum trace_ev {
+  TRACE_BEGIN,  // arg: enum stat_prim
+  TRACE_PHASE,  // the phase starts posting. arg: enum rdma_op_state
+  TRACE_FIRST,  // first completion of the phase
+  TRACE_QUORUM, // the phase's replies decided it, or no longer can
+  TRACE_END,    // arg: enum stat_path
+};
+
+struct trace_rec {
+  uint64_t ns;  // ts_ns()
+  uint32_t op;  // trace id, per lane
+  uint8_t ev;   // enum trace_ev
+  uint8_t arg;
+  uint16_t pad;
+};
+
+/* Ring of the last TRACE_EVENTS events of a lane. Single writer, like the
+ * histograms: an event is written before head moves past it */
+struct rdma_trace {
+  uint64_t head;     // events written so far
+  uint32_t every;    // trace one op in every
+  uint32_t skipped;  // ops since the last traced one
+  uint32_t seq;      // trace id of the last traced op
+  struct trace_rec ev[TRACE_EVENTS];
+};
+
+/* Per-thread RDMA lane.
+ * A lane owns its CQs, one QP pair to every peer and its registered
+ * scratch buffers, so operations on different lanes never share state.
+ * Lane i on this node is connected to lane i on every peer. */
+struct rdma_lane {
+  struct rdma_ctx *r;
+  uint16_t id;
+  uint64_t round;                 // round of the lane's last ballot
+  struct ibv_cq *cq;              // CQ for consensus operations
+  struct ibv_cq *fcq;             // CQ for frontier operations
+  struct ibv_qp **qp;             // QPs for consensus operations
+  struct ibv_qp **fqp;            // QPs for frontier FAA
+  struct ibv_mr *mr;              // MR covering the scratch buffers
+  uint64_t *results;              // Buffer for slot CAS/reads
+  struct llsc_slot *llsc_results; // Buffer for LL/SC slot reads
+  uint64_t *frontier_results;     // Buffer for frontier reads
+  struct rdma_stage *stage;       // Source buffers for RDMA writes
+  struct prep_res *prepares;
+  pthread_mutex_t lock;           // recursive: callbacks may submit
+  int owned;                      // bound to a thread
+  uint64_t floor;                 // lowest FAA/TAS slot of the blocking call
+  struct rdma_region *held;       // region floor is a slot of
+
+  /* Asynchronous operations */
+  struct rdma_op *ops;            // MAX_OPS entries
+  uint16_t *op_free;              // free op indices (stack)
+  uint16_t op_nfree;
+  uint16_t nrecover;              // ops in OP_RECOVER
+  uint16_t nring;                 // ops in OP_RING
+  uint16_t nrevoke;               // ops in OP_REVOKE
+  uint32_t op_done;               // ops completed (wraps)
+  uint64_t *op_scratch;           // backing store of the ops' scratch
+  struct prep_res *op_prepares;
+  struct ibv_mr *op_mr;           // MR covering op_scratch
+
+  /* Doorbell batching */
+  struct rdma_chain *chains;      // 2 per peer: consensus, frontier
+  struct ibv_wc lost[MAX_LOST];   // signaled WRs that failed to post
+  struct ibv_cq *lost_cq[MAX_LOST]; // CQ each lost WR would complete on
+  int nlost;
+
+  /* Blocking calls */
+  uint32_t sync_gen;              // generation of the current call
+
+  /* Completion waits */
+  struct ibv_comp_channel *channel; // cq and fcq events. NULL when spinning
+  struct ibv_cq *armed;           // CQ last armed for an event
+  uint32_t spin_limit;            // empty polls before blocking
+  uint32_t idle;                  // empty polls of the current wait
+  uint64_t poll_cycles;           // cycles spent polling in blocking calls
+  uint64_t block_cycles;          // cycles spent asleep on the channel
+  uint64_t blocks;                // times a wait went to sleep
+
+  /* Counters and latency histograms, written only by the lane's holder */
+  struct rdma_stats *stats;       // cache-aligned, own lines
+  uint8_t sc_path;                // enum stat_path of the last blocking SC
+
+  /* Tracing (config.trace_every), NULL when off */
+  struct rdma_trace *trace;
+  uint32_t trace_op;              // trace id of the blocking call, or 0
+  uint32_t trace_wait;            // its phase awaits a first completion
+};
+
+/* LL/SC coordinated recoveries. Latencies in us */
+struct rdma_recovery_stats {
+  uint64_t requests; // recoveries this node ran or asked for
+  uint64_t wait_us;  // their total latency, request to response
+  uint64_t max_us;
+  uint64_t served;   // coordinator: requests answered
+  uint64_t batches;  // coordinator: engine rounds that answered any
+  uint64_t serve_us; // coordinator: total time from request seen to answer
+};
+
+/* Coordinator recovery engine. Every round gathers the pending requests,
+ * reads their slots with one doorbell per replica, then writes every
+ * decision and response with another */
+struct rdma_recoverer {
+  pthread_t thread;
+  struct rdma_lane *l;      // the rec lane
+  uint32_t *jobs;           // RECOVERY_BATCH request indices
+  uint64_t *seen_us;        // when each job's request was first seen
+  struct llsc_slot *reads;  // RECOVERY_BATCH * n slot reads
+  struct llsc_slot *decided; // per job: the slot written back
+  struct llsc_head *heads;  // per job: the head published
+  struct recovery_resp *resps; // per job: the response written
+  struct ibv_mr *mr;        // covers reads to resps
+};
+
+/* Time spent waiting for completions by blocking calls, over all lanes,
+ * the grower's and the recovery engine's included */
+struct rdma_wait_stats {
+  uint64_t poll_cycles;
+  uint64_t block_cycles;
+  uint64_t blocks;
+};
+
+/* Lanes after the nlanes per-thread ones: the grower's and the recovery
+ * engine's */
+#define SYS_LANES (2)
+
+/* The low 16 bits of a ballot name its proposer: lane << BALLOT_NODE_BITS
+ * | node. Nodes and lanes, SYS_LANES included, must fit */
+#define BALLOT_NODE_BITS (6)
+#define BALLOT_NODES (1 << BALLOT_NODE_BITS)
+#define BALLOT_LANES (1 << (16 - BALLOT_NODE_BITS))
+#define BALLOT_NODE(ballot) ((int)((ballot) & (BALLOT_NODES - 1)))
+
+/* Above the proposer, a ballot has its round: a per-lane counter that
+ * leaves the top LAP_SHIFT bits of a slot word to its lap and the bit
+ * below them to COMPACT_FLAG */
+#define ROUND_BITS (35)
+#define ROUND_MASK ((1ULL << ROUND_BITS) - 1)
+
 /* Per-node RDMA context */
 struct rdma_ctx {
   struct ibv_context *ctx;
   uint16_t lid;
   uint8_t gid[16];
   struct ibv_pd *pd;
-  struct ibv_mr *mr[2];
-  struct ibv_cq *cq;   // CQ for consensus operations
-  struct ibv_cq *fcq;  // CQ for frontier operations
-  struct ibv_qp **qp;  // QPs for consensus operations
-  struct ibv_qp **fqp; // QPs for frontier FAA
-  struct {             // Shared (RDMA accessible)
-    uint64_t frontier;
-    uint64_t slots[MAX_SLOTS];
-  } *shared_mem;
-  uint64_t *results;
-  struct prep_res *prepares;
+  struct rdma_region faa; // FAA/TAS slots (uint64_t)
+  struct rdma_lane *lanes;
+  uint16_t nlanes;
+  struct rdma_lane *ctl;  // lane of the grower, after the nlanes lanes
+  struct rdma_lane *rec;  // lane of the recovery engine, after ctl
+  pthread_t grower;       // grows the regions and looks up peer chunks
+  int stop;
   struct remote_attr *ra;
   int max_inline;
+  int max_cqe;
   struct config *c;
 
   /* LL/SC specific fields */
-  struct ibv_mr *llsc_mr[2];           // MRs for LL/SC: [0]=slots, [1]=recovery
-  struct {                             // LL/SC slots (RDMA accessible)
-    uint64_t frontier;                 // Current frontier at this replica
-    struct llsc_slot slots[MAX_SLOTS]; // Mi[t] := ⟨ballot, value⟩
-  } *llsc_mem;
-  struct recovery_req *recovery_reqs;  // MRc[j]: recovery requests (coordinator only)
-  struct recovery_resp *recovery_resp; // MSj: recovery response (spinning area)
-  struct llsc_slot *llsc_results;      // Buffer for LL/SC slot reads
-  uint64_t *frontier_results;          // Buffer for frontier reads
+  struct rdma_region llsc;             // Mi[t] := ⟨ballot, value⟩, frontier
+  struct ibv_mr *recovery_mr;          // covers recovery_reqs and recovery_resp
+  struct recovery_req *recovery_reqs;  // MRc: n * RECOVERY_SLOTS requests (coordinator only)
+  struct recovery_resp *recovery_resp; // MSj: RECOVERY_SLOTS responses (spinning areas)
+  uint64_t recovery_free;              // response slots not in use
+  uint32_t recovery_seq;               // tags requests
+  struct rdma_recovery_stats recovery_stats;
+  struct rdma_recoverer recoverer;     // coordinator only
+
+  /* Named objects */
+  struct obj_ent *registry;            // MAX_OBJECTS entries, then a peer's
+  struct ibv_mr *registry_mr;
+  struct rdma_region **objs;           // by registry entry, NULL when free
+  char (*obj_names)[OBJ_NAME_LEN];
+  pthread_mutex_t obj_lock;            // serializes opens
 };
 
 /* Initialize RDMA context */
@@ -86,41 +584,491 @@ int rdma_init(struct rdma_ctx *r, struct config *c);
 /* Destroy RDMA context */
 void rdma_destroy(struct rdma_ctx *r);
 
-/* Get next slot from frontier node */
-uint64_t rdma_get_next_slot(struct rdma_ctx *r);
+/* Allocate nb zeroed bytes as config.mem_mode asks. *mapped is the
+ * length to pass to rdma_mem_free, 0 when it fell back to the heap */
+void *rdma_mem_alloc(struct config *c, size_t nb, size_t *mapped);
+void rdma_mem_free(void *p, size_t mapped);
 
-/* Fast path operations */
-int rdma_bcas(struct rdma_ctx *r, uint32_t slot, uint64_t swp);
-#define rdma_btas(r, slot) rdma_bcas(r, slot, 1)
+/* Slot regions of kind with room for max_slots slots */
+int rdma_region_init(struct rdma_ctx *r, struct rdma_region *g, uint8_t kind,
+                     uint64_t max_slots);
+void rdma_region_destroy(struct rdma_region *g);
 
-/* Slow path */
-int rdma_slow_path(struct rdma_ctx *r, uint32_t slot, uint64_t ballot,
-                   uint64_t proposed_value);
+/* Register chunk k locally and publish it. Returns its base or NULL */
+uint8_t *rdma_region_grow(struct rdma_region *g, uint32_t k);
 
-/* LL/SC operations */
-int rdma_load_link(struct rdma_ctx *r, uint32_t *out_index, uint64_t *out_value);
-int rdma_store_conditional(struct rdma_ctx *r, uint32_t index, uint64_t value);
+/* Start (and stop) the thread that grows the regions ahead of use and
+ * looks up the peer chunks that missed */
+int rdma_grower_start(struct rdma_ctx *r);
+void rdma_grower_stop(struct rdma_ctx *r);
 
-/* LL/SC slow path (coordinated recovery) */
-int rdma_llsc_slow_path(struct rdma_ctx *r, uint32_t slot, uint64_t value,
-                        uint16_t thread_id, uint64_t ballot);
+/* Wait until slots below end may be used. -1 if the ring stays full for
+ * RING_WAIT_US, as when a replica stopped advancing its watermark */
+int rdma_region_wait(struct rdma_lane *l, struct rdma_region *g, uint64_t end);
 
-/* Coordinator recovery processing (call periodically from coordinator) */
-void rdma_llsc_process_recovery(struct rdma_ctx *r);
+/* Pin slot to *floor for an operation on a slot it did not reserve.
+ * -ERANGE (and *floor reset) when slot is outside the ring's window */
+int rdma_region_hold(struct rdma_region *g, uint64_t *floor, uint64_t slot);
 
-/* Timestamp function */
-static inline uint64_t ts_us(void) {
-  struct timespec ts;
-  clock_gettime(CLOCK_MONOTONIC, &ts);
-  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000ULL;
+/* Lowest slot this node may still use and the window the cluster agreed
+ * on: slots in [low, high) may be used */
+static inline void rdma_region_watermarks(struct rdma_region *g,
+                                          uint64_t *low, uint64_t *high) {
+  *low = __atomic_load_n(&g->low, __ATOMIC_ACQUIRE);
+  *high = __atomic_load_n(&g->high, __ATOMIC_ACQUIRE);
+}
+
+/* Word of an empty slot in its lap */
+static inline uint64_t rdma_slot_lap(struct rdma_region *g, uint64_t slot) {
+  return ((slot / g->capacity) & LAP_MASK) << LAP_SHIFT;
+}
+
+/* Ballot held in a slot word, 0 when empty. -1 if the word belongs to
+ * another lap */
+static inline int rdma_slot_ballot(struct rdma_region *g, uint64_t slot,
+                                   uint64_t word, uint64_t *ballot) {
+  if ((word & ~BALLOT_MASK) != rdma_slot_lap(g, slot)) return -1;
+  *ballot = word & BALLOT_MASK;
+  return 0;
+}
+
+/* Proposer id of the ballots of lane l */
+static inline uint16_t rdma_ballot_id(const struct rdma_lane *l) {
+  return l->id << BALLOT_NODE_BITS | l->r->c->host_id;
+}
+
+/* Flag of an LL/SC ballot that carries its value. Its round keeps only
+ * the low COMPACT_ROUND_BITS of the lane's counter, above the value */
+#define COMPACT_FLAG (1ULL << (LAP_SHIFT - 1))
+#define COMPACT_ROUND_BITS (11)
+#define COMPACT_VALUE_BITS (24)
+#define COMPACT_VALUE_MAX ((1ULL << COMPACT_VALUE_BITS) - 1)
+
+/* Round of a ballot, of rdma_round_bits() bits */
+static inline int rdma_round_bits(uint64_t ballot) {
+  return (ballot & COMPACT_FLAG) ? COMPACT_ROUND_BITS : ROUND_BITS;
+}
+
+static inline uint64_t rdma_ballot_round(uint64_t ballot) {
+  int shift = (ballot & COMPACT_FLAG) ? 16 + COMPACT_VALUE_BITS : 16;
+  return (ballot >> shift) & ((1ULL << rdma_round_bits(ballot)) - 1);
+}
+
+/* Signed distance from round b to round a over their low bits. Rounds
+ * wrap, so of two rounds less than half the round space apart the one
+ * ahead is the newer */
+static inline int64_t rdma_round_diff(uint64_t a, uint64_t b, int bits) {
+  return (int64_t)((a - b) << (64 - bits)) >> (64 - bits);
+}
+
+/* Whether ballot a is newer than ballot b: a later round, or the same
+ * round of a higher proposer. Against a compact ballot only the low
+ * COMPACT_ROUND_BITS of the rounds compare */
+static inline int rdma_ballot_after(uint64_t a, uint64_t b) {
+  int bits = ((a | b) & COMPACT_FLAG) ? COMPACT_ROUND_BITS : ROUND_BITS;
+  int64_t d = rdma_round_diff(rdma_ballot_round(a), rdma_ballot_round(b),
+                              bits);
+  return d > 0 || (!d && (a & 0xFFFF) > (b & 0xFFFF));
+}
+
+/* Next round of lane l. Every ballot of the lane takes one, so a ballot
+ * names one attempt of the lane. No clock is involved and nothing is lost
+ * when the round wraps */
+static inline uint64_t rdma_next_round(struct rdma_lane *l) {
+  l->round = (l->round + 1) & ROUND_MASK;
+  if (l->round == 0)
+    l->round = 1;
+  return l->round;
+}
+
+/* Generate a ballot of lane l: (round << 16) | rdma_ballot_id(l) */
+static inline uint64_t gen_ballot(struct rdma_lane *l) {
+  return (rdma_next_round(l) << 16) | rdma_ballot_id(l);
+}
+
+/* Move lane l's round up to the newest of the n prepare replies p, so its
+ * next ballot outranks them. Lanes that propose rarely catch up with busy
+ * ones this way instead of failing their promise checks */
+static inline void rdma_ballots_seen(struct rdma_lane *l,
+                                     const struct prep_res *p, int n) {
+  for (int i = 0; i < n; ++i) {
+    uint64_t b = p[i].ballot;
+    if (!p[i].success || !b)
+      continue;
+    int64_t d = rdma_round_diff(rdma_ballot_round(b), l->round,
+                                rdma_round_bits(b));
+    if (d > 0)
+      l->round = (l->round + d) & ROUND_MASK;
+  }
+}
+
+/* Ballot of lane l packing value, or 0 if value needs the value word. The
+ * round, lane and node keep two SCs of one value at one index apart, up
+ * to 2^COMPACT_ROUND_BITS ballots of a lane */
+static inline uint64_t rdma_llsc_compact(struct rdma_lane *l,
+                                         uint64_t value) {
+  if (value > COMPACT_VALUE_MAX)
+    return 0;
+  uint64_t round = rdma_next_round(l) & ((1ULL << COMPACT_ROUND_BITS) - 1);
+  return COMPACT_FLAG | round << (16 + COMPACT_VALUE_BITS) | value << 16 |
+         rdma_ballot_id(l);
+}
+
+/* Value of an LL/SC slot holding ballot (without its lap) */
+static inline uint64_t rdma_llsc_value(uint64_t ballot,
+                                       const volatile struct llsc_slot *s) {
+  return (ballot & COMPACT_FLAG) ? (ballot >> 16) & COMPACT_VALUE_MAX
+                                 : s->value;
+}
+
+/* Local address of slot, registering its chunk on first use. NULL if the
+ * chunk cannot be registered */
+static inline void *rdma_region_slot(struct rdma_region *g, uint64_t slot) {
+  slot %= g->capacity;
+  uint32_t k = slot / g->chunk_slots;
+  uint8_t *base = __atomic_load_n(&g->chunks[k], __ATOMIC_ACQUIRE);
+  if (!base && !(base = rdma_region_grow(g, k))) return NULL;
+  if (k > g->touched) g->touched = k;
+  return base + (slot % g->chunk_slots) * g->slot_size;
+}
+
+/* Address of slot on peer, or 0 while the peer's chunk is not known yet.
+ * A miss queues a directory lookup: callers count the peer as failed */
+static inline uint64_t rdma_region_raddr(struct rdma_region *g, int peer,
+                                         uint64_t slot, uint32_t *rkey) {
+  slot %= g->capacity;
+  uint32_t k = slot / g->chunk_slots;
+  struct chunk_ent *e = g->peers + (size_t)peer * g->max_chunks + k;
+  if (!__atomic_load_n(&e->valid, __ATOMIC_ACQUIRE)) {
+    g->lookup[peer] = k + 1;
+    return 0;
+  }
+  *rkey = e->rkey;
+  return e->addr + (slot % g->chunk_slots) * g->slot_size;
+}
+
+#define rdma_faa_slot(g, slot) ((uint64_t *)rdma_region_slot(g, slot))
+#define rdma_llsc_slot(g, slot) \
+  ((struct llsc_slot *)rdma_region_slot(g, slot))
+
+/* Directory of region g on peer, or 0 while the peer's is not known */
+static inline uint64_t rdma_region_dir(struct rdma_region *g, int peer,
+                                       uint32_t *rkey) {
+  struct chunk_ent *e = g->dirs + peer;
+  if (!__atomic_load_n(&e->valid, __ATOMIC_ACQUIRE)) return 0;
+  *rkey = e->rkey;
+  return e->addr;
+}
+
+/* Named objects. Open creates the object, or returns it if this node
+ * already has it under that name. An object exists cluster-wide once every
+ * node opened it: the grower looks up the peers' directories until then,
+ * and operations count the peers it has not found as failed.
+ * Returns NULL with errno set (EINVAL, EEXIST on a hash collision or a
+ * kind mismatch, ENOSPC when the registry is full) */
+struct rdma_region *rdma_obj_open(struct rdma_ctx *r, const char *name,
+                                  uint8_t kind);
+
+/* Region of object id (0: the node's LL/SC region), or NULL */
+struct rdma_region *rdma_obj_find(struct rdma_ctx *r, uint32_t id);
+
+/* Look up the directories of the objects peers were not known to have.
+ * Called by the grower */
+void rdma_obj_resolve(struct rdma_ctx *r);
+
+int rdma_obj_init(struct rdma_ctx *r);
+void rdma_obj_destroy(struct rdma_ctx *r);
+
+/* Sum the completion wait counters of every lane, system lanes included */
+void rdma_wait_stats(struct rdma_ctx *r, struct rdma_wait_stats *s);
+
+/* Histogram bucket of a latency, and the highest latency it holds */
+static inline uint32_t rdma_hist_bucket(uint64_t ns) {
+  if (ns < (1ULL << HIST_SUB_BITS)) return ns;
+  int e = 63 - __builtin_clzll(ns);
+  if (e > HIST_MAX_BITS) return HIST_BUCKETS - 1;
+  return ((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) +
+         ((ns >> (e - HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+}
+
+uint64_t rdma_hist_value(uint32_t bucket);
+
+/* Record a latency on the lane. Single writer: relaxed stores are enough
+ * for a concurrent snapshot not to tear a counter */
+static inline void rdma_stats_record(struct rdma_lane *l, int prim, int path,
+                                     uint64_t ns) {
+  struct rdma_hist *h = &l->stats->h[prim][path];
+  uint64_t *b = h->buckets + rdma_hist_bucket(ns);
+  __atomic_store_n(b, *b + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->count, h->count + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&h->sum_ns, h->sum_ns + ns, __ATOMIC_RELAXED);
+  if (ns > h->max_ns) __atomic_store_n(&h->max_ns, ns, __ATOMIC_RELAXED);
+}
+
+/* Add k to counter f of the lane, single writer as above */
+#define rdma_count(l, f, k)                                                  \
+  __atomic_store_n(&(l)->stats->c.f, (l)->stats->c.f + (k), __ATOMIC_RELAXED)
+
+/* Record ev of trace id op, if it is one */
+static inline void rdma_trace_ev(struct rdma_lane *l, uint32_t op, uint8_t ev,
+                                 uint8_t arg) {
+  if (!op) return;
+  struct rdma_trace *t = l->trace;
+  // a dump that sees the entry rewritten sees the head that passed it
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  t->ev[t->head % TRACE_EVENTS] =
+      (struct trace_rec){.ns = ts_ns(), .op = op, .ev = ev, .arg = arg};
+  __atomic_store_n(&t->head, t->head + 1, __ATOMIC_RELEASE);
+}
+
+/* Sample an operation of prim. Returns its trace id, 0 if not traced */
+static inline uint32_t rdma_trace_begin(struct rdma_lane *l, uint8_t prim) {
+  struct rdma_trace *t = l->trace;
+  if (!t || ++t->skipped < t->every) return 0;
+  t->skipped = 0;
+  if (!++t->seq) ++t->seq;
+  rdma_trace_ev(l, t->seq, TRACE_BEGIN, prim);
+  return t->seq;
+}
+
+/* Blocking calls: the call's phase starts posting, its first completion
+ * is recorded by rdma_wait */
+static inline void rdma_trace_phase(struct rdma_lane *l, uint8_t phase) {
+  rdma_trace_ev(l, l->trace_op, TRACE_PHASE, phase);
+  l->trace_wait = l->trace_op;
+}
+
+static inline void rdma_trace_quorum(struct rdma_lane *l) {
+  rdma_trace_ev(l, l->trace_op, TRACE_QUORUM, 0);
+  l->trace_wait = 0;
+}
+
+static inline void rdma_trace_end(struct rdma_lane *l, uint8_t path) {
+  rdma_trace_ev(l, l->trace_op, TRACE_END, path);
+  l->trace_op = 0;
+  l->trace_wait = 0;
+}
+
+/* Write the rings of every lane as Chrome trace JSON */
+int rdma_trace_dump(struct rdma_ctx *r, FILE *f);
+
+/* Merge the histograms and counters of every lane into s */
+void rdma_stats_snapshot(struct rdma_ctx *r, struct rdma_stats *s);
+
+/* Sum the counters of every lane, system lanes included */
+void rdma_counters_snapshot(struct rdma_ctx *r, struct rdma_counters *s);
+
+/* Latency at quantile q (0 to 1) of h, in ns. 0 if h is empty */
+uint64_t rdma_hist_quantile(const struct rdma_hist *h, double q);
+
+/* Striped frontier: block b of STRIPE_SLOTS slots belongs to node b % n.
+ * A node counts the slots it handed out in its directory frontier, and
+ * its x-th slot is */
+static inline uint64_t rdma_stripe_slot(struct config *c, uint64_t x) {
+  uint64_t block = x / STRIPE_SLOTS;
+  return (block * c->n + c->host_id) * STRIPE_SLOTS + x % STRIPE_SLOTS;
+}
+
+/* Reserve k consecutive slots (k <= MAX_BATCH) from the frontier. Returns
+ * the first slot, or -1 if the frontier node could not be reached */
+uint64_t rdma_get_next_slots(struct rdma_lane *l, struct rdma_region *g,
+                             uint32_t k);
+
+/* FAA of k on FRONTIER_NODE's frontier. Returns the old value or -1 */
+uint64_t rdma_frontier_faa(struct rdma_lane *l, struct rdma_region *g,
+                           uint64_t k);
+
+/* Leased frontier. rdma_lease_try hands out k slots from the current
+ * lease or returns -1. rdma_lease_next leases a new range when it has to,
+ * deciding the old tail as no-ops. rdma_lease_tick, from the grower,
+ * fills the tail of a lease idle for LEASE_TTL_US */
+uint64_t rdma_lease_try(struct rdma_region *g, uint32_t k);
+uint64_t rdma_lease_next(struct rdma_lane *l, struct rdma_region *g,
+                         uint32_t k);
+void rdma_lease_tick(struct rdma_region *g);
+
+/* Leave slots [from, end) for the grower to decide as no-ops, once the
+ * ring has room for them. rdma_holes_tick, from the grower, fills them */
+void rdma_hole_add(struct rdma_region *g, uint64_t from, uint64_t end);
+void rdma_holes_tick(struct rdma_region *g);
+
+/* Value of a slot decided as a no-op: a gap in the log. It has
+ * COMPACT_FLAG set, which gen_ballot never does */
+#define NOOP_BALLOT(id) ((BALLOT_MASK & ~0xFFFFULL) | (id))
+
+/* Reserve k consecutive slots from this node's stripe. A run never
+ * straddles two blocks: the rest of a block too short for it is a gap */
+uint64_t rdma_stripe_next(struct rdma_region *g, uint32_t k);
+#define rdma_get_next_slot(l, g) rdma_get_next_slots(l, g, 1)
+
+/* Stage a WR for the lane's consensus (or frontier) QP to peer. Only WRs
+ * flagged IBV_SEND_SIGNALED complete on the CQ and small RDMA writes are
+ * inlined, so their source may be reused after the flush. Returns the
+ * number of doorbells rung by a full chain */
+int rdma_stage(struct rdma_lane *l, int peer, int frontier,
+               struct ibv_send_wr *wr);
+
+/* Post every staged chain, one doorbell per QP. Returns the doorbells */
+int rdma_flush(struct rdma_lane *l);
+
+/* ibv_poll_cq that also reports the WRs of cq that failed to post */
+int rdma_poll(struct rdma_lane *l, struct ibv_cq *cq, int n,
+              struct ibv_wc *wc);
+
+/* Start a blocking call on the lane. Its WRs are tagged with the returned
+ * generation, so it may return at quorum and leave the late replies */
+static inline uint32_t rdma_sync_begin(struct rdma_lane *l) {
+  l->idle = 0;
+  return ++l->sync_gen;
 }
 
-/* Generate ballot number: (timestamp << 16) | node_id */
-static inline uint64_t gen_ballot(uint16_t node_id) {
-  uint64_t ts = ts_us() & 0xFFFFFFFFFFFFULL;
-  if (ts == 0)
-    ts = 1;
-  return (ts << 16) | node_id;
+/* Completion dispatcher of blocking calls. Drains up to n entries of cq,
+ * routes those of asynchronous ops to their op, drops late replies of
+ * earlier calls and returns the completions of the current call in wc.
+ * Past the lane's spin limit an empty poll sleeps until cq has an event */
+int rdma_wait(struct rdma_lane *l, struct ibv_cq *cq, int n,
+              struct ibv_wc *wc);
+
+/* Account an empty poll of the current wait. Arms cq once the spin limit
+ * is reached and sleeps on the lane's channel on the next empty poll */
+void rdma_idle(struct rdma_lane *l, struct ibv_cq *cq);
+
+/* A wait got what it was waiting for */
+void rdma_wait_done(struct rdma_lane *l);
+
+/* One iteration of a wait on local memory. Past the spin limit it naps
+ * instead of spinning, unless the mode is POLL_SPIN */
+void rdma_relax(struct rdma_lane *l);
+
+/* Fast path operations */
+int rdma_bcas(struct rdma_lane *l, struct rdma_region *g, uint64_t slot,
+              uint64_t swp);
+int rdma_bcas_n(struct rdma_lane *l, struct rdma_region *g, uint64_t slot,
+                uint32_t k, uint64_t swp, int *res);
+
+/* Slow path: a prepare/accept round of ballot proposing proposed_value.
+ * Returns 0 if the slot is decided with proposed_value, 1 if with another
+ * value and -1 if it is left undecided */
+int rdma_slow_path(struct rdma_lane *l, struct rdma_region *g, uint64_t slot,
+                   uint64_t ballot, uint64_t proposed_value);
+
+/* 0 or 1 once a fast quorum of the prepare replies agrees on a ballot (0
+ * when it is mine), -1 while no ballot has a fast quorum */
+int rdma_prepare_decided(struct config *c, struct prep_res *results,
+                         uint64_t mine);
+
+/* Evaluate the prepare replies of a slot. Returns 0 or 1 if a fast quorum
+ * already decided it (0 when it holds proposed_value), -1
+ * without a classic quorum of promises and 2 if the accept phase should
+ * propose *proposal */
+int rdma_prepare_outcome(struct config *c, struct prep_res *results,
+                         uint64_t ballot, uint64_t proposed_value,
+                         uint64_t *proposal);
+
+/* LL/SC operations. Load-Link returns the highest frontier of a quorum
+ * and the value of the slot behind it, or -1 while no replica of the
+ * quorum published that slot and a majority does not hold it yet.
+ * rdma_llsc_read always reads the quorum; rdma_load_link serves it from
+ * the node's read lease when leases are on */
+int rdma_llsc_read(struct rdma_lane *l, struct rdma_region *g,
+                   uint64_t *out_index, uint64_t *out_value);
+int rdma_load_link(struct rdma_lane *l, struct rdma_region *g,
+                   uint64_t *out_index, uint64_t *out_value);
+int rdma_store_conditional(struct rdma_lane *l, struct rdma_region *g,
+                           uint64_t index, uint64_t value);
+
+/* Record slot, decided with h->slot, as the last slot of g here and on
+ * every replica. h is the registered source of the writes (lkey): they
+ * are signaled with gen unless inlined. The caller flushes */
+void rdma_llsc_publish(struct rdma_lane *l, struct rdma_region *g,
+                       struct llsc_head *h, uint32_t lkey, uint32_t gen);
+
+/* Clocks of two nodes drift apart by at most 1/RLEASE_DRIFT */
+#define RLEASE_DRIFT (100)
+
+/* Time a writer waits for a read lease it could not revoke to run out */
+#define RLEASE_WAIT_US(us) ((us) + (us) / RLEASE_DRIFT + 1)
+
+/* Nodes that may hold a read lease on g. A writer checks them once its
+ * slot is decided */
+static inline uint64_t rdma_rlease_readers(struct rdma_region *g) {
+  return __atomic_load_n(&g->dir->readers, __ATOMIC_ACQUIRE);
 }
 
+/* LL/SC read leases. Load-Link served by the lease, renewing it with a
+ * quorum read when it ran out. Revoke ends the leases of g's readers once
+ * an SC decided a slot, waiting out those it cannot reach. The tick, run
+ * by the grower, drops a lease left unused */
+int rdma_rlease_load_link(struct rdma_lane *l, struct rdma_region *g,
+                          uint64_t *out_index, uint64_t *out_value);
+void rdma_rlease_revoke(struct rdma_lane *l, struct rdma_region *g);
+void rdma_rlease_tick(struct rdma_region *g);
+
+/* Evaluate the prepare replies of an LL/SC slot in leaderless recovery.
+ * Returns 0 or 1 if a majority already holds a ballot (0 when it is
+ * ballot), -1 without a classic quorum of promises and 2 if the accept
+ * phase should propose *proposal. *from is the replica holding it, -1
+ * when the proposal is ballot itself */
+int rdma_llsc_outcome(struct config *c, const struct prep_res *p,
+                      uint64_t ballot, uint64_t *proposal, int *from);
+
+/* LL/SC slow path (coordinated or leaderless recovery) */
+int rdma_llsc_slow_path(struct rdma_lane *l, struct rdma_region *g,
+                        uint64_t slot, uint64_t value, uint16_t thread_id,
+                        uint64_t ballot);
+
+/* Coordinated recovery, requester side. A recovery takes a free response
+ * slot s (-1 while all are in use) and fills its request for slot of g.
+ * Send returns the coordinator address the request is written to, or 0
+ * when this node is the coordinator and stored it already. The response
+ * of s answers the request once poll returns it; done frees s and records
+ * the latency since start */
+int rdma_recovery_slot(struct rdma_ctx *r);
+void rdma_recovery_fill(struct rdma_ctx *r, int s, struct recovery_req *req,
+                        struct rdma_region *g, uint64_t slot);
+uint64_t rdma_recovery_send(struct rdma_ctx *r, int s,
+                            const struct recovery_req *req, uint32_t *rkey);
+struct recovery_resp *rdma_recovery_poll(struct rdma_ctx *r, int s,
+                                         uint32_t seq);
+void rdma_recovery_done(struct rdma_ctx *r, int s, uint64_t start);
+
+/* Record the latency of a recovery since start, coordinated or not */
+void rdma_recovery_record(struct rdma_ctx *r, uint64_t start);
+
+/* Start (and stop) the coordinator's recovery engine */
+int rdma_recoverer_start(struct rdma_ctx *r);
+void rdma_recoverer_stop(struct rdma_ctx *r);
+void rdma_recovery_stats(struct rdma_ctx *r, struct rdma_recovery_stats *s);
+
+/* Contention manager (config.backoff_mode). Backoff waits before retry
+ * attempt (from 0) of an operation on g; record counts an operation that
+ * finished after retries retries, or failed on a conflict */
+void rdma_backoff(struct rdma_region *g, uint32_t attempt);
+void rdma_conflict_record(struct rdma_region *g, uint32_t retries, int failed);
+void rdma_conflict_stats(struct rdma_region *g, struct rdma_conflicts *s);
+
+/* Path selection (config.path_mode). Skip returns 1 if an FAA or TAS on g
+ * should go straight to the slow path; record counts a fast path that
+ * ended decided or not */
+int rdma_fast_path_skip(struct rdma_region *g);
+void rdma_fast_path_record(struct rdma_region *g, int undecided);
+
+/* Asynchronous operations on a lane. Submit stages the first phase, posted
+ * by the next rdma_progress, and returns NULL when the lane has MAX_OPS
+ * operations in flight. Blocking calls on the lane advance its
+ * operations as well, so callbacks must not issue blocking calls */
+struct rdma_op *rdma_faa_submit(struct rdma_lane *l, struct rdma_region *g,
+                                rdma_op_cb cb, void *arg);
+struct rdma_op *rdma_tas_submit(struct rdma_lane *l, struct rdma_region *g,
+                                uint64_t slot, rdma_op_cb cb, void *arg);
+struct rdma_op *rdma_sc_submit(struct rdma_lane *l, struct rdma_region *g,
+                               uint64_t index, uint64_t value, rdma_op_cb cb,
+                               void *arg);
+
+/* Drive up to max completions. Returns the number of ops completed */
+int rdma_progress(struct rdma_lane *l, int max);
+
+/* Returns 0 and releases the handle once op is done, else -EINPROGRESS */
+int rdma_op_test(struct rdma_op *op, int64_t *result);
+
 #endif /* RDMA_H */
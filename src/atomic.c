@@ -5,111 +5,128 @@
 #define FAST_QUORUM(c) ((c->n * 3 + 3) / 4)
 #define CLASSIC_QUORUM(c) (((c)->n / 2) + 1)
 
-/* Broadcast atomic RDMA CAS */
-int rdma_bcas(struct rdma_ctx *r, uint32_t slot, uint64_t swp) {
+/* Broadcast atomic RDMA CAS over k consecutive slots in a single round.
+ * res[j] is 0 if swp won slot + j, 1 if it lost to another ballot a fast
+ * quorum holds and -1 if the fast quorum could not be decided */
+int rdma_bcas_n(struct rdma_lane *l, struct rdma_region *g, uint64_t slot,
+                uint32_t k, uint64_t swp, int *res) {
+    struct rdma_ctx *r = l->r;
     struct config *c = r->c;
-    uint64_t *thread_results = r->results;
+    uint64_t *thread_results = l->results;
+    uint64_t empty[k];
+    int successes[k], replies[k];
+    // the ballots the replicas hold, as the CASes that failed returned them
+    struct prep_res seen[k * c->n];
+    uint32_t pending = k, gen = rdma_sync_begin(l);
+    struct ibv_wc wc[c->n * 2];
+    int n = 0;
 
-    uint64_t local_result =
-        __sync_val_compare_and_swap(&r->shared_mem->slots[slot], 0, swp);
-    int local_won = (local_result == 0);
-    int successes = local_won;
+    rdma_trace_phase(l, OP_FAST);
+    memset(seen, 0, sizeof(seen));
+    for (uint32_t j = 0; j < k; ++j) {
+        uint64_t *local = rdma_faa_slot(g, slot + j);
+        struct prep_res *own = seen + j * c->n + c->host_id;
+        empty[j] = rdma_slot_lap(g, slot + j);
+        successes[j] = local && __sync_bool_compare_and_swap(
+                                    local, empty[j], swp | empty[j]);
+        own->success = local && !rdma_slot_ballot(g, slot + j,
+                                                  *(volatile uint64_t *)local,
+                                                  &own->ballot);
+        replies[j] = 0;
+        res[j] = -1;
+    }
 
     for (int i = 0; i < c->n; ++i) {
         if (i != c->host_id) {
-            struct ibv_send_wr *bad_wr = NULL, wr = {};
-            struct remote_attr *a = r->ra + i;
-            uint64_t remote_slot_addr =
-                a->addr + offsetof(typeof(*r->shared_mem), slots) +
-                (slot * sizeof(uint64_t));
-
-            struct ibv_sge list = {};
-            list.addr = (uint64_t)(thread_results + i);
-            list.length = sizeof(uint64_t);
-            list.lkey = r->mr[1]->lkey;
-
-            wr.wr_id = ((uint64_t)slot << 16) | i;
-            wr.sg_list = &list;
-            wr.opcode = IBV_WR_ATOMIC_CMP_AND_SWP;
-            wr.num_sge = 1;
-            wr.send_flags = IBV_SEND_SIGNALED;
-            wr.wr.atomic.remote_addr = remote_slot_addr;
-            wr.wr.atomic.rkey = a->rkey;
-            wr.wr.atomic.compare_add = 0;
-            wr.wr.atomic.swap = swp;
-
-            ibv_post_send(r->qp[i], &wr, &bad_wr);
-        }
-    }
-
-    struct ibv_wc wc[c->n * 2];
-    int left = c->n - 1, n = 0;
-    while (1)
-        if ((n = ibv_poll_cq(r->cq, left, wc)) > 0)
-            for (int i = 0; i < n; ++i) {
-                uint32_t completion_slot = (uint32_t)(wc[i].wr_id >> 16);
-                int node_id = wc[i].wr_id & 0xFFFF;
-                if (completion_slot == slot && wc[i].status == IBV_WC_SUCCESS) {
-                    successes += (thread_results[node_id] == 0);
-                    if (successes >= FAST_QUORUM(c)) return !local_won;
-                    --left;
-                }
+            uint64_t raddr[k];
+            uint32_t rkey[k], j = 0;
+            while (j < k &&
+                   (raddr[j] = rdma_region_raddr(g, i, slot + j, rkey + j)))
+                ++j;
+            if (j < k) {
+                // chunk not known yet: the peer counts as failed
+                wc[n++] = (struct ibv_wc){.wr_id = SYNC_WR_ID(PH_FAST, gen, i),
+                                          .status = IBV_WC_REM_ACCESS_ERR};
+                continue;
             }
 
-    return (successes < FAST_QUORUM(c)) ? -1 : !local_won;
-}
-
-/* Slow path: paxos recovery */
-int rdma_slow_path(struct rdma_ctx *r, uint32_t slot, uint64_t ballot,
-                   uint64_t proposed_value) {
-    struct config *c = r->c;
-    uint64_t *thread_results = r->results;
-    struct prep_res *results = r->prepares;
-    memset(results, 0, sizeof(struct prep_res) * c->n);
-
-    // Phase 2a (Prepare): Read current values
-    results[c->host_id].ballot =
-        *(volatile uint64_t *)&r->shared_mem->slots[slot];
-    results[c->host_id].success = 1;
-    for (int i = 0; i < c->n; ++i)
-        if (i != c->host_id) {
-            struct remote_attr *ra = r->ra + i;
-            uint64_t remote_slot_addr =
-                ra->addr + offsetof(typeof(*r->shared_mem), slots) +
-                (slot * sizeof(uint64_t));
-            struct ibv_sge sge = {.addr = (uint64_t)(thread_results + i),
-                                  .length = sizeof(uint64_t),
-                                  .lkey = r->mr[1]->lkey};
-            struct ibv_send_wr wr = {
-                .wr_id = i,
-                .sg_list = &sge,
-                .num_sge = 1,
-                .opcode = IBV_WR_RDMA_READ,
-                .send_flags = IBV_SEND_SIGNALED,
-                .wr.rdma = {.remote_addr = remote_slot_addr, .rkey = ra->rkey}};
-            struct ibv_send_wr *bad_wr;
-            ibv_post_send(r->qp[i], &wr, &bad_wr);
+            // chain the k CAS requests. RC completes them in order, so only
+            // the last one is signaled and its completion covers the rest
+            for (j = 0; j < k; ++j) {
+                struct ibv_sge sge = {
+                    .addr = (uint64_t)(thread_results + j * c->n + i),
+                    .length = sizeof(uint64_t),
+                    .lkey = l->mr->lkey};
+                struct ibv_send_wr wr = {
+                    .wr_id = SYNC_WR_ID(PH_FAST, gen, i),
+                    .sg_list = &sge,
+                    .num_sge = 1,
+                    .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
+                    .send_flags = (j + 1 == k) ? IBV_SEND_SIGNALED : 0,
+                    .wr.atomic = {.remote_addr = raddr[j],
+                                  .rkey = rkey[j],
+                                  .compare_add = empty[j],
+                                  .swap = swp | empty[j]}};
+                rdma_stage(l, i, 0, &wr);
+            }
         }
+    }
+    rdma_flush(l);
 
-    struct ibv_wc wc[c->n];
-    int completed = 0;
-    int num_posted = c->n - 1;
-    while (completed < num_posted) {
-        int n = ibv_poll_cq(r->cq, num_posted - completed, wc);
-        if (n > 0) {
-            for (int i = 0; i < n; ++i) {
-                int remote_idx = wc[i].wr_id;
+    int left = c->n - 1;
+    uint64_t replied = 0;
+    while (pending && left > 0) {
+        for (int i = 0; i < n; ++i) {
+            int node_id = WR_PEER(wc[i].wr_id);
+            // a failed WR errors the QP, so every CAS before it is lost.
+            // The ones after it complete with an error too: a peer counts
+            // once
+            if (replied & (1ULL << node_id)) continue;
+            replied |= 1ULL << node_id;
+            --left;
+            for (uint32_t j = 0; j < k; ++j) {
+                if (res[j] != -1) continue;  // already decided
+                ++replies[j];
                 if (wc[i].status == IBV_WC_SUCCESS) {
-                    results[remote_idx].ballot = thread_results[remote_idx];
-                    results[remote_idx].success = 1;
-                } else
-                    results[remote_idx].success = 0;
+                    uint64_t word = thread_results[j * c->n + node_id];
+                    struct prep_res *p = seen + j * c->n + node_id;
+                    successes[j] += word == empty[j];
+                    p->success = !rdma_slot_ballot(g, slot + j, word,
+                                                   &p->ballot);
+                }
+                // a fast quorum of replicas took swp, local or not
+                if (successes[j] >= FAST_QUORUM(c)) {
+                    res[j] = 0;
+                    --pending;
+                } else if (rdma_prepare_decided(c, seen + j * c->n, swp) ==
+                           1) {
+                    res[j] = 1;  // a fast quorum took another ballot
+                    --pending;
+                } else if (replies[j] == c->n - 1)
+                    --pending;  // every peer replied. undecided
             }
-            completed += n;
         }
+        n = (pending && left > 0) ? rdma_wait(l, l->cq, c->n * 2, wc) : 0;
     }
 
-    // Check if fast quorum already exists
+    rdma_trace_quorum(l);
+    rdma_count(l, fast, k);
+    for (uint32_t j = 0; j < k; ++j)
+        if (res[j] < 0) rdma_count(l, undecided, 1);
+    return pending ? -1 : 0;
+}
+
+/* Broadcast atomic RDMA CAS */
+int rdma_bcas(struct rdma_lane *l, struct rdma_region *g, uint64_t slot,
+              uint64_t swp) {
+    int res;
+    rdma_bcas_n(l, g, slot, 1, swp, &res);
+    return res;
+}
+
+/* Check whether the prepare replies already show a decided slot */
+int rdma_prepare_decided(struct config *c, struct prep_res *results,
+                         uint64_t mine) {
     uint64_t ballot_counts[c->n];
     memset(ballot_counts, 0, sizeof(ballot_counts));
     int unique_ballots = 0;
@@ -126,107 +143,232 @@ int rdma_slow_path(struct rdma_ctx *r, uint32_t slot, uint64_t ballot,
         }
     for (int i = 0; i < unique_ballots; ++i) {
         int count = 0;
-        uint16_t owner = ballot_counts[i] & 0xFFFF;
         for (int j = 0; j < c->n; ++j)
             if (results[j].success && results[j].ballot == ballot_counts[i])
                 ++count;
-        if (count >= FAST_QUORUM(c)) return (owner != c->host_id);
+        if (count >= FAST_QUORUM(c)) return ballot_counts[i] != mine;
     }
+    return -1;
+}
 
-    // Calculate promises
+/* Evaluate the prepare phase replies of a slot */
+int rdma_prepare_outcome(struct config *c, struct prep_res *results,
+                         uint64_t ballot, uint64_t proposed_value,
+                         uint64_t *proposal) {
+    // Check if fast quorum already exists
+    int decided = rdma_prepare_decided(c, results, proposed_value);
+    if (decided != -1) return decided;
+
+    // Calculate promises. An empty replica always promises; rounds wrap,
+    // so ballots compare by their distance
     int promises = 0;
     uint64_t highest_ballot = 0;
     uint64_t highest_value = 0;
     for (int i = 0; i < c->n; ++i)
-        if (results[i].success && ballot >= results[i].ballot) {
+        if (results[i].success &&
+            (!results[i].ballot ||
+             !rdma_ballot_after(results[i].ballot, ballot))) {
             ++promises;
-            if (results[i].ballot > highest_ballot) {
+            if (results[i].ballot &&
+                (!highest_ballot ||
+                 rdma_ballot_after(results[i].ballot, highest_ballot))) {
                 highest_ballot = results[i].ballot;
                 highest_value = results[i].ballot;
             }
         }
     if (promises < CLASSIC_QUORUM(c)) return -1;
 
+    *proposal = (highest_ballot > 0) ? highest_value : proposed_value;
+    return 2;
+}
+
+/* Slow path: paxos recovery */
+int rdma_slow_path(struct rdma_lane *l, struct rdma_region *g, uint64_t slot,
+                   uint64_t ballot, uint64_t proposed_value) {
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+    uint64_t *thread_results = l->results;
+    struct prep_res *results = l->prepares;
+    uint32_t gen = rdma_sync_begin(l);
+    memset(results, 0, sizeof(struct prep_res) * c->n);
+
+    uint64_t *local = rdma_faa_slot(g, slot);
+    uint64_t lap = rdma_slot_lap(g, slot);
+    if (!local) return -1;
+    rdma_count(l, slow, 1);
+    rdma_trace_phase(l, OP_PREPARE);
+
+    // Phase 2a (Prepare): Read current values. Replicas holding another
+    // lap of the slot cannot promise
+    results[c->host_id].success = !rdma_slot_ballot(
+        g, slot, *(volatile uint64_t *)local, &results[c->host_id].ballot);
+    int num_posted = 0;
+    for (int i = 0; i < c->n; ++i)
+        if (i != c->host_id) {
+            uint32_t rkey;
+            uint64_t remote_slot_addr =
+                rdma_region_raddr(g, i, slot, &rkey);
+            if (!remote_slot_addr) continue;  // chunk not known yet
+            struct ibv_sge sge = {.addr = (uint64_t)(thread_results + i),
+                                  .length = sizeof(uint64_t),
+                                  .lkey = l->mr->lkey};
+            struct ibv_send_wr wr = {
+                .wr_id = SYNC_WR_ID(PH_PREPARE, gen, i),
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_RDMA_READ,
+                .send_flags = IBV_SEND_SIGNALED,
+                .wr.rdma = {.remote_addr = remote_slot_addr, .rkey = rkey}};
+            rdma_stage(l, i, 0, &wr);
+            ++num_posted;
+        }
+    rdma_flush(l);
+
+    struct ibv_wc wc[c->n];
+    int completed = 0;
+    // a fast quorum on one ballot decides the slot without the other replies
+    while (completed < num_posted &&
+           rdma_prepare_decided(c, results, proposed_value) == -1) {
+        int n = rdma_wait(l, l->cq, c->n, wc);
+        for (int i = 0; i < n; ++i) {
+            int remote_idx = WR_PEER(wc[i].wr_id);
+            results[remote_idx].success =
+                wc[i].status == IBV_WC_SUCCESS &&
+                !rdma_slot_ballot(g, slot, thread_results[remote_idx],
+                                  &results[remote_idx].ballot);
+            ++completed;
+        }
+    }
+
+    rdma_trace_quorum(l);
+    rdma_ballots_seen(l, results, c->n);
+    uint64_t proposal;
+    int outcome =
+        rdma_prepare_outcome(c, results, ballot, proposed_value, &proposal);
+    if (outcome != 2) return outcome;
+
     // Phase 2b (Accept)
-    uint64_t proposal = (highest_ballot > 0) ? highest_value : proposed_value;
-    uint64_t cmp = results[c->host_id].ballot;
-    uint64_t res =
-        __sync_val_compare_and_swap(&r->shared_mem->slots[slot], cmp, proposal);
+    rdma_trace_phase(l, OP_ACCEPT);
+    uint64_t cmp = results[c->host_id].ballot | lap;
+    uint64_t res = __sync_val_compare_and_swap(local, cmp, proposal | lap);
     int accepts = (res == cmp);
+    num_posted = 0;
     for (int i = 0; i < c->n; ++i)
         if (i != c->host_id) {
-            struct remote_attr *ra = r->ra + i;
+            uint32_t rkey;
             uint64_t remote_slot_addr =
-                ra->addr + offsetof(typeof(*r->shared_mem), slots) +
-                (slot * sizeof(uint64_t));
-            uint64_t expected = results[i].ballot;
+                rdma_region_raddr(g, i, slot, &rkey);
+            if (!remote_slot_addr) continue;
+            uint64_t expected = results[i].ballot | lap;
             struct ibv_sge sge = {.addr = (uint64_t)(thread_results + i),
                                   .length = sizeof(uint64_t),
-                                  .lkey = r->mr[1]->lkey};
+                                  .lkey = l->mr->lkey};
             struct ibv_send_wr wr = {
-                .wr_id = i,
+                .wr_id = SYNC_WR_ID(PH_ACCEPT, gen, i),
                 .sg_list = &sge,
                 .num_sge = 1,
                 .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
                 .send_flags = IBV_SEND_SIGNALED,
                 .wr.atomic = {.remote_addr = remote_slot_addr,
-                              .rkey = ra->rkey,
+                              .rkey = rkey,
                               .compare_add = expected,
-                              .swap = proposal}};
-            struct ibv_send_wr *bad_wr;
-            ibv_post_send(r->qp[i], &wr, &bad_wr);
+                              .swap = proposal | lap}};
+            rdma_stage(l, i, 0, &wr);
+            ++num_posted;
         }
+    rdma_flush(l);
 
+    // stop once a classic quorum accepted or can no longer accept
     completed = 0;
-    num_posted = c->n - 1;
-    while (completed < num_posted) {
-        int n = ibv_poll_cq(r->cq, num_posted - completed, wc);
-        if (n > 0) {
-            for (int i = 0; i < n; ++i)
-                if (wc[i].status == IBV_WC_SUCCESS) {
-                    int remote_idx = wc[i].wr_id;
-                    uint64_t returned = thread_results[remote_idx];
-                    uint64_t expected = results[remote_idx].ballot;
-                    if (returned == expected) ++accepts;
-                }
-            completed += n;
+    while (accepts < CLASSIC_QUORUM(c) &&
+           accepts + num_posted - completed >= CLASSIC_QUORUM(c)) {
+        int n = rdma_wait(l, l->cq, c->n, wc);
+        for (int i = 0; i < n; ++i) {
+            if (WR_PHASE(wc[i].wr_id) != PH_ACCEPT)
+                continue;  // late prepare reply
+            if (wc[i].status == IBV_WC_SUCCESS) {
+                int remote_idx = WR_PEER(wc[i].wr_id);
+                uint64_t returned = thread_results[remote_idx];
+                uint64_t expected = results[remote_idx].ballot | lap;
+                if (returned == expected) ++accepts;
+            }
+            ++completed;
         }
     }
+    rdma_trace_quorum(l);
 
-    uint16_t winner = proposal & 0xffff;
-    return (accepts >= CLASSIC_QUORUM(c)) ? c->host_id != winner : -1;
+    return (accepts >= CLASSIC_QUORUM(c)) ? proposal != proposed_value : -1;
 }
 
-/* Read next slot from frontier node */
-uint64_t rdma_get_next_slot(struct rdma_ctx *r) {
-    uint64_t *result_ptr = r->results + r->c->n;
-    struct remote_attr *ra = r->ra + FRONTIER_NODE;
-    uint64_t remote_frontier_addr =
-        ra->addr + offsetof(typeof(*r->shared_mem), frontier);
+/* Reserve k consecutive slots from this node's stripe */
+uint64_t rdma_stripe_next(struct rdma_region *g, uint32_t k) {
+    uint64_t *frontier = &g->dir->frontier;
+    uint64_t x = __atomic_load_n(frontier, __ATOMIC_RELAXED), y;
+    do {
+        y = x;
+        if (y % STRIPE_SLOTS + k > STRIPE_SLOTS)
+            y += STRIPE_SLOTS - y % STRIPE_SLOTS;  // skip to the next block
+    } while (!__atomic_compare_exchange_n(frontier, &x, y + k, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    return rdma_stripe_slot(g->r->c, y);
+}
+
+uint64_t rdma_frontier_faa(struct rdma_lane *l, struct rdma_region *g,
+                           uint64_t k) {
+    struct rdma_ctx *r = l->r;
+    uint64_t *result_ptr = l->results + r->c->n * MAX_BATCH;
+    uint32_t rkey = 0;
+    uint64_t remote_frontier_addr = rdma_region_dir(g, FRONTIER_NODE, &rkey);
+    if (!remote_frontier_addr) return -1;  // object not found there yet
+    remote_frontier_addr += offsetof(struct region_dir, frontier);
 
     struct ibv_sge sge = {.addr = (uint64_t)result_ptr,
                           .length = sizeof(uint64_t),
-                          .lkey = r->mr[1]->lkey};
+                          .lkey = l->mr->lkey};
 
-    struct ibv_send_wr wr = {.wr_id = 0,
+    struct ibv_send_wr wr = {.wr_id = SYNC_WR_ID(PH_FRONTIER, rdma_sync_begin(l),
+                                                  FRONTIER_NODE),
                              .sg_list = &sge,
                              .num_sge = 1,
                              .opcode = IBV_WR_ATOMIC_FETCH_AND_ADD,
                              .send_flags = IBV_SEND_SIGNALED,
                              .wr.atomic = {.remote_addr = remote_frontier_addr,
-                                           .rkey = ra->rkey,
-                                           .compare_add = 1}};
+                                           .rkey = rkey,
+                                           .compare_add = k}};
 
-    struct ibv_send_wr *bad_wr;
-    if (ibv_post_send(r->fqp[FRONTIER_NODE], &wr, &bad_wr)) {
-        FAA_LOG("Failed to post frontier FAA");
-        return -1;
-    }
+    rdma_stage(l, FRONTIER_NODE, 1, &wr);
+    rdma_flush(l);
 
     struct ibv_wc wc;
     while (1)
-        if (ibv_poll_cq(r->fcq, 1, &wc) > 0)
-            return wc.status == IBV_WC_SUCCESS ? *result_ptr : (uint64_t)-1;
+        if (rdma_wait(l, l->fcq, 1, &wc) > 0) {
+            if (wc.status != IBV_WC_SUCCESS) return -1;
+            return *result_ptr;
+        }
 
     return -1;
 }
+
+/* Reserve k consecutive slots from frontier node */
+uint64_t rdma_get_next_slots(struct rdma_lane *l, struct rdma_region *g,
+                             uint32_t k) {
+    struct rdma_ctx *r = l->r;
+    uint64_t slot;
+
+    // every slot handed out from now on is above this node's low, so the
+    // grower cannot publish past the slot before it is seen
+    if (l->floor == FLOOR_IDLE) {
+        __atomic_store_n(&l->held, g, __ATOMIC_RELAXED);
+        __atomic_store_n(&l->floor, g->mine, __ATOMIC_SEQ_CST);
+    }
+
+    if (r->c->frontier_mode == FRONTIER_STRIPED)
+        slot = rdma_stripe_next(g, k);
+    else if (r->c->frontier_mode == FRONTIER_LEASED)
+        slot = rdma_lease_next(l, g, k);
+    else
+        slot = rdma_frontier_faa(l, g, k);
+    if (slot != (uint64_t)-1)
+        __atomic_store_n(&l->floor, slot, __ATOMIC_RELEASE);
+    return slot;
+}
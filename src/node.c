@@ -1,129 +1,442 @@
 #include "node.h"
 
-#include <unistd.h>
-#include "arch.h"
-
 #define MAX_RETRIES (5)
 
-static inline int __try_fast_path(struct node_ctx *ctx, uint32_t target_slot) {
-    uint64_t ballot = gen_ballot(ctx->id);
-    return rdma_bcas(&ctx->r, target_slot, ballot);
+/* Lane bound to the calling thread by node_lane_acquire() */
+static __thread struct {
+    struct node_ctx *ctx;
+    struct rdma_lane *l;
+} __bound;
+
+/* The calling thread's last Load-Link. It stays with the thread, so an SC
+ * finds it whichever lane it runs on */
+static __thread struct {
+    struct node_ctx *ctx;
+    struct rdma_region *obj;
+    uint64_t index;
+} __link;
+
+/* Lock the calling thread's lane. Threads without a bound lane share
+ * lanes round-robin */
+static inline struct rdma_lane *__lane_lock(struct node_ctx *ctx) {
+    struct rdma_lane *l = __bound.l;
+    if (__bound.ctx != ctx)
+        l = ctx->r.lanes +
+            __sync_fetch_and_add(&ctx->next_lane, 1) % ctx->r.nlanes;
+    pthread_mutex_lock(&l->lock);
+    return l;
 }
 
-static inline int __try_slow_path(struct node_ctx *ctx, uint32_t target_slot) {
-    uint64_t ballot = gen_ballot(ctx->id);
-    return rdma_slow_path(&ctx->r, target_slot, ballot, ballot);
+static inline void __lane_unlock(struct rdma_lane *l) {
+    pthread_mutex_unlock(&l->lock);
 }
 
-int64_t fetch_and_add(struct node_ctx *ctx) {
+int node_lane_acquire(struct node_ctx *ctx) {
     struct rdma_ctx *r = &ctx->r;
+    if (__bound.ctx == ctx) return __bound.l->id;
+    for (int i = 0; i < r->nlanes; ++i)
+        if (__sync_bool_compare_and_swap(&r->lanes[i].owned, 0, 1)) {
+            __bound.ctx = ctx;
+            __bound.l = r->lanes + i;
+            return i;
+        }
+    return -EBUSY;
+}
+
+void node_lane_release(struct node_ctx *ctx) {
+    if (__bound.ctx != ctx) return;
+    __sync_lock_release(&__bound.l->owned);
+    __bound.ctx = NULL;
+    __bound.l = NULL;
+}
+
+/* A slow path round of a fresh ballot proposing mine, the ballot the fast
+ * path tried: a replica holding it counts as this call's */
+static inline int __try_slow_path(struct rdma_lane *l, struct rdma_region *g,
+                                  uint64_t target_slot, uint64_t mine) {
+    return rdma_slow_path(l, g, target_slot, gen_ballot(l), mine);
+}
+
+/* Path of a blocking FAA or TAS: its last retry or slow path */
+static inline int __path(uint32_t retries, int slow) {
+    return retries ? STAT_RETRIED : slow ? STAT_SLOW : STAT_FAST_WIN;
+}
+
+/* Decide a slot whose fast path with mine was inconclusive. Retries are
+ * added to *retries. Returns 0 if mine won the slot, 1 otherwise and
+ * -EAGAIN if the slot's chunk is not mapped here */
+static int __resolve_slot(struct rdma_lane *l, struct rdma_region *g,
+                          uint64_t target_slot, uint64_t mine,
+                          uint32_t *retries) {
+    uint64_t *local = rdma_faa_slot(g, target_slot);
+    if (!local) return -EAGAIN;
+    int ret = __try_slow_path(l, g, target_slot, mine);
+    int retry_count = 0;
+    for (; ret < 0 && retry_count < MAX_RETRIES; ++retry_count) {
+        uint64_t val = *(volatile uint64_t *)local;
+        if (val != rdma_slot_lap(g, target_slot)) break;  // slot filled
+        rdma_backoff(g, retry_count);
+        ++*retries;
+        ret = __try_slow_path(l, g, target_slot, mine);
+    }
+    if (ret < 0 && retry_count == MAX_RETRIES) rdma_count(l, gave_up, 1);
+    return ret != 0;
+}
+
+struct rdma_region *node_obj_open(struct node_ctx *ctx, const char *name,
+                                  enum obj_kind kind) {
+    return rdma_obj_open(&ctx->r, name, kind);
+}
+
+int64_t fetch_and_add(struct node_ctx *ctx) {
+    return fetch_and_add_obj(ctx, &ctx->r.faa);
+}
+
+int64_t fetch_and_add_obj(struct node_ctx *ctx, struct rdma_region *g) {
+    if (g->kind != OBJ_FAA) return -EINVAL;
+    uint64_t start = ts_ns();
+    struct rdma_lane *l = __lane_lock(ctx);
     uint64_t slot = 0;
-    int64_t ret = 0;
-    pthread_mutex_lock(&ctx->lock);
+    uint32_t retries = 0, failures = 0;
+    int slow = 0;
+    l->trace_op = rdma_trace_begin(l, STAT_FAA);
     while (1) {
         /* Get assigned slot */
-        slot = rdma_get_next_slot(r);
-        if (slot == (uint64_t)-1) {  // failed. try again
-            usleep(100);
+        rdma_trace_phase(l, OP_SLOT);
+        slot = rdma_get_next_slot(l, g);
+        if (slot == (uint64_t)-1) {  // failed. back off and try again
+            rdma_backoff(g, failures++);
+            ++retries;
             continue;
-        } else if (slot >= MAX_SLOTS) {
+        } else if (rdma_region_wait(l, g, slot + 1)) {
+            // the ring stayed full: the slot is decided as a no-op later
+            rdma_hole_add(g, slot, slot + 1);
             slot = -ENOMEM;
-            goto done;
+            break;
         }
 
-        /* 1. Try fast path */
-        ret = __try_fast_path(ctx, slot);
+        /* 1. Try fast path, unless it keeps ending undecided */
+        uint64_t mine = gen_ballot(l);
+        int ret = -1;
+        if (!rdma_fast_path_skip(g)) {
+            ret = rdma_bcas(l, g, slot, mine);
+            rdma_fast_path_record(g, ret < 0);
+        }
         if (!ret)
-            goto done;  // this thread won
-        else if (ret == 1)
-            continue;  // slot commited by another thread
+            break;  // this thread won
+        else if (ret == 1) {
+            ++retries;
+            continue;  // slot commited by another thread: take the next
+        }
 
         /* 2. Fast path failed. Try slow path */
-        ret = __try_slow_path(ctx, slot);
-        if (!ret)
-            goto done;  // this thread won
-        else if (ret == 1)
-            continue;  // slot commited by another thread
-
-        /* 3. Both paths failed. Retry slow path on the same slot. */
-        for (int retry_count = 0; retry_count < MAX_RETRIES; ++retry_count) {
-            uint64_t val = *(volatile uint64_t *)&r->shared_mem->slots[ret];
-            if (val != 0 || __try_slow_path(ctx, slot) >= 0)
-                break;  // slot filled
-            usleep(1);
+        slow = 1;
+        int lost = __resolve_slot(l, g, slot, mine, &retries);
+        if (lost <= 0) {
+            if (lost) slot = lost;
+            break;
         }
+        ++retries;
     }
-done:
-    pthread_mutex_unlock(&ctx->lock);
+    __atomic_store_n(&l->floor, FLOOR_IDLE, __ATOMIC_RELEASE);
+    rdma_stats_record(l, STAT_FAA, __path(retries, slow), ts_ns() - start);
+    rdma_trace_end(l, __path(retries, slow));
+    __lane_unlock(l);
+    rdma_conflict_record(g, retries, slot == (uint64_t)-ENOMEM);
     return slot;
 }
 
-int64_t test_and_set(struct node_ctx *ctx, uint32_t slot) {
-    struct rdma_ctx *r = &ctx->r;
+int fetch_and_add_n(struct node_ctx *ctx, uint32_t k, int64_t *out) {
+    struct rdma_region *g = &ctx->r.faa;
+    uint64_t start = ts_ns();
+    struct rdma_lane *l = __lane_lock(ctx);
+    uint32_t got = 0, retries = 0, failures = 0;
+    int res[MAX_BATCH], slow = 0, err = -ENOMEM;
+    l->trace_op = rdma_trace_begin(l, STAT_FAA);
+    while (got < k) {
+        /* Reserve a run of slots with one frontier FAA */
+        uint32_t want = k - got < MAX_BATCH ? k - got : MAX_BATCH;
+        rdma_trace_phase(l, OP_SLOT);
+        uint64_t base = rdma_get_next_slots(l, g, want);
+        if (base == (uint64_t)-1) {  // failed. back off and try again
+            rdma_backoff(g, failures++);
+            ++retries;
+            continue;
+        } else if (rdma_region_wait(l, g, base + want)) {
+            // the ring stayed full: the run is decided as no-ops later
+            rdma_hole_add(g, base, base + want);
+            break;
+        }
+
+        /* 1. Fast path for the whole run in one broadcast round */
+        uint64_t mine = gen_ballot(l);
+        rdma_bcas_n(l, g, base, want, mine, res);
+
+        /* 2. Slow path only for the slots left undecided. Lost slots
+         * count as retries */
+        uint32_t first = got;
+        int unmapped = 0;
+        for (uint32_t j = 0; j < want; ++j) {
+            slow |= res[j] < 0;
+            int lost = res[j] < 0
+                           ? __resolve_slot(l, g, base + j, mine, &retries)
+                           : res[j];
+            if (!lost)
+                out[got++] = base + j;
+            else if (lost < 0)
+                unmapped = 1;
+        }
+        retries += want - (got - first);
+        if (unmapped) {
+            err = -EAGAIN;
+            break;
+        }
+    }
+    __atomic_store_n(&l->floor, FLOOR_IDLE, __ATOMIC_RELEASE);
+    rdma_stats_record(l, STAT_FAA, __path(retries, slow), ts_ns() - start);
+    rdma_trace_end(l, __path(retries, slow));
+    __lane_unlock(l);
+    rdma_conflict_record(g, retries, got < k);
+    return (got || !k) ? (int)got : err;
+}
+
+int64_t test_and_set(struct node_ctx *ctx, uint64_t slot) {
+    return test_and_set_obj(ctx, &ctx->r.faa, slot);
+}
+
+int64_t test_and_set_obj(struct node_ctx *ctx, struct rdma_region *g,
+                         uint64_t slot) {
+    if (g->kind != OBJ_FAA) return -EINVAL;
+    uint64_t start = ts_ns();
+    struct rdma_lane *l = __lane_lock(ctx);
+    int64_t ret = -1;
+    uint32_t retries = 0;
+    int slow = 0;
+    __atomic_store_n(&l->held, g, __ATOMIC_RELAXED);
+    if (rdma_region_hold(g, &l->floor, slot)) {
+        __lane_unlock(l);
+        return -ERANGE;
+    }
+    l->trace_op = rdma_trace_begin(l, STAT_TAS);
+    // the ballot the call sets the slot to, in every round
+    uint64_t mine = gen_ballot(l);
     for (int retry_count = 0; retry_count < MAX_RETRIES; ++retry_count) {
-        // 1. Try fast path
-        int fast_res = rdma_btas(r, slot);
-        if (fast_res == 0)
-            return 0;  // this thread won
-        else if (fast_res == 1)
-            return 1;  // another thread won
+        // 1. Try fast path, unless it keeps ending undecided
+        int fast_res = -1;
+        if (!rdma_fast_path_skip(g)) {
+            fast_res = rdma_bcas(l, g, slot, mine);
+            rdma_fast_path_record(g, fast_res < 0);
+        }
+        if (fast_res >= 0) {
+            ret = fast_res;  // 0: this thread won, 1: another thread won
+            break;
+        }
 
         // 2. Fast path failed. Try slow path
-        uint64_t ballot = gen_ballot(ctx->id);
-        int slow_res = rdma_slow_path(r, slot, ballot, 1);
-        if (slow_res == 0)
-            return 0;  // this thread won
-        else if (slow_res >= 0)
-            return 1;  // another thread won
+        slow = 1;
+        int slow_res = __try_slow_path(l, g, slot, mine);
+        if (slow_res >= 0) {
+            ret = slow_res != 0;  // 0: this thread won, 1: another thread won
+            break;
+        }
 
         // 3. Both paths failed. Check and retry
-        uint64_t val = *(volatile uint64_t *)&r->shared_mem->slots[slot];
-        if (val != 0) return 1;
-        if (retry_count < 3)
-            cpu_relax();
-        else
-            usleep(1);
+        uint64_t *local = rdma_faa_slot(g, slot);
+        if (!local) {
+            ret = -EAGAIN;  // the slot's chunk is not mapped here
+            break;
+        }
+        uint64_t val = *(volatile uint64_t *)local;
+        if (val != rdma_slot_lap(g, slot)) {
+            ret = 1;
+            break;
+        }
+        rdma_backoff(g, retry_count);
+        ++retries;
     }
-    return -1;
+    if (ret == -1) rdma_count(l, gave_up, 1);
+    __atomic_store_n(&l->floor, FLOOR_IDLE, __ATOMIC_RELEASE);
+    int path = __path(retries, slow);
+    if (path == STAT_FAST_WIN && ret) path = STAT_FAST_LOSS;
+    rdma_stats_record(l, STAT_TAS, path, ts_ns() - start);
+    rdma_trace_end(l, path);
+    __lane_unlock(l);
+    rdma_conflict_record(g, retries, ret < 0);
+    return ret;
 }
 
 /* LL/SC: Load-Link operation */
 int load_link(struct node_ctx *ctx, uint64_t *out_value) {
-    struct rdma_ctx *r = &ctx->r;
+    return load_link_obj(ctx, &ctx->r.llsc, out_value);
+}
+
+int load_link_obj(struct node_ctx *ctx, struct rdma_region *g,
+                  uint64_t *out_value) {
+    if (g->kind != OBJ_LLSC) return -EINVAL;
+    uint64_t start = ts_ns();
+    struct rdma_lane *l = __lane_lock(ctx);
+    uint64_t index, value;
     int ret;
 
-    pthread_mutex_lock(&ctx->lock);
-    ret = rdma_load_link(r, &ctx->my_index, &ctx->my_value);
-    if (ret == 0 && out_value) {
-        *out_value = ctx->my_value;
+    l->trace_op = rdma_trace_begin(l, STAT_LL);
+    ret = rdma_load_link(l, g, &index, &value);
+    int path = ret ? STAT_FAST_LOSS : STAT_FAST_WIN;
+    rdma_stats_record(l, STAT_LL, path, ts_ns() - start);
+    rdma_trace_end(l, path);
+    __lane_unlock(l);
+    // a failed Load-Link leaves the thread without a link
+    __link.ctx = ctx;
+    __link.obj = NULL;
+    if (ret == 0) {
+        __link.obj = g;
+        __link.index = index;
+        if (out_value) *out_value = value;
     }
-    pthread_mutex_unlock(&ctx->lock);
 
     return ret;
 }
 
+uint64_t node_ll_index(struct node_ctx *ctx) {
+    return __link.ctx == ctx ? __link.index : 0;
+}
+
 /* LL/SC: Store-Conditional operation */
 int store_conditional(struct node_ctx *ctx, uint64_t value) {
-    struct rdma_ctx *r = &ctx->r;
-    int ret;
+    return store_conditional_obj(ctx, &ctx->r.llsc, value);
+}
+
+int store_conditional_obj(struct node_ctx *ctx, struct rdma_region *g,
+                          uint64_t value) {
+    if (g->kind != OBJ_LLSC) return -EINVAL;
+    uint64_t start = ts_ns();
+    struct rdma_lane *l = __lane_lock(ctx);
+    int ret = -1;
+
+    // the thread's link is to another object: the SC fails
+    l->sc_path = STAT_FAST_LOSS;
+    l->trace_op = rdma_trace_begin(l, STAT_SC);
+    if (__link.ctx == ctx && __link.obj == g)
+        ret = rdma_store_conditional(l, g, __link.index, value);
+    rdma_stats_record(l, STAT_SC, l->sc_path, ts_ns() - start);
+    rdma_trace_end(l, l->sc_path);
+    __lane_unlock(l);
+    rdma_conflict_record(g, 0, ret != 0);
+
+    return ret;
+}
+
+/* Lane of the calling thread for asynchronous operations. Completions are
+ * only driven by node_progress() on the same lane, so one is bound */
+static inline struct rdma_lane *__async_lane(struct node_ctx *ctx) {
+    if (__bound.ctx != ctx && node_lane_acquire(ctx) < 0) return NULL;
+    return __bound.l;
+}
+
+struct rdma_op *faa_submit(struct node_ctx *ctx, rdma_op_cb cb, void *arg) {
+    struct rdma_lane *l = __async_lane(ctx);
+    struct rdma_op *op = NULL;
+    if (l) {
+        pthread_mutex_lock(&l->lock);
+        op = rdma_faa_submit(l, &ctx->r.faa, cb, arg);
+        __lane_unlock(l);
+    }
+    return op;
+}
+
+struct rdma_op *tas_submit(struct node_ctx *ctx, uint64_t slot, rdma_op_cb cb,
+                           void *arg) {
+    struct rdma_lane *l = __async_lane(ctx);
+    struct rdma_op *op = NULL;
+    if (l) {
+        pthread_mutex_lock(&l->lock);
+        op = rdma_tas_submit(l, &ctx->r.faa, slot, cb, arg);
+        __lane_unlock(l);
+    }
+    return op;
+}
+
+struct rdma_op *sc_submit(struct node_ctx *ctx, uint64_t value, rdma_op_cb cb,
+                          void *arg) {
+    struct rdma_lane *l = __async_lane(ctx);
+    struct rdma_op *op = NULL;
+    // without a Load-Link there is no index to store at
+    if (l && __link.ctx == ctx && __link.obj) {
+        pthread_mutex_lock(&l->lock);
+        op = rdma_sc_submit(l, __link.obj, __link.index, value, cb, arg);
+        __lane_unlock(l);
+    }
+    return op;
+}
 
-    pthread_mutex_lock(&ctx->lock);
-    ret = rdma_store_conditional(r, ctx->my_index, value);
-    pthread_mutex_unlock(&ctx->lock);
+int node_progress(struct node_ctx *ctx, int max) {
+    struct rdma_lane *l = __async_lane(ctx);
+    int ret = 0;
+    if (l) {
+        pthread_mutex_lock(&l->lock);
+        ret = rdma_progress(l, max);
+        __lane_unlock(l);
+    }
+    return ret;
+}
+
+int node_op_test(struct rdma_op *op, int64_t *result) {
+    pthread_mutex_lock(&op->l->lock);
+    int ret = rdma_op_test(op, result);
+    __lane_unlock(op->l);
+    return ret;
+}
+
+void node_wait_stats(struct node_ctx *ctx, struct rdma_wait_stats *s) {
+    rdma_wait_stats(&ctx->r, s);
+}
+
+void node_recovery_stats(struct node_ctx *ctx, struct rdma_recovery_stats *s) {
+    rdma_recovery_stats(&ctx->r, s);
+}
+
+void node_backoff(struct node_ctx *ctx, struct rdma_region *obj,
+                  uint32_t attempt) {
+    (void)ctx;
+    rdma_backoff(obj, attempt);
+}
+
+void node_conflict_stats(struct node_ctx *ctx, struct rdma_region *obj,
+                         struct rdma_conflicts *s) {
+    (void)ctx;
+    rdma_conflict_stats(obj, s);
+}
 
+void node_stats_snapshot(struct node_ctx *ctx, struct rdma_stats *s) {
+    rdma_stats_snapshot(&ctx->r, s);
+}
+
+uint64_t node_stats_quantile(const struct rdma_hist *h, double q) {
+    return rdma_hist_quantile(h, q);
+}
+
+void node_stats(struct node_ctx *ctx, struct rdma_counters *s) {
+    rdma_counters_snapshot(&ctx->r, s);
+}
+
+int node_trace_dump(struct node_ctx *ctx, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (!f) return -errno;
+    int ret = rdma_trace_dump(&ctx->r, f);
+    if (fclose(f) && !ret) ret = -errno;
     return ret;
 }
 
+void node_watermarks(struct node_ctx *ctx, uint64_t *low, uint64_t *high) {
+    rdma_region_watermarks(&ctx->r.faa, low, high);
+}
+
 int node_init(struct node_ctx *ctx, struct config *c) {
     ctx->id = c->host_id;
     ctx->seed = (uint32_t)time(0) ^ (uint32_t)ctx->id;
-    ctx->my_index = 0;
-    ctx->my_value = 0;
-    pthread_mutex_init(&ctx->lock, 0);
+    ctx->next_lane = 0;
     return rdma_init(&ctx->r, c);
 }
 
 void node_destroy(struct node_ctx *ctx) {
-    pthread_mutex_destroy(&ctx->lock);
     rdma_destroy(&ctx->r);
 }
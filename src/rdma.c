@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 /* Max Work requests */
 #define MAX_WR (1 << 10)
@@ -9,17 +10,22 @@
 /* Max scatter-gather entries */
 #define MAX_SGE (1 << 1)
 
-extern int rdma_handshake(struct rdma_ctx *r, struct config *c);
+/* Inline data requested per send WR. Small RDMA writes skip the DMA read */
+#define MAX_INLINE (1 << 6)
 
-int __add_qp(struct rdma_ctx *r, int id, int port_num, int frontier) {
-    struct ibv_qp **qp = (frontier ? r->fqp : r->qp);
+extern int rdma_handshake(struct rdma_ctx *r);
+
+int __add_qp(struct rdma_ctx *r, struct rdma_lane *l, int id, int port_num,
+             int frontier) {
+    struct ibv_qp **qp = (frontier ? l->fqp : l->qp);
     struct ibv_qp_init_attr init_attr = {.qp_type = IBV_QPT_RC,
-                                         .send_cq = frontier ? r->fcq : r->cq,
-                                         .recv_cq = frontier ? r->fcq : r->cq,
+                                         .send_cq = frontier ? l->fcq : l->cq,
+                                         .recv_cq = frontier ? l->fcq : l->cq,
                                          .cap = {.max_send_wr = MAX_WR,
                                                  .max_recv_wr = MAX_WR,
                                                  .max_send_sge = MAX_SGE,
-                                                 .max_recv_sge = MAX_SGE}};
+                                                 .max_recv_sge = MAX_SGE,
+                                                 .max_inline_data = MAX_INLINE}};
     struct ibv_qp_attr attr = {
         .qp_state = IBV_QPS_INIT,
         .pkey_index = 0,
@@ -43,6 +49,166 @@ int __add_qp(struct rdma_ctx *r, int id, int port_num, int frontier) {
     return 0;
 }
 
+/* Allocate the CQs, QPs and scratch buffers of a lane */
+int __lane_init(struct rdma_ctx *r, struct rdma_lane *l, struct config *c,
+                uint16_t id) {
+    l->r = r;
+    l->id = id;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&l->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    l->floor = FLOOR_IDLE;
+
+    // scratch: slot results | frontier results | LL/SC results | stage
+    size_t nres = c->n * MAX_BATCH + 1;
+    size_t nb = sizeof(uint64_t) * (nres + c->n) +
+                sizeof(struct llsc_slot) * c->n + sizeof(struct rdma_stage);
+    if (!(l->results = calloc(1, nb))) {
+        perror("calloc:");
+        return -errno;
+    }
+    l->frontier_results = l->results + nres;
+    l->llsc_results = (struct llsc_slot *)(l->frontier_results + c->n);
+    l->stage = (struct rdma_stage *)(l->llsc_results + c->n);
+    if (!(l->mr = ibv_reg_mr(r->pd, l->results, nb, IBV_ACCESS_LOCAL_WRITE))) {
+        FAA_LOG("Failed to register lane %hu scratch", id);
+        return -errno;
+    }
+
+    if (!(l->prepares = calloc(c->n, sizeof(struct prep_res)))) {
+        perror("calloc:");
+        return -errno;
+    }
+
+    // counters and histograms on lines of their own: only snapshots read them
+    if (posix_memalign((void **)&l->stats, 64, sizeof(struct rdma_stats))) {
+        l->stats = NULL;
+        FAA_LOG("Failed to allocate lane %hu stats", id);
+        return -ENOMEM;
+    }
+    memset(l->stats, 0, sizeof(struct rdma_stats));
+
+    if (c->trace_every && id < r->nlanes) {  // system lanes run no ops
+        if (posix_memalign((void **)&l->trace, 64, sizeof(struct rdma_trace))) {
+            l->trace = NULL;
+            FAA_LOG("Failed to allocate lane %hu trace", id);
+            return -ENOMEM;
+        }
+        memset(l->trace, 0, sizeof(struct rdma_trace));
+        l->trace->every = c->trace_every;
+    }
+
+    // asynchronous ops: per-op scratch of n results, n frontier words, the
+    // SC value and its LL/SC head
+    size_t nop = 2 * c->n + 1 + sizeof(struct llsc_head) / sizeof(uint64_t);
+    if (!(l->ops = calloc(MAX_OPS, sizeof(struct rdma_op))) ||
+        !(l->op_free = calloc(MAX_OPS, sizeof(uint16_t))) ||
+        !(l->op_scratch = calloc(MAX_OPS * nop, sizeof(uint64_t))) ||
+        !(l->op_prepares = calloc(MAX_OPS * c->n, sizeof(struct prep_res)))) {
+        perror("calloc:");
+        return -errno;
+    }
+    if (!(l->op_mr = ibv_reg_mr(r->pd, l->op_scratch,
+                                MAX_OPS * nop * sizeof(uint64_t),
+                                IBV_ACCESS_LOCAL_WRITE))) {
+        FAA_LOG("Failed to register lane %hu op scratch", id);
+        return -errno;
+    }
+    for (int i = MAX_OPS - 1; i >= 0; --i) {
+        struct rdma_op *op = l->ops + i;
+        op->l = l;
+        op->idx = i;
+        op->results = l->op_scratch + i * nop;
+        op->fresults = op->results + c->n;
+        op->prepares = l->op_prepares + i * c->n;
+        op->floor = FLOOR_IDLE;
+        l->op_free[l->op_nfree++] = i;
+    }
+
+    // completion channel shared by both CQs when waits may block
+    l->spin_limit = c->spin_budget ? c->spin_budget : SPIN_BUDGET;
+    if (c->poll_mode != POLL_SPIN &&
+        !(l->channel = ibv_create_comp_channel(r->ctx))) {
+        FAA_LOG("ibv_create_comp_channel failed");
+        return -errno;
+    }
+
+    // allocate completion queue for consensus, sized for MAX_OPS in flight
+    int cqe = 2 * MAX_OPS * c->n + 1024;
+    if (cqe > r->max_cqe) cqe = r->max_cqe;
+    if (!(l->cq = ibv_create_cq(r->ctx, cqe, NULL, l->channel, 0))) {
+        FAA_LOG("ibv_create_cq failed");
+        return -errno;
+    }
+
+    // allocate completion queue for frontier operations: every async FAA
+    // has a signaled frontier FAA of its own in flight
+    int fcqe = MAX_OPS + 16;
+    if (fcqe > r->max_cqe) fcqe = r->max_cqe;
+    if (!(l->fcq = ibv_create_cq(r->ctx, fcqe, NULL, l->channel, 0))) {
+        FAA_LOG("ibv_create_cq (frontier) failed");
+        return -errno;
+    }
+
+    // allocate queue-pairs
+    if (!(l->qp = calloc(c->n, sizeof(struct ibv_qp *))) ||
+        !(l->fqp = calloc(c->n, sizeof(struct ibv_qp *)))) {
+        perror("calloc:");
+        return -errno;
+    }
+
+    // init queue pairs
+    for (int i = 0; i < c->n; ++i) {
+        if (i != c->host_id && __add_qp(r, l, i, c->c[i].ib_port, 0)) {
+            FAA_LOG("Failed to create QP %d", i);
+            return -errno;
+        }
+        if (__add_qp(r, l, i, c->c[i].ib_port, 1)) {
+            FAA_LOG("Failed to create QP %d", i);
+            return -errno;
+        }
+    }
+
+    // doorbell batching chains, one per QP
+    if (!(l->chains = calloc(2 * c->n, sizeof(struct rdma_chain)))) {
+        perror("calloc:");
+        return -errno;
+    }
+    for (int i = 0; i < c->n; ++i) {
+        l->chains[2 * i].qp = l->qp[i];
+        l->chains[2 * i + 1].qp = l->fqp[i];
+    }
+    return 0;
+}
+
+/* Release a (possibly partially initialized) lane */
+void __lane_destroy(struct rdma_lane *l, int n) {
+    for (int i = 0; i < n; ++i) {
+        if (l->qp && l->qp[i]) ibv_destroy_qp(l->qp[i]);
+        if (l->fqp && l->fqp[i]) ibv_destroy_qp(l->fqp[i]);
+    }
+    if (l->cq) ibv_destroy_cq(l->cq);
+    if (l->fcq) ibv_destroy_cq(l->fcq);
+    if (l->channel) ibv_destroy_comp_channel(l->channel);
+    if (l->mr) ibv_dereg_mr(l->mr);
+    if (l->op_mr) ibv_dereg_mr(l->op_mr);
+    free(l->op_scratch);
+    free(l->op_prepares);
+    free(l->ops);
+    free(l->op_free);
+    free(l->chains);
+    free(l->qp);
+    free(l->fqp);
+    free(l->prepares);
+    free(l->results);
+    free(l->stats);
+    free(l->trace);
+    pthread_mutex_destroy(&l->lock);
+    memset(l, 0, sizeof(*l));
+}
+
 int rdma_init(struct rdma_ctx *r, struct config *c) {
     union ibv_gid gid;
     struct ibv_port_attr pa;
@@ -78,184 +244,121 @@ int rdma_init(struct rdma_ctx *r, struct config *c) {
     }
     r->lid = pa.lid;
 
-    if (!(r->pd = ibv_alloc_pd(r->ctx))) {
-        FAA_LOG("ibv_alloc_pd failed");
+    struct ibv_device_attr da;
+    if (ibv_query_device(r->ctx, &da)) {
+        FAA_LOG("ibv_query_device failed");
         goto exit;
     }
+    r->max_cqe = da.max_cqe;
 
-    size_t nb = sizeof(*r->shared_mem);
-    if (!(r->shared_mem = calloc(1, nb))) {
-        perror("calloc:");
-        goto errpd;
-    }
-    r->shared_mem->frontier = 0;
-
-    r->mr[0] =
-        ibv_reg_mr(r->pd, r->shared_mem, nb,
-                   IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
-                       IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
-    if (!r->mr[0]) {
-        FAA_LOG("Failed to register memory region");
-        goto errslots;
-    }
-
-    // allocate results buffer
-    nb = sizeof(uint64_t) * (c->n + 1);
-    if (!(r->results = calloc(1, nb))) {
-        perror("calloc:");
-        goto errmr;
-    }
-    r->mr[1] = ibv_reg_mr(r->pd, r->results, nb, IBV_ACCESS_LOCAL_WRITE);
-    if (!r->mr[1]) {
-        FAA_LOG("Failed to register memory region");
-        goto errres;
-    }
-
-    // allocate completion queue for consensus
-    if (!(r->cq = ibv_create_cq(r->ctx, 1024, NULL, NULL, 0))) {
-        FAA_LOG("ibv_create_cq failed");
-        goto errmr2;
+    if (!(r->pd = ibv_alloc_pd(r->ctx))) {
+        FAA_LOG("ibv_alloc_pd failed");
+        goto exit;
     }
 
-    // allocate completion queue for frontier operations
-    if (!(r->fcq = ibv_create_cq(r->ctx, 16, NULL, NULL, 0))) {
-        FAA_LOG("ibv_create_cq (frontier) failed");
-        goto errcq;
+    r->c = c;
+    r->grower = 0;
+    uint64_t max_slots = c->max_slots ? c->max_slots : MAX_SLOTS;
+    if (rdma_region_init(r, &r->faa, OBJ_FAA, max_slots)) {
+        FAA_LOG("Failed to create the FAA region");
+        goto errfaa;
     }
 
-    // allocate queue-pairs
-    nb = sizeof(struct ibv_qp *) * c->n;
-    if (!(r->qp = calloc(1, nb))) {
-        perror("calloc:");
-        goto errfrontiercq;
+    // allocate per-thread lanes, plus the grower's and the recoverer's
+    r->nlanes = c->lanes ? c->lanes : 1;
+    // every lane names itself in its ballots
+    if (c->n > BALLOT_NODES || r->nlanes + SYS_LANES > BALLOT_LANES) {
+        FAA_LOG("Ballots name at most %d nodes and %d lanes", BALLOT_NODES,
+                BALLOT_LANES - SYS_LANES);
+        goto errfaa;
     }
-    if (!(r->fqp = calloc(1, nb))) {
+    if (!(r->lanes = calloc(r->nlanes + SYS_LANES, sizeof(struct rdma_lane)))) {
         perror("calloc:");
-        goto errfrontiercq;
+        goto errfaa;
     }
-
-    // init queue pairs
+    r->ctl = r->lanes + r->nlanes;
+    r->rec = r->ctl + 1;
     int i = 0;
-    for (; i < c->n; ++i) {
-        if (i != c->host_id && __add_qp(r, i, c->c[i].ib_port, 0)) {
-            FAA_LOG("Failed to create QP %d", i);
-            goto errra;
+    for (; i < r->nlanes + SYS_LANES; ++i)
+        if (__lane_init(r, r->lanes + i, c, i)) {
+            FAA_LOG("Failed to create lane %d", i);
+            goto errlanes;
         }
-        if (__add_qp(r, i, c->c[i].ib_port, 1)) {
-            FAA_LOG("Failed to create QP %d", i);
-            goto errra;
-        }
-    }
 
-    nb = sizeof(struct remote_attr) * c->n;
+    size_t nb = sizeof(struct remote_attr) * c->n;
     if (!(r->ra = calloc(1, nb))) {
         perror("calloc");
-        goto errra;
+        goto errlanes;
     }
 
-    nb = sizeof(struct prep_res) * c->n;
-    if (!(r->prepares = calloc(1, nb))) {
-        perror("calloc");
-        goto err;
+    /* LL/SC: Allocate LL/SC slot region */
+    if (rdma_region_init(r, &r->llsc, OBJ_LLSC, max_slots)) {
+        FAA_LOG("Failed to create the LL/SC region");
+        goto errllsc;
     }
 
-    /* LL/SC: Allocate LL/SC memory regions */
-    nb = sizeof(*r->llsc_mem);
-    if (!(r->llsc_mem = calloc(1, nb))) {
-        perror("calloc (llsc_mem)");
-        goto errprep;
-    }
-    r->llsc_mem->frontier = 0;
-
-    r->llsc_mr[0] =
-        ibv_reg_mr(r->pd, r->llsc_mem, nb,
-                   IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |
-                       IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC);
-    if (!r->llsc_mr[0]) {
-        FAA_LOG("Failed to register LL/SC memory region");
-        goto errllscmem;
-    }
-
-    /* LL/SC: Allocate recovery memory (MRc and MSj) */
-    nb = sizeof(struct recovery_req) * c->n;
+    /* LL/SC: Allocate recovery memory (MRc, then MSj) */
+    nb = (sizeof(struct recovery_req) * c->n + sizeof(struct recovery_resp)) *
+         RECOVERY_SLOTS;
     if (!(r->recovery_reqs = calloc(1, nb))) {
         perror("calloc (recovery_reqs)");
-        goto errllscmr0;
-    }
-
-    nb = sizeof(struct recovery_resp);
-    if (!(r->recovery_resp = calloc(1, nb))) {
-        perror("calloc (recovery_resp)");
-        goto errrecovreq;
+        goto errllsc;
     }
+    r->recovery_resp =
+        (struct recovery_resp *)(r->recovery_reqs + c->n * RECOVERY_SLOTS);
+    r->recovery_free = ~0ULL >> (64 - RECOVERY_SLOTS);
 
-    nb = sizeof(struct recovery_req) * c->n + sizeof(struct recovery_resp);
-    r->llsc_mr[1] = ibv_reg_mr(r->pd, r->recovery_reqs, nb,
-                               IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
-                                   IBV_ACCESS_REMOTE_READ);
-    if (!r->llsc_mr[1]) {
+    r->recovery_mr = ibv_reg_mr(r->pd, r->recovery_reqs, nb,
+                                IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_WRITE |
+                                    IBV_ACCESS_REMOTE_READ);
+    if (!r->recovery_mr) {
         FAA_LOG("Failed to register LL/SC recovery memory region");
-        goto errrecovresp;
+        goto errrecov;
     }
 
-    /* LL/SC: Allocate result buffers */
-    nb = sizeof(struct llsc_slot) * c->n;
-    if (!(r->llsc_results = calloc(1, nb))) {
-        perror("calloc (llsc_results)");
-        goto errllscmr1;
+    if (rdma_obj_init(r)) {
+        FAA_LOG("Failed to create the object registry");
+        goto errobj;
     }
 
-    nb = sizeof(uint64_t) * c->n;
-    if (!(r->frontier_results = calloc(1, nb))) {
-        perror("calloc (frontier_results)");
-        goto errllscres;
+    int ret;
+    if ((ret = rdma_handshake(r))) {
+        FAA_LOG("Failed to connect to the peers");
+        goto errstart;
     }
+    if ((ret = rdma_grower_start(r))) {
+        FAA_LOG("Failed to start the grower");
+        goto errstart;
+    }
+    if ((ret = rdma_recoverer_start(r))) {
+        FAA_LOG("Failed to start the recovery engine");
+        goto errgrower;
+    }
+    return 0;
 
-    r->c = c;
-    return rdma_handshake(r, c);
-
-errllscres:
-    free(r->llsc_results);
-errllscmr1:
-    ibv_dereg_mr(r->llsc_mr[1]);
-errrecovresp:
-    free(r->recovery_resp);
-errrecovreq:
+errgrower:
+    rdma_grower_stop(r);
+    r->grower = 0;
+errstart:
+    rdma_obj_destroy(r);
+    errno = ret < 0 ? -ret : EIO;
+errobj:
+    ibv_dereg_mr(r->recovery_mr);
+    r->recovery_mr = NULL;
+errrecov:
     free(r->recovery_reqs);
-errllscmr0:
-    ibv_dereg_mr(r->llsc_mr[0]);
-errllscmem:
-    free(r->llsc_mem);
-errprep:
-    free(r->prepares);
-err:
+    r->recovery_reqs = NULL;
+errllsc:
+    rdma_region_destroy(&r->llsc);
     free(r->ra);
-errra:
-    for (int j = 0; j <= i; ++j) {
-        if (r->qp[j]) ibv_destroy_qp(r->qp[j]);
-        if (r->fqp[j]) ibv_destroy_qp(r->fqp[j]);
-    }
-    free(r->qp);
-    free(r->fqp);
-    r->qp = r->fqp = NULL;
-errfrontiercq:
-    ibv_destroy_cq(r->fcq);
-    r->fcq = NULL;
-errcq:
-    ibv_destroy_cq(r->cq);
-    r->cq = NULL;
-errmr2:
-    ibv_dereg_mr(r->mr[1]);
-    r->mr[1] = NULL;
-errres:
-    free(r->results);
-    r->results = NULL;
-errmr:
-    ibv_dereg_mr(r->mr[0]);
-    r->mr[0] = NULL;
-errslots:
-    free(r->shared_mem);
-errpd:
+    r->ra = NULL;
+errlanes:
+    for (int j = 0; j <= i && j < r->nlanes + SYS_LANES; ++j)
+        __lane_destroy(r->lanes + j, c->n);
+    free(r->lanes);
+    r->lanes = NULL;
+errfaa:
+    rdma_region_destroy(&r->faa);
     ibv_dealloc_pd(r->pd);
     r->pd = NULL;
 exit:
@@ -265,35 +368,21 @@ exit:
 }
 
 void rdma_destroy(struct rdma_ctx *r) {
-    for (int i = 0; i < 2; ++i)
-        if (r->mr[i]) {
-            ibv_dereg_mr(r->mr[i]);
-            r->mr[i] = NULL;
-        }
-    /* LL/SC: Deregister LL/SC memory regions */
-    for (int i = 0; i < 2; ++i)
-        if (r->llsc_mr[i]) {
-            ibv_dereg_mr(r->llsc_mr[i]);
-            r->llsc_mr[i] = NULL;
-        }
-    for (int i = 0; i < r->c->n; ++i) {
-        if (r->qp[i]) {
-            ibv_destroy_qp(r->qp[i]);
-            r->qp[i] = NULL;
-        }
-        if (r->fqp) {
-            ibv_destroy_qp(r->fqp[i]);
-            r->fqp[i] = NULL;
-        }
-    }
-    if (r->cq) {
-        ibv_destroy_cq(r->cq);
-        r->cq = NULL;
+    rdma_recoverer_stop(r);
+    if (r->grower) {
+        rdma_grower_stop(r);
+        r->grower = 0;
     }
-    if (r->fcq) {
-        ibv_destroy_cq(r->fcq);
-        r->fcq = NULL;
+    rdma_region_destroy(&r->faa);
+    /* LL/SC: Deregister LL/SC memory regions */
+    rdma_region_destroy(&r->llsc);
+    rdma_obj_destroy(r);
+    if (r->recovery_mr) {
+        ibv_dereg_mr(r->recovery_mr);
+        r->recovery_mr = NULL;
     }
+    for (int i = 0; r->lanes && i < r->nlanes + SYS_LANES; ++i)
+        __lane_destroy(r->lanes + i, r->c->n);
     if (r->pd) {
         ibv_dealloc_pd(r->pd);
         r->pd = NULL;
@@ -303,26 +392,25 @@ void rdma_destroy(struct rdma_ctx *r) {
         r->ctx = NULL;
     }
     free(r->ra);
-    free(r->qp);
-    free(r->fqp);
-    free(r->shared_mem);
-    free(r->prepares);
-    free(r->results);
+    free(r->lanes);
     /* LL/SC: Free LL/SC memory */
-    free(r->llsc_mem);
     free(r->recovery_reqs);
-    free(r->recovery_resp);
-    free(r->llsc_results);
-    free(r->frontier_results);
     r->ra = NULL;
-    r->qp = NULL;
-    r->fqp = NULL;
-    r->shared_mem = NULL;
-    r->results = NULL;
-    r->prepares = NULL;
-    r->llsc_mem = NULL;
+    r->lanes = NULL;
+    r->ctl = NULL;
+    r->rec = NULL;
+    r->nlanes = 0;
     r->recovery_reqs = NULL;
     r->recovery_resp = NULL;
-    r->llsc_results = NULL;
-    r->frontier_results = NULL;
+}
+
+void rdma_wait_stats(struct rdma_ctx *r, struct rdma_wait_stats *s) {
+    memset(s, 0, sizeof(*s));
+    // the grower and the recovery engine wait on their lanes too
+    for (int i = 0; i < r->nlanes + SYS_LANES; ++i) {
+        struct rdma_lane *l = r->lanes + i;
+        s->poll_cycles += l->poll_cycles;
+        s->block_cycles += l->block_cycles;
+        s->blocks += l->blocks;
+    }
 }
@@ -0,0 +1,996 @@
+// Asynchronous distributed atomics.
+// Every operation is a state machine advanced by rdma_progress():
+//   FAA: frontier FAA (or stripe) -> (ring wait) -> fast path -> prepare ->
+//        accept -> retry
+//   TAS: fast path -> prepare -> accept -> retry
+//   SC:  fast path -> coordinated recovery, or prepare -> accept -> retry
+//        when leaderless -> read lease revocation
+
+#include "rdma.h"
+#include "arch.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#define FAST_QUORUM(c) ((c->n * 3 + 3) / 4)
+#define CLASSIC_QUORUM(c) (((c)->n / 2) + 1)
+#define COORDINATOR_NODE (0)
+#define MAX_RETRIES (5)
+
+/* LL/SC coordinated recovery timeout */
+#define RECOVERY_TIMEOUT_US (10000000)
+
+/* Asynchronous wr_id: [1 | op:15 | gen:16 | round:16 | peer:16].
+ * Blocking calls never set the top bit */
+#define ASYNC_BIT (1ULL << 63)
+#define ASYNC_WR_ID(op, peer)                                       \
+    (ASYNC_BIT | ((uint64_t)(op)->idx << 48) |                      \
+     ((uint64_t)(op)->gen << 32) | ((uint64_t)(op)->round << 16) | \
+     (uint64_t)(peer))
+
+/* SC frontier CAS replies are flagged in the peer field */
+#define SC_FRONTIER (1 << 15)
+
+static void __faa_slot(struct rdma_op *op);
+static void __ring_wait(struct rdma_op *op);
+static void __cas_fast(struct rdma_op *op);
+static void __prepare(struct rdma_op *op);
+static void __sc_recover(struct rdma_op *op);
+static void __sc_revoke(struct rdma_op *op, int64_t result);
+static void __sc_prepare_eval(struct rdma_op *op);
+static void __sc_accept_eval(struct rdma_op *op);
+static void __revoke_eval(struct rdma_op *op);
+
+/* Remote address of the op's FAA/TAS slot on peer i, or 0 while its chunk
+ * is unknown */
+static inline uint64_t __slot_addr(struct rdma_op *op, int i, uint32_t *rkey) {
+    return rdma_region_raddr(op->g, i, op->slot, rkey);
+}
+
+/* Remote address of a field of the op's LL/SC slot on peer i, or 0 */
+static inline uint64_t __llsc_addr(struct rdma_op *op, int i, size_t field,
+                                   uint32_t *rkey) {
+    uint64_t addr = rdma_region_raddr(op->g, i, op->slot, rkey);
+    return addr ? addr + field : 0;
+}
+
+/* Leaderless SC prepare reads: one slot per peer over results and
+ * fresults */
+static inline struct llsc_slot *__sc_reads(struct rdma_op *op) {
+    return (struct llsc_slot *)op->results;
+}
+
+/* Remote address of the frontier of the op's object on peer i, or 0 */
+static inline uint64_t __frontier_addr(struct rdma_op *op, int i,
+                                       uint32_t *rkey) {
+    uint64_t addr = rdma_region_dir(op->g, i, rkey);
+    return addr ? addr + offsetof(struct region_dir, frontier) : 0;
+}
+
+/* Primitive of each op kind */
+static const uint8_t __prims[] = {STAT_FAA, STAT_TAS, STAT_SC};
+
+static struct rdma_op *__op_alloc(struct rdma_lane *l, struct rdma_region *g,
+                                  uint8_t kind, rdma_op_cb cb, void *arg) {
+    if (!l->op_nfree) return NULL;
+    struct rdma_op *op = l->ops + l->op_free[--l->op_nfree];
+    op->g = g;
+    op->kind = kind;
+    op->retries = 0;
+    op->user = !cb;
+    op->waiting = 0;
+    op->pending = 0;
+    op->result = 0;
+    op->path = STAT_FAST_WIN;
+    op->submitted = ts_ns();
+    op->trace = rdma_trace_begin(l, __prims[kind]);
+    op->cb = cb;
+    op->arg = arg;
+    return op;
+}
+
+/* Recycle op once it is done, released and has no WRs in flight */
+static void __op_put(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    if (op->state != OP_DONE || op->user || op->pending) return;
+    ++op->gen;
+    op->state = OP_FREE;
+    l->op_free[l->op_nfree++] = op->idx;
+}
+
+/* Word of the op's slot when empty */
+static inline uint64_t __lap(struct rdma_op *op) {
+    return rdma_slot_lap(op->g, op->slot);
+}
+
+/* The op went through path */
+static inline void __op_path(struct rdma_op *op, uint8_t path) {
+    if (path > op->path) op->path = path;
+}
+
+/* The op's round ends: its replies decided it, or no longer can */
+static inline void __op_trace_round(struct rdma_op *op) {
+    if (op->state >= OP_FAST && op->state <= OP_ACCEPT)
+        rdma_trace_ev(op->l, op->trace, TRACE_QUORUM, 0);
+}
+
+static void __op_finish(struct rdma_op *op, int64_t result) {
+    __atomic_store_n(&op->floor, FLOOR_IDLE, __ATOMIC_RELEASE);
+    rdma_stats_record(op->l, __prims[op->kind], op->path,
+                      ts_ns() - op->submitted);
+    if (op->trace) {
+        __op_trace_round(op);
+        rdma_trace_ev(op->l, op->trace, TRACE_END, op->path);
+    }
+    // an SC fails on a conflict, an FAA or TAS only once out of retries
+    rdma_conflict_record(op->g, op->retries,
+                         op->kind == OP_SC ? result != 0 : result < 0);
+    op->state = OP_DONE;
+    op->result = result;
+    ++op->l->op_done;
+    if (op->cb) op->cb(op, result, op->arg);
+    __op_put(op);
+}
+
+/* Stage a signaled WR tagged with the op's current round. It is posted by
+ * the next rdma_flush, and a failed post completes it with an error */
+static void __op_post(struct rdma_op *op, int peer, int frontier,
+                      struct ibv_send_wr *wr) {
+    wr->wr_id = ASYNC_WR_ID(op, peer);
+    wr->send_flags |= IBV_SEND_SIGNALED;
+    rdma_stage(op->l, peer & ~SC_FRONTIER, frontier, wr);
+    ++op->pending;
+}
+
+static void __next_round(struct rdma_op *op, uint8_t state) {
+    if (op->trace) {
+        __op_trace_round(op);
+        rdma_trace_ev(op->l, op->trace, TRACE_PHASE, state);
+    }
+    op->first = 0;
+    ++op->round;
+    op->state = state;
+    op->replies = 0;
+    op->successes = 0;
+    op->failures = 0;
+}
+
+/* FAA: reserve a slot from the frontier node */
+static void __faa_slot(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    struct rdma_ctx *r = l->r;
+    uint32_t rkey = 0;
+    uint64_t addr = __frontier_addr(op, FRONTIER_NODE, &rkey);
+    struct ibv_sge sge = {.addr = (uint64_t)(op->fresults + r->c->n),
+                          .length = sizeof(uint64_t),
+                          .lkey = l->op_mr->lkey};
+    struct ibv_send_wr wr = {
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_ATOMIC_FETCH_AND_ADD,
+        .wr.atomic = {.remote_addr = addr, .rkey = rkey, .compare_add = 1}};
+
+    __next_round(op, OP_SLOT);
+    op->retries = 0;
+    // slots handed out from now on are above this node's low
+    if (op->floor == FLOOR_IDLE)
+        __atomic_store_n(&op->floor, op->g->mine, __ATOMIC_SEQ_CST);
+    if (r->c->frontier_mode == FRONTIER_STRIPED)
+        op->slot = rdma_stripe_next(op->g, 1);
+    else if (r->c->frontier_mode == FRONTIER_LEASED)
+        op->slot = rdma_lease_try(op->g, 1);  // a new lease is a blocking FAA
+    else
+        op->slot = -1;
+    if (op->slot != (uint64_t)-1) {
+        // no round trip: the fast path starts from the next rdma_progress
+        __atomic_store_n(&op->floor, op->slot, __ATOMIC_RELEASE);
+        __ring_wait(op);
+        return;
+    }
+    if (!addr)
+        __op_finish(op, -EAGAIN);  // the frontier node has no such object yet
+    else
+        __op_post(op, FRONTIER_NODE, 1, &wr);
+}
+
+static void __slot_reply(struct rdma_op *op, int ok) {
+    struct rdma_ctx *r = op->l->r;
+    if (!ok) {
+        __op_path(op, STAT_RETRIED);
+        __faa_slot(op);  // failed. try again
+        return;
+    }
+    op->slot = op->fresults[r->c->n];
+    op->mine = gen_ballot(op->l);
+    __atomic_store_n(&op->floor, op->slot, __ATOMIC_RELEASE);
+    if (op->slot >= __atomic_load_n(&op->g->high, __ATOMIC_ACQUIRE))
+        __ring_wait(op);  // the slot's previous lap is not reset everywhere
+    else
+        __cas_fast(op);
+}
+
+/* Park the op until the ring frees its slot */
+static void __ring_wait(struct rdma_op *op) {
+    __next_round(op, OP_RING);
+    op->deadline = ts_us() + RING_WAIT_US;
+    ++op->l->nring;
+}
+
+static void __ring_poll(struct rdma_op *op) {
+    if (op->slot < __atomic_load_n(&op->g->high, __ATOMIC_ACQUIRE)) {
+        --op->l->nring;
+        __cas_fast(op);
+    } else if (ts_us() > op->deadline) {
+        --op->l->nring;
+        // the ring stayed full: the slot is decided as a no-op later
+        rdma_hole_add(op->g, op->slot, op->slot + 1);
+        __op_finish(op, -ENOMEM);
+    }
+}
+
+/* Fast path: broadcast CAS of swp into the op's slot */
+static void __fast_eval(struct rdma_op *op) {
+    struct config *c = op->l->r->c;
+    int res;
+    if (op->successes >= FAST_QUORUM(c))
+        res = 0;  // a fast quorum took mine, local or not
+    else if (rdma_prepare_decided(c, op->prepares, op->mine) == 1)
+        res = 1;  // a fast quorum took another ballot
+    else if (op->replies == c->n - 1)
+        res = -1;
+    else
+        return;
+    rdma_fast_path_record(op->g, res < 0);
+    if (res < 0) rdma_count(op->l, undecided, 1);
+
+    if (op->kind == OP_TAS) {
+        if (res == 1) __op_path(op, STAT_FAST_LOSS);
+        if (res >= 0)
+            __op_finish(op, res);
+        else
+            __prepare(op);
+    } else if (!res)
+        __op_finish(op, op->slot);  // this thread won
+    else if (res == 1) {
+        __op_path(op, STAT_RETRIED);
+        __faa_slot(op);  // slot commited by another thread
+    } else
+        __prepare(op);
+}
+
+static void __cas_fast(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+
+    // a contended object wastes the broadcast: prepare right away
+    if (rdma_fast_path_skip(op->g)) {
+        __prepare(op);
+        return;
+    }
+    uint64_t *local = rdma_faa_slot(op->g, op->slot);
+    if (!local) {
+        __op_finish(op, -EAGAIN);  // the slot's chunk is not mapped here
+        return;
+    }
+    __next_round(op, OP_FAST);
+    rdma_count(l, fast, 1);
+    uint64_t lap = __lap(op);
+    op->successes = __sync_bool_compare_and_swap(local, lap, op->mine | lap);
+    // the ballots the replicas hold, as the CASes that failed return them
+    memset(op->prepares, 0, sizeof(struct prep_res) * c->n);
+    op->prepares[c->host_id].success =
+        !rdma_slot_ballot(op->g, op->slot, *(volatile uint64_t *)local,
+                          &op->prepares[c->host_id].ballot);
+
+    for (int i = 0; i < c->n; ++i)
+        if (i != c->host_id) {
+            uint32_t rkey;
+            uint64_t addr = __slot_addr(op, i, &rkey);
+            if (!addr) {
+                ++op->replies;  // chunk not known yet: counts as failed
+                continue;
+            }
+            struct ibv_sge sge = {.addr = (uint64_t)(op->results + i),
+                                  .length = sizeof(uint64_t),
+                                  .lkey = l->op_mr->lkey};
+            struct ibv_send_wr wr = {
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
+                .wr.atomic = {.remote_addr = addr,
+                              .rkey = rkey,
+                              .compare_add = lap,
+                              .swap = op->mine | lap}};
+            __op_post(op, i, 0, &wr);
+        }
+    __fast_eval(op);
+}
+
+/* Slow path finished a round with res (0 won, 1 lost, -1 undecided) */
+static void __slow_eval(struct rdma_op *op, int res) {
+    uint64_t *local = rdma_faa_slot(op->g, op->slot);
+    if (!local) {
+        __op_finish(op, -EAGAIN);
+        return;
+    }
+    uint64_t val = *(volatile uint64_t *)local;
+    val = (val != __lap(op));  // filled
+
+    if (op->kind == OP_TAS) {
+        if (res >= 0)
+            __op_finish(op, res != 0);
+        else if (val)
+            __op_finish(op, 1);
+        else if (++op->retries >= MAX_RETRIES) {
+            rdma_count(op->l, gave_up, 1);
+            __op_finish(op, -1);
+        }
+        else {
+            __op_path(op, STAT_RETRIED);
+            __cas_fast(op);
+        }
+    } else if (!res)
+        __op_finish(op, op->slot);
+    else {
+        __op_path(op, STAT_RETRIED);
+        int given_up = res < 0 && !val && ++op->retries > MAX_RETRIES;
+        if (given_up) rdma_count(op->l, gave_up, 1);
+        if (res > 0 || val || given_up)
+            __faa_slot(op);  // lost or given up. take a new slot
+        else
+            __prepare(op);
+    }
+}
+
+/* Slow path phase 2b: CAS the proposal over the prepared ballots */
+static void __accept_eval(struct rdma_op *op) {
+    struct config *c = op->l->r->c;
+    if (op->kind == OP_SC) {
+        __sc_accept_eval(op);
+        return;
+    }
+    if (op->successes >= CLASSIC_QUORUM(c))
+        __slow_eval(op, op->proposal != op->mine);
+    else if (op->successes + (c->n - 1 - op->replies) < CLASSIC_QUORUM(c))
+        __slow_eval(op, -1);
+}
+
+static void __accept(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+
+    uint64_t *local = rdma_faa_slot(op->g, op->slot);
+    if (!local) {
+        __op_finish(op, -EAGAIN);
+        return;
+    }
+    __next_round(op, OP_ACCEPT);
+    uint64_t lap = __lap(op);
+    uint64_t cmp = op->prepares[c->host_id].ballot | lap;
+    op->successes =
+        __sync_bool_compare_and_swap(local, cmp, op->proposal | lap);
+    if (op->kind == OP_SC) {
+        // ballot first, then the value
+        op->won = op->successes ? 1ULL << c->host_id : 0;
+        if (op->successes && !(op->proposal & COMPACT_FLAG))
+            rdma_llsc_slot(op->g, op->slot)->value = op->fresults[c->n];
+    }
+
+    for (int i = 0; i < c->n; ++i)
+        if (i != c->host_id) {
+            uint32_t rkey;
+            uint64_t addr = __slot_addr(op, i, &rkey);
+            if (!addr) {
+                ++op->replies;
+                continue;
+            }
+            struct ibv_sge sge = {.addr = (uint64_t)(op->results + i),
+                                  .length = sizeof(uint64_t),
+                                  .lkey = l->op_mr->lkey};
+            struct ibv_send_wr wr = {
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
+                .wr.atomic = {.remote_addr = addr,
+                              .rkey = rkey,
+                              .compare_add = op->prepares[i].ballot | lap,
+                              .swap = op->proposal | lap}};
+            __op_post(op, i, 0, &wr);
+        }
+    __accept_eval(op);
+}
+
+/* Slow path phase 2a: read the slot from every replica */
+static void __prepare_eval(struct rdma_op *op) {
+    struct config *c = op->l->r->c;
+    if (op->kind == OP_SC) {
+        __sc_prepare_eval(op);
+        return;
+    }
+    int decided = rdma_prepare_decided(c, op->prepares, op->mine);
+    if (decided != -1) {
+        __slow_eval(op, decided);
+        return;
+    }
+    if (op->replies < c->n - 1) return;
+    rdma_ballots_seen(op->l, op->prepares, c->n);
+    int outcome = rdma_prepare_outcome(c, op->prepares, op->ballot, op->mine,
+                                       &op->proposal);
+    if (outcome == 2)
+        __accept(op);
+    else
+        __slow_eval(op, outcome);
+}
+
+static void __prepare(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+
+    uint64_t *local = rdma_faa_slot(op->g, op->slot);
+    if (!local) {
+        __op_finish(op, -EAGAIN);
+        return;
+    }
+    __next_round(op, OP_PREPARE);
+    __op_path(op, STAT_SLOW);
+    rdma_count(l, slow, 1);
+    int sc = op->kind == OP_SC;  // reads the whole slot, keeps its ballot
+    if (!sc) op->ballot = gen_ballot(l);
+    memset(op->prepares, 0, sizeof(struct prep_res) * c->n);
+    if (sc)
+        __sc_reads(op)[c->host_id] =
+            *(volatile struct llsc_slot *)rdma_llsc_slot(op->g, op->slot);
+    // replicas holding another lap of the slot cannot promise
+    op->prepares[c->host_id].success =
+        !rdma_slot_ballot(op->g, op->slot, *(volatile uint64_t *)local,
+                          &op->prepares[c->host_id].ballot);
+
+    for (int i = 0; i < c->n; ++i)
+        if (i != c->host_id) {
+            uint32_t rkey;
+            uint64_t addr = __slot_addr(op, i, &rkey);
+            if (!addr) {
+                ++op->replies;
+                continue;
+            }
+            struct ibv_sge sge = {
+                .addr = sc ? (uint64_t)(__sc_reads(op) + i)
+                           : (uint64_t)(op->results + i),
+                .length = sc ? sizeof(struct llsc_slot) : sizeof(uint64_t),
+                .lkey = l->op_mr->lkey};
+            struct ibv_send_wr wr = {
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_RDMA_READ,
+                .wr.rdma = {.remote_addr = addr, .rkey = rkey}};
+            __op_post(op, i, 0, &wr);
+        }
+    __prepare_eval(op);
+}
+
+/* Write the SC value, staged in fresults, to the peers in mask whose slot
+ * took ballot, unless the ballot carries it. Returns whether the writes
+ * were inlined and need a flush */
+static int __sc_write_value(struct rdma_op *op, uint64_t ballot,
+                            uint64_t mask) {
+    struct rdma_lane *l = op->l;
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+    int inlined = sizeof(uint64_t) <= (size_t)r->max_inline;
+    if (ballot & COMPACT_FLAG) return 0;
+    for (int i = 0; i < c->n; ++i)
+        if (i != c->host_id && (mask & (1ULL << i))) {
+            uint32_t rkey = 0;
+            uint64_t addr =
+                __llsc_addr(op, i, offsetof(struct llsc_slot, value), &rkey);
+            struct ibv_sge sge = {.addr = (uint64_t)(op->fresults + c->n),
+                                  .length = sizeof(uint64_t),
+                                  .lkey = l->op_mr->lkey};
+            struct ibv_send_wr wr = {
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_RDMA_WRITE,
+                .wr.rdma = {.remote_addr = addr, .rkey = rkey}};
+            if (inlined)
+                rdma_stage(l, i, 0, &wr);  // nothing waits on it
+            else
+                __op_post(op, i, 0, &wr);  // keep the source alive
+        }
+    return inlined;
+}
+
+/* Publish the op's slot, decided with ballot, as the last slot of its
+ * object. Only inlined: nothing keeps the head alive. Returns whether it
+ * was published */
+static int __sc_publish(struct rdma_op *op, uint64_t ballot) {
+    struct rdma_lane *l = op->l;
+    struct rdma_ctx *r = l->r;
+    struct llsc_head *head = (struct llsc_head *)(op->fresults + r->c->n + 1);
+    if (sizeof(*head) > (size_t)r->max_inline) return 0;
+    head->next = op->slot + 1;
+    head->slot.ballot = ballot | __lap(op);
+    head->slot.value = op->fresults[r->c->n];
+    rdma_llsc_publish(l, op->g, head, l->op_mr->lkey, 0);
+    return 1;
+}
+
+/* Leaderless SC: run prepare/accept rounds on the slot itself */
+static void __sc_paxos(struct rdma_op *op) {
+    __op_path(op, STAT_RECOVERY);
+    op->started = ts_us();
+    op->retries = 0;
+    if (!rdma_llsc_slot(op->g, op->slot))
+        __op_finish(op, -1);
+    else
+        __prepare(op);
+}
+
+/* Leaderless SC: the slot is decided, by this op or another proposer */
+static void __sc_settle(struct rdma_op *op, int64_t result) {
+    rdma_recovery_record(op->l->r, op->started);
+    __sc_revoke(op, result);
+}
+
+static void __sc_retry(struct rdma_op *op) {
+    if (++op->retries < MAX_RETRIES) {
+        __prepare(op);
+        return;
+    }
+    FAA_LOG("Leaderless recovery of slot %llu undecided",
+            (unsigned long long)op->slot);
+    rdma_count(op->l, gave_up, 1);
+    rdma_recovery_record(op->l->r, op->started);
+    __op_finish(op, -1);
+}
+
+static void __sc_prepare_eval(struct rdma_op *op) {
+    struct config *c = op->l->r->c;
+    int from;
+    int outcome = rdma_llsc_outcome(c, op->prepares, op->ballot,
+                                    &op->proposal, &from);
+    if (outcome == 0 || outcome == 1) {
+        __sc_settle(op, outcome ? -1 : 0);  // no other reply needed
+        return;
+    }
+    if (op->replies < c->n - 1) return;
+    if (outcome == -1) {
+        rdma_ballots_seen(op->l, op->prepares, c->n);
+        __sc_retry(op);
+        return;
+    }
+    // adopt the value of the replica the proposal was read from
+    op->fresults[c->n] = from < 0 ? op->value : __sc_reads(op)[from].value;
+    __accept(op);
+}
+
+/* Every CAS that landed gets the value before the round ends */
+static void __sc_accept_eval(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    struct config *c = l->r->c;
+    if (op->replies < c->n - 1) return;
+    int flush = __sc_write_value(op, op->proposal, op->won);
+    if (op->successes < CLASSIC_QUORUM(c)) {
+        if (flush) rdma_flush(l);
+        __sc_retry(op);  // another proposer got in first
+        return;
+    }
+    // the slot may be the last one, unless a later one was decided
+    if (op->slot + 1 >= *(volatile uint64_t *)&op->g->dir->frontier)
+        flush |= __sc_publish(op, op->proposal);
+    if (flush) rdma_flush(l);
+    __sc_settle(op, op->proposal == op->ballot ? 0 : -1);
+}
+
+/* SC fast path: CAS the slot ballot and the frontier on every replica */
+static void __sc_eval(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+
+    // write the value where the ballot CAS won, so whoever finishes the
+    // slot can read it back
+    op->fresults[c->n] = op->value;
+    if (op->successes >= FAST_QUORUM(c)) {
+        int flush = __sc_write_value(op, op->ballot, op->won);
+        // inline data is copied on post, before the op can be recycled
+        if (__sc_publish(op, op->ballot) || flush) rdma_flush(l);
+        __sc_revoke(op, 0);  // ignores the remaining CAS replies
+    } else if (op->failures > c->n - FAST_QUORUM(c) ||
+               op->replies == 2 * (c->n - 1)) {
+        if (op->successes == 0) {
+            __op_path(op, STAT_FAST_LOSS);
+            __op_finish(op, -1);
+            return;
+        }
+        // prepare reads reuse the CAS results: wait for every reply
+        int leaderless = c->llsc_recovery == LLSC_LEADERLESS;
+        if (leaderless && op->replies < 2 * (c->n - 1)) return;
+        if (__sc_write_value(op, op->ballot, op->won)) rdma_flush(l);
+        rdma_count(l, undecided, 1);
+        if (leaderless)
+            __sc_paxos(op);
+        else
+            __sc_recover(op);
+    }
+}
+
+static void __sc_fast(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+    uint64_t index = op->slot;
+
+    __next_round(op, OP_FAST);
+    op->ballot = rdma_llsc_compact(l, op->value);
+    if (!op->ballot) op->ballot = gen_ballot(l);
+    op->won = 0;
+    if (index >= __atomic_load_n(&op->g->high, __ATOMIC_ACQUIRE)) {
+        __op_finish(op, -1);  // the ring is full
+        return;
+    }
+    rdma_count(l, fast, 1);
+
+    uint64_t lap = __lap(op);
+    struct llsc_slot *local = rdma_llsc_slot(op->g, index);
+    int local_slot_success =
+        local &&
+        __sync_bool_compare_and_swap(&local->ballot, lap, op->ballot | lap);
+    if (local_slot_success && !(op->ballot & COMPACT_FLAG))
+        local->value = op->value;
+    int local_frontier_success = __sync_bool_compare_and_swap(
+        &op->g->dir->frontier, index, index + 1);
+    if (local_slot_success && local_frontier_success)
+        ++op->successes;
+    else
+        ++op->failures;
+
+    for (int i = 0; i < c->n; ++i)
+        if (i != c->host_id) {
+            uint32_t rkey = 0;
+            uint64_t addr =
+                __llsc_addr(op, i, offsetof(struct llsc_slot, ballot), &rkey);
+            struct ibv_sge sge_slot = {.addr = (uint64_t)(op->results + i),
+                                       .length = sizeof(uint64_t),
+                                       .lkey = l->op_mr->lkey};
+            struct ibv_send_wr wr_slot = {
+                .sg_list = &sge_slot,
+                .num_sge = 1,
+                .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
+                .wr.atomic = {.remote_addr = addr,
+                              .rkey = rkey,
+                              .compare_add = lap,
+                              .swap = op->ballot | lap}};
+            if (addr)
+                __op_post(op, i, 0, &wr_slot);
+            else {
+                ++op->replies;  // chunk not known yet: counts as failed
+                ++op->failures;
+            }
+
+            addr = __frontier_addr(op, i, &rkey);
+            if (!addr) {
+                ++op->replies;  // object not found there yet
+                ++op->failures;
+                continue;
+            }
+            struct ibv_sge sge_frontier = {
+                .addr = (uint64_t)(op->fresults + i),
+                .length = sizeof(uint64_t),
+                .lkey = l->op_mr->lkey};
+            struct ibv_send_wr wr_frontier = {
+                .sg_list = &sge_frontier,
+                .num_sge = 1,
+                .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
+                .wr.atomic = {.remote_addr = addr,
+                              .rkey = rkey,
+                              .compare_add = index,
+                              .swap = index + 1}};
+            __op_post(op, i | SC_FRONTIER, 0, &wr_frontier);
+        }
+    __sc_eval(op);
+}
+
+/* SC decided: end the read leases of g before the op completes with
+ * result. won holds the readers not revoked yet and successes the
+ * revocations posted */
+static void __sc_revoke(struct rdma_op *op, int64_t result) {
+    struct rdma_lane *l = op->l;
+    struct config *c = l->r->c;
+    uint64_t readers = rdma_rlease_readers(op->g);
+
+    __next_round(op, OP_REVOKE);
+    op->result = result;
+    if (readers & (1ULL << c->host_id)) {
+        __atomic_store_n(&op->g->dir->revoked, 1, __ATOMIC_SEQ_CST);
+        readers &= ~(1ULL << c->host_id);
+    }
+    op->won = readers;
+    op->deadline = 0;
+    op->results[c->host_id] = 1;  // no reply lands in the op's own entry
+    for (int i = 0; i < c->n; ++i) {
+        if (!(readers & (1ULL << i))) continue;
+        uint32_t rkey;
+        uint64_t addr = rdma_region_dir(op->g, i, &rkey);
+        if (!addr) continue;  // stays in won: waited out
+        struct ibv_sge sge = {.addr = (uint64_t)(op->results + c->host_id),
+                              .length = sizeof(uint64_t),
+                              .lkey = l->op_mr->lkey};
+        struct ibv_send_wr wr = {
+            .sg_list = &sge,
+            .num_sge = 1,
+            .opcode = IBV_WR_RDMA_WRITE,
+            .wr.rdma = {.remote_addr = addr + offsetof(struct region_dir, revoked),
+                        .rkey = rkey}};
+        __op_post(op, i, 0, &wr);
+        ++op->successes;
+    }
+    __revoke_eval(op);
+}
+
+/* Complete the SC once every reader is revoked, or wait out the others */
+static void __revoke_eval(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    if (op->replies < op->successes) return;
+    if (!op->won) {
+        __op_finish(op, op->result);
+        return;
+    }
+    op->deadline = ts_us() + RLEASE_WAIT_US(l->r->c->read_lease_us);
+    ++l->nrevoke;
+}
+
+static void __revoke_poll(struct rdma_op *op) {
+    if (ts_us() > op->deadline) {
+        --op->l->nrevoke;
+        __op_finish(op, op->result);
+    }
+}
+
+static void __sc_reply(struct rdma_op *op, int peer, int ok) {
+    if (peer & SC_FRONTIER) {
+        peer &= ~SC_FRONTIER;
+        if (ok && op->fresults[peer] == op->slot)
+            ++op->successes;
+        else
+            ++op->failures;
+    } else if (ok && op->results[peer] == __lap(op)) {
+        ++op->successes;
+        op->won |= 1ULL << peer;
+    } else
+        ++op->failures;
+    __sc_eval(op);
+}
+
+/* SC slow path: ask the coordinator to decide the slot. The op waits for
+ * one of the node's response slots first */
+static void __sc_recover_done(struct rdma_op *op, int64_t result) {
+    struct rdma_lane *l = op->l;
+    if (op->rslot >= 0) rdma_recovery_done(l->r, op->rslot, op->started);
+    op->rslot = -1;
+    --l->nrecover;
+    if (result == 0)
+        __sc_revoke(op, 0);
+    else
+        __op_finish(op, result);
+}
+
+static void __sc_poll_recover(struct rdma_op *op) {
+    struct rdma_lane *l = op->l;
+    struct rdma_ctx *r = l->r;
+
+    if (op->waiting) {
+        if ((op->rslot = rdma_recovery_slot(r)) < 0) {
+            if (ts_us() > op->deadline) __sc_recover_done(op, -1);
+            return;
+        }
+        op->waiting = 0;
+
+        // rdma-write(MRc[j][s], ⟨threadID, t⟩)
+        struct recovery_req *req = (struct recovery_req *)op->results;
+        rdma_recovery_fill(r, op->rslot, req, op->g, op->slot);
+        uint32_t rkey = 0;
+        uint64_t addr = rdma_recovery_send(r, op->rslot, req, &rkey);
+        if (!addr) return;  // this node is the coordinator
+        struct ibv_sge sge = {.addr = (uint64_t)req,
+                              .length = sizeof(struct recovery_req),
+                              .lkey = l->op_mr->lkey};
+        struct ibv_send_wr wr = {
+            .sg_list = &sge,
+            .num_sge = 1,
+            .opcode = IBV_WR_RDMA_WRITE,
+            .wr.rdma = {.remote_addr = addr, .rkey = rkey}};
+        __op_post(op, COORDINATOR_NODE, 0, &wr);
+        return;
+    }
+
+    struct recovery_req *req = (struct recovery_req *)op->results;
+    struct recovery_resp *resp = rdma_recovery_poll(r, op->rslot, req->seq);
+    if (resp) {
+        int won = (resp->ballot & BALLOT_MASK) == op->ballot;
+        __sc_recover_done(op, won ? 0 : -1);
+    } else if (ts_us() > op->deadline) {
+        FAA_LOG("Recovery timeout for slot %llu",
+                (unsigned long long)op->slot);
+        __sc_recover_done(op, -1);
+    }
+}
+
+static void __sc_recover(struct rdma_op *op) {
+    __next_round(op, OP_RECOVER);
+    __op_path(op, STAT_RECOVERY);
+    op->waiting = 1;
+    op->rslot = -1;
+    op->started = ts_us();
+    op->deadline = op->started + RECOVERY_TIMEOUT_US;
+    ++op->l->nrecover;
+    __sc_poll_recover(op);
+}
+
+/* Route a reply of the op's current round */
+static void __op_reply(struct rdma_op *op, int peer, int ok) {
+    if (op->state != OP_RECOVER) ++op->replies;
+    switch (op->state) {
+    case OP_SLOT:
+        __slot_reply(op, ok);
+        break;
+    case OP_FAST:
+        if (op->kind == OP_SC) {
+            __sc_reply(op, peer, ok);
+            break;
+        }
+        op->successes += ok && op->results[peer] == __lap(op);
+        op->prepares[peer].success =
+            ok && !rdma_slot_ballot(op->g, op->slot, op->results[peer],
+                                    &op->prepares[peer].ballot);
+        __fast_eval(op);
+        break;
+    case OP_PREPARE:
+        op->prepares[peer].success =
+            ok && !rdma_slot_ballot(op->g, op->slot,
+                                    op->kind == OP_SC
+                                        ? __sc_reads(op)[peer].ballot
+                                        : op->results[peer],
+                                    &op->prepares[peer].ballot);
+        __prepare_eval(op);
+        break;
+    case OP_ACCEPT:
+        if (ok && op->results[peer] == (op->prepares[peer].ballot | __lap(op))) {
+            ++op->successes;
+            op->won |= 1ULL << peer;
+        }
+        __accept_eval(op);
+        break;
+    case OP_RECOVER:
+        if (!ok) __sc_recover_done(op, -1);  // coordinator not notified
+        break;
+    case OP_REVOKE:
+        if (ok) op->won &= ~(1ULL << peer);
+        __revoke_eval(op);
+        break;
+    }
+}
+
+static void __op_wc(struct rdma_lane *l, struct ibv_wc *wc) {
+    if (!(wc->wr_id & ASYNC_BIT)) return;  // late blocking call completion
+    struct rdma_op *op = l->ops + ((wc->wr_id >> 48) & 0x7FFF);
+    uint16_t gen = wc->wr_id >> 32;
+    uint16_t round = wc->wr_id >> 16;
+    if (gen != op->gen) return;
+    --op->pending;
+    if (op->state != OP_DONE && round == op->round) {
+        if (op->trace && !op->first) {
+            rdma_trace_ev(l, op->trace, TRACE_FIRST, 0);
+            op->first = 1;
+        }
+        __op_reply(op, wc->wr_id & 0xFFFF, wc->status == IBV_WC_SUCCESS);
+    }
+    __op_put(op);
+}
+
+struct rdma_op *rdma_faa_submit(struct rdma_lane *l, struct rdma_region *g,
+                                rdma_op_cb cb, void *arg) {
+    struct rdma_op *op = __op_alloc(l, g, OP_FAA, cb, arg);
+    if (op) __faa_slot(op);
+    return op;
+}
+
+struct rdma_op *rdma_tas_submit(struct rdma_lane *l, struct rdma_region *g,
+                                uint64_t slot, rdma_op_cb cb, void *arg) {
+    struct rdma_op *op = __op_alloc(l, g, OP_TAS, cb, arg);
+    if (!op) return NULL;
+    op->slot = slot;
+    // the slot is set to the op's own ballot, the same in every round
+    op->mine = gen_ballot(l);
+    if (rdma_region_hold(g, &op->floor, slot))
+        __op_finish(op, -ERANGE);
+    else
+        __cas_fast(op);
+    return op;
+}
+
+struct rdma_op *rdma_sc_submit(struct rdma_lane *l, struct rdma_region *g,
+                               uint64_t index, uint64_t value, rdma_op_cb cb,
+                               void *arg) {
+    struct rdma_op *op = __op_alloc(l, g, OP_SC, cb, arg);
+    if (!op) return NULL;
+    op->slot = index;
+    op->value = value;
+    __sc_fast(op);
+    return op;
+}
+
+int rdma_progress(struct rdma_lane *l, int max) {
+    struct ibv_wc wc[32];
+    uint32_t done = l->op_done;
+
+    // ring one doorbell per QP for everything submitted since the last call
+    rdma_flush(l);
+
+    while (max > 0) {
+        int batch = max < 32 ? max : 32;
+        int n = rdma_poll(l, l->cq, batch, wc);
+        if (n < 0) n = 0;
+        if (n < batch) {
+            int m = rdma_poll(l, l->fcq, batch - n, wc + n);
+            if (m > 0) n += m;
+        }
+        if (!n) break;
+        for (int i = 0; i < n; ++i) __op_wc(l, wc + i);
+        max -= n;
+    }
+
+    // recoveries wait on the response area, FAAs on the ring and SCs on
+    // read leases running out, not on the CQ
+    for (int i = 0; (l->nrecover || l->nring || l->nrevoke) && i < MAX_OPS;
+         ++i)
+        if (l->ops[i].state == OP_RECOVER)
+            __sc_poll_recover(l->ops + i);
+        else if (l->ops[i].state == OP_RING)
+            __ring_poll(l->ops + i);
+        else if (l->ops[i].state == OP_REVOKE && l->ops[i].deadline)
+            __revoke_poll(l->ops + i);
+
+    // post the next rounds of the ops that advanced
+    rdma_flush(l);
+
+    return l->op_done - done;
+}
+
+int rdma_wait(struct rdma_lane *l, struct ibv_cq *cq, int n,
+              struct ibv_wc *wc) {
+    int got = 0, routed = 0;
+    uint64_t start = cpu_cycles();
+    int m = rdma_poll(l, cq, n, wc);
+    for (int i = 0; i < m; ++i) {
+        uint64_t id = wc[i].wr_id;
+        if (id & ASYNC_BIT) {
+            __op_wc(l, wc + i);
+            ++routed;
+        } else if (WR_PHASE(id) != PH_SIGNAL && WR_GEN(id) == l->sync_gen)
+            wc[got++] = wc[i];
+    }
+    if (routed) rdma_flush(l);  // rounds started by the routed replies
+    l->poll_cycles += cpu_cycles() - start;
+
+    if (got && l->trace_wait) {
+        rdma_trace_ev(l, l->trace_wait, TRACE_FIRST, 0);
+        l->trace_wait = 0;
+    }
+    if (got)
+        rdma_wait_done(l);
+    else if (m <= 0)
+        rdma_idle(l, cq);
+    return got;
+}
+
+int rdma_op_test(struct rdma_op *op, int64_t *result) {
+    if (op->state != OP_DONE) return -EINPROGRESS;
+    if (result) *result = op->result;
+    op->user = 0;
+    __op_put(op);
+    return 0;
+}
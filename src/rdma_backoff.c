@@ -0,0 +1,140 @@
+// Contention manager.
+// Every primitive backs off through rdma_backoff() before it retries a
+// conflicting operation and records how the operation ended, so each
+// object keeps its own conflict statistics. Backoffs double per retry from
+// BACKOFF_BASE_NS up to config.backoff_max_us; randomized ones wait a
+// uniform share of that bound, and adaptive ones also scale it by the
+// object's recent conflict rate. Short waits spin, longer ones sleep.
+// FAA and TAS on an object whose fast paths keep ending undecided skip
+// the broadcast they would waste and go straight to the slow path, still
+// trying one fast path in FAST_PROBE to notice contention subside.
+
+#include "rdma.h"
+#include "arch.h"
+
+#include <unistd.h>
+
+/* First backoff */
+#define BACKOFF_BASE_NS (128)
+
+/* Backoffs shorter than this spin */
+#define BACKOFF_SPIN_NS (4000)
+
+/* The conflict rate moves 1/2^RATE_SHIFT of the way per operation */
+#define RATE_SHIFT (4)
+
+/* Undecided fast path rates, out of CONFLICT_ONE, above which an object
+ * skips its fast paths and below which it takes them again */
+#define FAST_SKIP_HIGH (CONFLICT_ONE * 3 / 4)
+#define FAST_SKIP_LOW (CONFLICT_ONE / 4)
+
+/* One in FAST_PROBE operations of a skipping object takes the fast path */
+#define FAST_PROBE (16)
+
+/* xorshift state of the calling thread */
+static __thread uint32_t __seed;
+
+static inline uint32_t __rand(void) {
+    uint32_t x = __seed;
+    if (!x) x = (uint32_t)ts_ns() | 1;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return __seed = x;
+}
+
+/* Move a rate out of CONFLICT_ONE towards hit */
+static void __rate_update(uint32_t *rate, int hit) {
+    // a lost update only delays the average
+    int32_t v = __atomic_load_n(rate, __ATOMIC_RELAXED);
+    v += ((hit ? CONFLICT_ONE : 0) - v) >> RATE_SHIFT;
+    __atomic_store_n(rate, (uint32_t)v, __ATOMIC_RELAXED);
+}
+
+/* Wait of retry attempt on g under the configured policy, in ns */
+static uint64_t __delay(struct rdma_region *g, uint32_t attempt) {
+    struct config *c = g->r->c;
+    uint64_t max = 1000ULL * (c->backoff_max_us ? c->backoff_max_us
+                                                : BACKOFF_MAX_US);
+    uint64_t bound = attempt < 32 ? (uint64_t)BACKOFF_BASE_NS << attempt : max;
+    if (bound > max) bound = max;
+
+    switch (c->backoff_mode) {
+    case BACKOFF_RANDOM:
+        return __rand() % (bound + 1);
+    case BACKOFF_ADAPTIVE: {
+        // a ninth of the bound when nothing conflicts, all of it when
+        // everything does
+        uint32_t rate = __atomic_load_n(&g->conflicts.rate, __ATOMIC_RELAXED);
+        bound = bound * (8 * rate + CONFLICT_ONE) / (9 * CONFLICT_ONE);
+        return __rand() % (bound + 1);
+    }
+    default:
+        return bound;
+    }
+}
+
+void rdma_backoff(struct rdma_region *g, uint32_t attempt) {
+    struct rdma_conflicts *s = &g->conflicts;
+    uint64_t ns = __delay(g, attempt);
+    uint64_t start = ts_ns();
+    if (ns < BACKOFF_SPIN_NS)
+        while (ts_ns() - start < ns) cpu_relax();
+    else
+        usleep(ns / 1000);
+    __atomic_add_fetch(&s->backoffs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->backoff_ns, ts_ns() - start, __ATOMIC_RELAXED);
+}
+
+void rdma_conflict_record(struct rdma_region *g, uint32_t retries, int failed) {
+    struct rdma_conflicts *s = &g->conflicts;
+    int conflicted = retries || failed;
+    __atomic_add_fetch(&s->ops, 1, __ATOMIC_RELAXED);
+    if (conflicted) {
+        __atomic_add_fetch(&s->conflicts, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&s->retries, retries, __ATOMIC_RELAXED);
+    }
+    __rate_update(&s->rate, conflicted);
+}
+
+int rdma_fast_path_skip(struct rdma_region *g) {
+    struct rdma_conflicts *s = &g->conflicts;
+    switch (g->r->c->path_mode) {
+    case PATH_FAST:
+        return 0;
+    case PATH_SLOW:
+        break;
+    default:
+        if (!__atomic_load_n(&s->slow, __ATOMIC_RELAXED) ||
+            __atomic_add_fetch(&s->probe, 1, __ATOMIC_RELAXED) % FAST_PROBE == 0)
+            return 0;
+    }
+    __atomic_add_fetch(&s->fast_skips, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void rdma_fast_path_record(struct rdma_region *g, int undecided) {
+    struct rdma_conflicts *s = &g->conflicts;
+    __rate_update(&s->fast_rate, undecided);
+
+    // between the two thresholds the object keeps its path
+    uint32_t rate = __atomic_load_n(&s->fast_rate, __ATOMIC_RELAXED);
+    if (rate > FAST_SKIP_HIGH)
+        __atomic_store_n(&s->slow, 1, __ATOMIC_RELAXED);
+    else if (rate < FAST_SKIP_LOW)
+        __atomic_store_n(&s->slow, 0, __ATOMIC_RELAXED);
+}
+
+void rdma_conflict_stats(struct rdma_region *g, struct rdma_conflicts *s) {
+    struct rdma_conflicts *st = &g->conflicts;
+    s->ops = __atomic_load_n(&st->ops, __ATOMIC_RELAXED);
+    s->conflicts = __atomic_load_n(&st->conflicts, __ATOMIC_RELAXED);
+    s->retries = __atomic_load_n(&st->retries, __ATOMIC_RELAXED);
+    s->backoffs = __atomic_load_n(&st->backoffs, __ATOMIC_RELAXED);
+    s->backoff_ns = __atomic_load_n(&st->backoff_ns, __ATOMIC_RELAXED);
+    s->fast_skips = __atomic_load_n(&st->fast_skips, __ATOMIC_RELAXED);
+    s->rate = __atomic_load_n(&st->rate, __ATOMIC_RELAXED);
+    s->fast_rate = __atomic_load_n(&st->fast_rate, __ATOMIC_RELAXED);
+    s->probe = __atomic_load_n(&st->probe, __ATOMIC_RELAXED);
+    s->slow = __atomic_load_n(&st->slow, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,173 @@
+// Leased frontier.
+// A node takes a range of slots with one FAA on the frontier node and hands
+// them out with a CAS on its lease. The lease size doubles while leases run
+// out quickly and halves while they outlive their target. A new lease, or
+// the grower once a lease has been idle, claims the unused tail and decides
+// it as no-ops so the log has no holes.
+
+#include "rdma.h"
+
+#include <stdio.h>
+
+/* Lease size bounds, in slots */
+#define LEASE_MIN (MAX_BATCH)
+#define LEASE_MAX (1 << 16)
+
+/* A lease should last about this long */
+#define LEASE_TARGET_US (1000)
+
+/* Idle time after which the grower fills the tail of a lease */
+#define LEASE_TTL_US (10000)
+
+/* Largest lease a region of capacity slots can hold, leaving room for the
+ * other nodes' leases in the ring */
+static inline uint32_t __lease_max(struct rdma_region *g) {
+    uint64_t cap = g->capacity / (4 * g->r->c->n);
+    if (cap > LEASE_MAX) cap = LEASE_MAX;
+    return cap < LEASE_MIN ? LEASE_MIN : (uint32_t)cap;
+}
+
+/* Hand out k slots of the current lease. Returns the first or -1 */
+uint64_t rdma_lease_try(struct rdma_region *g, uint32_t k) {
+    struct rdma_lease *s = &g->lease;
+    uint64_t end = __atomic_load_n(&s->end, __ATOMIC_ACQUIRE);
+    uint64_t x = __atomic_load_n(&s->next, __ATOMIC_ACQUIRE);
+    do {
+        if (x + k > end) return -1;
+    } while (!__atomic_compare_exchange_n(&s->next, &x, x + k, 0,
+                                          __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
+    __atomic_store_n(&s->used_us, ts_us(), __ATOMIC_RELAXED);
+    return x;
+}
+
+/* Claim the unused tail of the lease by moving next to to. Returns the
+ * first slot of the tail; the tail is empty if it is >= the old end */
+static uint64_t __claim(struct rdma_lease *s, uint64_t to) {
+    return __atomic_exchange_n(&s->next, to, __ATOMIC_SEQ_CST);
+}
+
+/* Decide slots [from, end) as no-ops */
+static void __fill(struct rdma_lane *l, struct rdma_region *g, uint64_t from,
+                   uint64_t end) {
+    struct rdma_ctx *r = l->r;
+    int res[MAX_BATCH];
+    while (from < end) {
+        uint32_t k = end - from < MAX_BATCH ? end - from : MAX_BATCH;
+        rdma_bcas_n(l, g, from, k, NOOP_BALLOT(r->c->host_id), res);
+        for (uint32_t j = 0; j < k; ++j)
+            if (res[j] < 0 &&
+                rdma_slow_path(l, g, from + j, gen_ballot(l),
+                               NOOP_BALLOT(r->c->host_id)) < 0)
+                FAA_LOG("Failed to fill slot %llu of an expired lease",
+                        (unsigned long long)(from + j));
+        from += k;
+    }
+}
+
+/* Adapt the lease size to how long the last lease lasted */
+static void __resize(struct rdma_region *g, uint64_t now) {
+    struct rdma_lease *s = &g->lease;
+    uint64_t lasted = now - s->taken_us;
+    if (lasted < LEASE_TARGET_US / 2 && s->size < __lease_max(g))
+        s->size *= 2;
+    else if (lasted > LEASE_TARGET_US * 2 && s->size > LEASE_MIN)
+        s->size /= 2;
+    if (s->size > __lease_max(g)) s->size = __lease_max(g);
+}
+
+uint64_t rdma_lease_next(struct rdma_lane *l, struct rdma_region *g,
+                         uint32_t k) {
+    struct rdma_lease *s = &g->lease;
+    uint64_t slot = rdma_lease_try(g, k);
+    if (slot != (uint64_t)-1) return slot;
+
+    pthread_mutex_lock(&s->lock);
+    slot = rdma_lease_try(g, k);  // another thread took a lease meanwhile
+    if (slot != (uint64_t)-1) goto exit;
+
+    // the unused tail is decided once claimed, so the ring must have room
+    // for it first. Without room the lease keeps it for the grower
+    uint64_t end = s->end;
+    if (__atomic_load_n(&s->next, __ATOMIC_ACQUIRE) < end &&
+        rdma_region_wait(l, g, end))
+        goto exit;
+
+    uint64_t now = ts_us();
+    __resize(g, now);
+    uint32_t size = s->size < k ? k : s->size;
+    uint64_t base = rdma_frontier_faa(l, g, size);
+    if (base == (uint64_t)-1) goto exit;
+
+    // next moves past the old end before end moves, so a handout racing
+    // with this one fails instead of taking a slot of the new lease
+    uint64_t tail = __claim(s, base + k);
+    __atomic_store_n(&s->end, base + size, __ATOMIC_RELEASE);
+    s->taken_us = s->used_us = now;
+    slot = base;
+    if (tail < end) __fill(l, g, tail, end);
+
+exit:
+    pthread_mutex_unlock(&s->lock);
+    return slot;
+}
+
+void rdma_lease_tick(struct rdma_region *g) {
+    struct rdma_lease *s = &g->lease;
+    struct rdma_lane *l = g->r->ctl;
+    uint64_t end = __atomic_load_n(&s->end, __ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->next, __ATOMIC_ACQUIRE) >= end ||
+        ts_us() - __atomic_load_n(&s->used_us, __ATOMIC_RELAXED) <
+            LEASE_TTL_US)
+        return;
+    // the grower cannot wait for its own watermarks; a tail past the ring
+    // window waits for a later tick
+    if (end > __atomic_load_n(&g->high, __ATOMIC_ACQUIRE)) return;
+    if (pthread_mutex_trylock(&s->lock)) return;
+
+    end = s->end;
+    __atomic_store_n(&l->held, g, __ATOMIC_RELAXED);
+    __atomic_store_n(&l->floor, g->mine, __ATOMIC_SEQ_CST);
+    uint64_t tail = __claim(s, end);
+    if (tail < end) {
+        __fill(l, g, tail, end);
+        if (s->size > LEASE_MIN) s->size /= 2;
+    }
+    __atomic_store_n(&l->floor, FLOOR_IDLE, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void rdma_hole_add(struct rdma_region *g, uint64_t from, uint64_t end) {
+    struct rdma_holes *h = &g->holes;
+    pthread_mutex_lock(&h->lock);
+    if (h->n < MAX_HOLES) {
+        h->from[h->n] = from;
+        h->end[h->n] = end;
+        __atomic_store_n(&h->n, h->n + 1, __ATOMIC_RELEASE);
+    } else
+        FAA_LOG("No room to fill slots %llu-%llu: the log keeps a hole",
+                (unsigned long long)from, (unsigned long long)end - 1);
+    pthread_mutex_unlock(&h->lock);
+}
+
+void rdma_holes_tick(struct rdma_region *g) {
+    struct rdma_holes *h = &g->holes;
+    struct rdma_lane *l = g->r->ctl;
+    if (!__atomic_load_n(&h->n, __ATOMIC_ACQUIRE)) return;
+    uint64_t high = __atomic_load_n(&g->high, __ATOMIC_ACQUIRE);
+
+    pthread_mutex_lock(&h->lock);
+    __atomic_store_n(&l->held, g, __ATOMIC_RELAXED);
+    __atomic_store_n(&l->floor, g->mine, __ATOMIC_SEQ_CST);
+    for (uint32_t i = 0; i < h->n;) {
+        if (h->end[i] > high) {
+            ++i;  // still past the ring window
+            continue;
+        }
+        __fill(l, g, h->from[i], h->end[i]);
+        --h->n;
+        h->from[i] = h->from[h->n];
+        h->end[i] = h->end[h->n];
+    }
+    __atomic_store_n(&l->floor, FLOOR_IDLE, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&h->lock);
+}
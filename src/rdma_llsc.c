@@ -7,56 +7,135 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include "arch.h"
 
 #define FAST_QUORUM(c) ((c->n * 3 + 3) / 4)
 #define CLASSIC_QUORUM(c) (((c)->n / 2) + 1)
 #define COORDINATOR_NODE (0)
-
-/* Load-Link: Read frontier from replicas and return max
- * Algorithm 2, Lines 1-4 */
-int rdma_load_link(struct rdma_ctx *r, uint32_t *out_index, uint64_t *out_value) {
+#define RECOVERY_TIMEOUT_US (10000000)
+#define LEADERLESS_ROUNDS (8)
+
+/* Value of slot read from every replica: the ballot a majority holds.
+ * Returns -1 if no ballot has a majority yet */
+static int __ll_read_slot(struct rdma_lane *l, struct rdma_region *g,
+                          uint64_t slot, uint64_t *out_value) {
+    struct rdma_ctx *r = l->r;
     struct config *c = r->c;
-    uint64_t *frontier_results = r->frontier_results;
+    struct llsc_slot *reads = l->llsc_results;
+    uint32_t gen = rdma_sync_begin(l);
+    int replied[c->n];
+    memset(replied, 0, sizeof(replied));
+
+    struct llsc_slot *local = rdma_llsc_slot(g, slot);
+    if (local) {
+        reads[c->host_id] = *(volatile struct llsc_slot *)local;
+        replied[c->host_id] = 1;
+    }
+
+    int num_posted = 0;
+    for (int i = 0; i < c->n; ++i) {
+        if (i == c->host_id) continue;
+        uint32_t rkey;
+        uint64_t addr = rdma_region_raddr(g, i, slot, &rkey);
+        if (!addr) continue;  // chunk not known yet
+        struct ibv_sge sge = {.addr = (uint64_t)(reads + i),
+                              .length = sizeof(struct llsc_slot),
+                              .lkey = l->mr->lkey};
+        struct ibv_send_wr wr = {.wr_id = SYNC_WR_ID(PH_LL, gen, i),
+                                 .sg_list = &sge,
+                                 .num_sge = 1,
+                                 .opcode = IBV_WR_RDMA_READ,
+                                 .send_flags = IBV_SEND_SIGNALED,
+                                 .wr.rdma = {.remote_addr = addr, .rkey = rkey}};
+        rdma_stage(l, i, 0, &wr);
+        num_posted++;
+    }
+    rdma_flush(l);
+
+    struct ibv_wc wc[c->n];
+    for (int completed = 0; completed < num_posted;) {
+        int n = rdma_wait(l, l->cq, c->n, wc);
+        for (int i = 0; i < n; ++i, ++completed)
+            if (wc[i].status == IBV_WC_SUCCESS)
+                replied[WR_PEER(wc[i].wr_id)] = 1;
+    }
 
-    // Read local frontier
-    uint64_t local_frontier = *(volatile uint64_t *)&r->llsc_mem->frontier;
-    frontier_results[c->host_id] = local_frontier;
+    // a loser's ballot may sit on a minority of replicas
+    uint64_t ballot;
+    for (int i = 0; i < c->n; ++i) {
+        if (!replied[i] ||
+            rdma_slot_ballot(g, slot, reads[i].ballot, &ballot) || !ballot)
+            continue;
+        int holders = 0;
+        for (int j = 0; j < c->n; ++j)
+            holders += replied[j] && reads[j].ballot == reads[i].ballot;
+        if (holders >= CLASSIC_QUORUM(c)) {
+            *out_value = rdma_llsc_value(ballot, reads + i);
+            return 0;
+        }
+    }
+    return -1;
+}
 
-    // Issue RDMA reads to all replicas for their frontier values
+/* Load-Link: Read frontier from replicas and return max
+ * Algorithm 2, Lines 1-4
+ * One read of each replica's directory head returns its frontier and the
+ * last slot published there. A head that recorded the slot behind the max
+ * frontier gives the value; otherwise that slot is read from the replicas */
+int rdma_llsc_read(struct rdma_lane *l, struct rdma_region *g,
+                   uint64_t *out_index, uint64_t *out_value) {
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+    uint64_t *heads = l->results;  // DIR_LL_WORDS per node
+    uint32_t gen = rdma_sync_begin(l);
+    int replied[c->n];
+    memset(replied, 0, sizeof(replied));
+    replied[c->host_id] = 1;
+
+    // Read local head. Publishers write the slot before next, so the slot
+    // read between two equal reads of next is the one next was stored with
+    volatile uint64_t *local_head = (volatile uint64_t *)g->dir;
+    uint64_t *own = heads + c->host_id * DIR_LL_WORDS;
+    struct llsc_head *own_last =
+        (struct llsc_head *)(own + offsetof(struct region_dir, last) /
+                                       sizeof(uint64_t));
+    uint64_t next = __atomic_load_n(&g->dir->last.next, __ATOMIC_ACQUIRE);
+    for (int w = 0; w < DIR_LL_WORDS; ++w) own[w] = local_head[w];
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&g->dir->last.next, __ATOMIC_RELAXED) != next)
+        own_last->next = 0;  // republished meanwhile: the head is unused
+
+    // Issue one RDMA read of the head of every replica
+    rdma_trace_phase(l, OP_FAST);
     int num_posted = 0;
     for (int i = 0; i < c->n; ++i) {
         if (i != c->host_id) {
-            struct remote_attr *ra = r->ra + i;
-            uint64_t remote_frontier_addr =
-                ra->addr + offsetof(typeof(*r->llsc_mem), frontier);
+            uint32_t rkey = 0;
+            uint64_t remote_dir_addr = rdma_region_dir(g, i, &rkey);
+            if (!remote_dir_addr) continue;  // object not found there yet
 
             struct ibv_sge sge = {
-                .addr = (uint64_t)(frontier_results + i),
-                .length = sizeof(uint64_t),
-                .lkey = r->llsc_mr[0]->lkey
+                .addr = (uint64_t)(heads + i * DIR_LL_WORDS),
+                .length = DIR_LL_WORDS * sizeof(uint64_t),
+                .lkey = l->mr->lkey
             };
 
             struct ibv_send_wr wr = {
-                .wr_id = i,
+                .wr_id = SYNC_WR_ID(PH_LL, gen, i),
                 .sg_list = &sge,
                 .num_sge = 1,
                 .opcode = IBV_WR_RDMA_READ,
                 .send_flags = IBV_SEND_SIGNALED,
                 .wr.rdma = {
-                    .remote_addr = remote_frontier_addr,
-                    .rkey = ra->rkey
+                    .remote_addr = remote_dir_addr,
+                    .rkey = rkey
                 }
             };
 
-            struct ibv_send_wr *bad_wr;
-            if (ibv_post_send(r->qp[i], &wr, &bad_wr)) {
-                FAA_LOG("Failed to post RDMA read for frontier[%d]", i);
-                return -1;
-            }
+            rdma_stage(l, i, 0, &wr);
             num_posted++;
         }
     }
+    rdma_flush(l);
 
     // Wait for a quorum of responses
     struct ibv_wc wc[c->n];
@@ -65,480 +144,623 @@ int rdma_load_link(struct rdma_ctx *r, uint32_t *out_index, uint64_t *out_value)
     int success_count = 1; // Count local read
 
     while (success_count < quorum && completed < num_posted) {
-        int n = ibv_poll_cq(r->cq, num_posted - completed, wc);
-        if (n > 0) {
-            for (int i = 0; i < n; ++i) {
-                if (wc[i].status == IBV_WC_SUCCESS) {
-                    success_count++;
-                }
+        int n = rdma_wait(l, l->cq, c->n, wc);
+        for (int i = 0; i < n; ++i) {
+            if (wc[i].status == IBV_WC_SUCCESS) {
+                replied[WR_PEER(wc[i].wr_id)] = 1;
+                success_count++;
             }
-            completed += n;
+            completed++;
         }
     }
+    rdma_trace_quorum(l);
 
     if (success_count < quorum) {
         FAA_LOG("Failed to get quorum for Load-Link");
         return -1;
     }
 
-    // Find max frontier (Line 4)
-    uint64_t max_index = local_frontier;
+    // Find max frontier (Line 4). Replicas outside the quorum may still
+    // be writing their reply
+    uint64_t max_index = 0;
     for (int i = 0; i < c->n; ++i) {
-        if (frontier_results[i] > max_index) {
-            max_index = frontier_results[i];
+        if (replied[i] && heads[i * DIR_LL_WORDS] > max_index) {
+            max_index = heads[i * DIR_LL_WORDS];
         }
     }
 
-    *out_index = (uint32_t)max_index;
+    *out_index = max_index;
+    if (max_index == 0) {
+        *out_value = 0; // Nothing decided yet
+        return 0;
+    }
 
-    // Read the value at max_index from local memory if available
-    if (max_index < MAX_SLOTS) {
-        struct llsc_slot *slot = &r->llsc_mem->slots[max_index];
-        uint64_t ballot = *(volatile uint64_t *)&slot->ballot;
-        if (ballot != 0) {
-            *out_value = *(volatile uint64_t *)&slot->value;
-        } else {
-            *out_value = 0; // Empty slot
+    // The value is that of slot max_index - 1, the last one decided. A
+    // head of another slot was overwritten or not published yet. A read
+    // may tear between the head's words, so only a ballot that packs its
+    // value is served from it
+    size_t last = offsetof(struct region_dir, last) / sizeof(uint64_t);
+    for (int i = 0; i < c->n; ++i) {
+        struct llsc_head *h = (struct llsc_head *)(heads + i * DIR_LL_WORDS + last);
+        uint64_t ballot;
+        if (replied[i] && h->next == max_index &&
+            !rdma_slot_ballot(g, max_index - 1, h->slot.ballot, &ballot) &&
+            (ballot & COMPACT_FLAG)) {
+            *out_value = rdma_llsc_value(ballot, &h->slot);
+            return 0;
         }
-    } else {
-        *out_value = 0;
     }
+    return __ll_read_slot(l, g, max_index - 1, out_value);
+}
 
-    return 0;
+int rdma_load_link(struct rdma_lane *l, struct rdma_region *g,
+                   uint64_t *out_index, uint64_t *out_value) {
+    if (l->r->c->read_lease_us)
+        return rdma_rlease_load_link(l, g, out_index, out_value);
+    return rdma_llsc_read(l, g, out_index, out_value);
+}
+
+void rdma_llsc_publish(struct rdma_lane *l, struct rdma_region *g,
+                       struct llsc_head *h, uint32_t lkey, uint32_t gen) {
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+
+    // next last, so a local reader matching it sees the slot too
+    g->dir->last.slot = h->slot;
+    __atomic_store_n(&g->dir->last.next, h->next, __ATOMIC_RELEASE);
+
+    int inlined = sizeof(struct llsc_head) <= (size_t)r->max_inline;
+    for (int i = 0; i < c->n; ++i) {
+        if (i == c->host_id) continue;
+        uint32_t rkey = 0;
+        uint64_t addr = rdma_region_dir(g, i, &rkey);
+        if (!addr) continue;
+        struct ibv_sge sge = {.addr = (uint64_t)h,
+                              .length = sizeof(struct llsc_head),
+                              .lkey = lkey};
+        struct ibv_send_wr wr = {
+            .wr_id = SYNC_WR_ID(PH_WRITE, gen, i),
+            .sg_list = &sge,
+            .num_sge = 1,
+            .opcode = IBV_WR_RDMA_WRITE,
+            .send_flags = inlined ? 0 : IBV_SEND_SIGNALED,
+            .wr.rdma = {.remote_addr = addr + offsetof(struct region_dir, last),
+                        .rkey = rkey}};
+        rdma_stage(l, i, 0, &wr);
+    }
 }
 
 /* Store-Conditional: FastPaxos on the slot
  * Algorithm 2, Lines 5-24
- * NOTE: CAS only on ballot field (64-bit), then write value separately */
-int rdma_store_conditional(struct rdma_ctx *r, uint32_t index, uint64_t value) {
+ * NOTE: CAS only on ballot field (64-bit), then write value separately,
+ * unless the value fits in the ballot */
+int rdma_store_conditional(struct rdma_lane *l, struct rdma_region *g,
+                           uint64_t index, uint64_t value) {
+    struct rdma_ctx *r = l->r;
     struct config *c = r->c;
-    uint16_t thread_id = c->host_id;
-    uint64_t ballot = gen_ballot(thread_id);
+    uint16_t thread_id = rdma_ballot_id(l);
+    uint64_t ballot = rdma_llsc_compact(l, value);
+    int compact = ballot != 0;
+    if (!compact) ballot = gen_ballot(l);
+    uint32_t gen = rdma_sync_begin(l);
 
     // Fast Path: Try to CAS the slot ballot field (Lines 8-12)
     // Local CAS on slot.ballot (64-bit atomic)
-    uint64_t expected_ballot = 0;
+    // the slot's previous lap is not reset everywhere yet: the ring is full
+    if (index >= __atomic_load_n(&g->high, __ATOMIC_ACQUIRE)) return -1;
+    struct llsc_slot *local = rdma_llsc_slot(g, index);
+    if (!local) return -1;
+    uint64_t expected_ballot = rdma_slot_lap(g, index);
     uint64_t old_ballot = __sync_val_compare_and_swap(
-        &r->llsc_mem->slots[index].ballot, expected_ballot, ballot);
+        &local->ballot, expected_ballot, ballot | expected_ballot);
     int local_slot_success = (old_ballot == expected_ballot);
 
     // If local CAS succeeded, write value
-    if (local_slot_success) {
-        r->llsc_mem->slots[index].value = value;
+    if (local_slot_success && !compact) {
+        local->value = value;
     }
 
     // Local CAS on frontier
     uint64_t expected_frontier = index;
     uint64_t new_frontier = index + 1;
     uint64_t old_frontier = __sync_val_compare_and_swap(
-        &r->llsc_mem->frontier, expected_frontier, new_frontier);
+        &g->dir->frontier, expected_frontier, new_frontier);
     int local_frontier_success = (old_frontier == expected_frontier);
 
     int successes = (local_slot_success && local_frontier_success) ? 1 : 0;
     int failures = (local_slot_success && local_frontier_success) ? 0 : 1;
 
     // Issue parallel RDMA CAS to all replicas on ballot field only
+    rdma_trace_phase(l, OP_FAST);
+    int left = (c->n - 1) * 2;
     for (int i = 0; i < c->n; ++i) {
         if (i != c->host_id) {
-            struct remote_attr *ra = r->ra + i;
-
             // CAS on Mi[index].ballot (Line 9) - 64-bit atomic operation
+            uint32_t rkey = 0;
             uint64_t remote_ballot_addr =
-                ra->addr + offsetof(typeof(*r->llsc_mem), slots) +
-                (index * sizeof(struct llsc_slot)) +
-                offsetof(struct llsc_slot, ballot);
+                rdma_region_raddr(g, i, index, &rkey);
+            if (remote_ballot_addr)
+                remote_ballot_addr += offsetof(struct llsc_slot, ballot);
 
             struct ibv_sge sge_slot = {
-                .addr = (uint64_t)(&r->llsc_results[i].ballot),
+                .addr = (uint64_t)(&l->llsc_results[i].ballot),
                 .length = sizeof(uint64_t),
-                .lkey = r->llsc_mr[1]->lkey
+                .lkey = l->mr->lkey
             };
 
             struct ibv_send_wr wr_slot = {
-                .wr_id = ((uint64_t)index << 32) | ((uint64_t)i << 16) | 0,
+                .wr_id = SYNC_WR_ID(PH_SC, gen, i),
                 .sg_list = &sge_slot,
                 .num_sge = 1,
                 .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
                 .send_flags = IBV_SEND_SIGNALED,
                 .wr.atomic = {
                     .remote_addr = remote_ballot_addr,
-                    .rkey = ra->rkey,
-                    .compare_add = 0,
-                    .swap = ballot
+                    .rkey = rkey,
+                    .compare_add = expected_ballot,
+                    .swap = ballot | expected_ballot
                 }
             };
 
-            struct ibv_send_wr *bad_wr;
-            ibv_post_send(r->qp[i], &wr_slot, &bad_wr);
+            if (remote_ballot_addr)
+                rdma_stage(l, i, 0, &wr_slot);
+            else {
+                // chunk not known yet: the ballot CAS counts as failed
+                left--;
+                failures++;
+            }
 
             // CAS on frontieri (Line 10)
-            uint64_t remote_frontier_addr =
-                ra->addr + offsetof(typeof(*r->llsc_mem), frontier);
+            uint32_t frkey = 0;
+            uint64_t remote_frontier_addr = rdma_region_dir(g, i, &frkey);
+            if (!remote_frontier_addr) {
+                // object not found there yet: the frontier CAS failed
+                left--;
+                failures++;
+                continue;
+            }
+            remote_frontier_addr += offsetof(struct region_dir, frontier);
 
             struct ibv_sge sge_frontier = {
-                .addr = (uint64_t)(r->frontier_results + i),
+                .addr = (uint64_t)(l->frontier_results + i),
                 .length = sizeof(uint64_t),
-                .lkey = r->llsc_mr[0]->lkey
+                .lkey = l->mr->lkey
             };
 
             struct ibv_send_wr wr_frontier = {
-                .wr_id = ((uint64_t)index << 32) | ((uint64_t)i << 16) | 1,
+                .wr_id = SYNC_WR_ID(PH_SC_FRONT, gen, i),
                 .sg_list = &sge_frontier,
                 .num_sge = 1,
                 .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
                 .send_flags = IBV_SEND_SIGNALED,
                 .wr.atomic = {
                     .remote_addr = remote_frontier_addr,
-                    .rkey = ra->rkey,
+                    .rkey = frkey,
                     .compare_add = index,
                     .swap = new_frontier
                 }
             };
 
-            ibv_post_send(r->qp[i], &wr_frontier, &bad_wr);
+            rdma_stage(l, i, 0, &wr_frontier);
         }
     }
+    rdma_flush(l);
 
     // Poll for completions
     struct ibv_wc wc[c->n * 2];
-    int left = (c->n - 1) * 2;
     int n = 0;
     int *remote_slot_won = calloc(c->n, sizeof(int));
 
     while (left > 0) {
-        if ((n = ibv_poll_cq(r->cq, left, wc)) > 0) {
+        if ((n = rdma_wait(l, l->cq, c->n * 2, wc)) > 0) {
             for (int i = 0; i < n; ++i) {
-                if (wc[i].status == IBV_WC_SUCCESS) {
-                    uint32_t completion_index = (uint32_t)(wc[i].wr_id >> 32);
-                    int node_id = (wc[i].wr_id >> 16) & 0xFFFF;
-                    int is_frontier = wc[i].wr_id & 1;
-
-                    if (completion_index == index) {
-                        if (is_frontier) {
-                            if (r->frontier_results[node_id] == expected_frontier) {
-                                successes++;
-                            } else {
-                                failures++;
-                            }
-                        } else {
-                            // Ballot CAS - check if it was empty (returned 0)
-                            if (r->llsc_results[node_id].ballot == 0) {
-                                successes++;
-                                remote_slot_won[node_id] = 1;
-                            } else {
-                                failures++;
-                            }
-                        }
-
-                        if (successes >= FAST_QUORUM(c)) {
-                            break; // Fast path succeeded
-                        }
-                        if (failures > c->n - FAST_QUORUM(c)) {
-                            break; // Fast path definitely failed
-                        }
+                int phase = WR_PHASE(wc[i].wr_id);
+                left--;
+                if (wc[i].status != IBV_WC_SUCCESS) {
+                    failures++;
+                    continue;
+                }
+                int node_id = WR_PEER(wc[i].wr_id);
+                if (phase == PH_SC_FRONT) {
+                    if (l->frontier_results[node_id] == expected_frontier) {
+                        successes++;
+                    } else {
+                        failures++;
+                    }
+                } else {
+                    // Ballot CAS - check if it was empty (returned 0)
+                    if (l->llsc_results[node_id].ballot == expected_ballot) {
+                        successes++;
+                        remote_slot_won[node_id] = 1;
+                    } else {
+                        failures++;
                     }
                 }
-                left--;
             }
         }
+        if (successes >= FAST_QUORUM(c)) {
+            break; // Fast path succeeded
+        }
+        if (failures > c->n - FAST_QUORUM(c)) {
+            break; // Fast path definitely failed
+        }
     }
+    rdma_count(l, fast, 1);
+    rdma_trace_quorum(l);
+
+    // Write the value to replicas where we won the ballot CAS, so whoever
+    // finishes the slot can read it back. A compact ballot already carried
+    // the value
+    l->stage->value = value;
+    for (int i = 0; i < c->n && !compact && successes > 0; ++i) {
+        if (i != c->host_id && remote_slot_won[i]) {
+            uint32_t rkey = 0;
+            uint64_t remote_value_addr =
+                rdma_region_raddr(g, i, index, &rkey) +
+                offsetof(struct llsc_slot, value);
 
-    // If fast quorum achieved, write values to replicas where we won the ballot CAS
-    if (successes >= FAST_QUORUM(c)) {
-        // Write value to replicas where ballot CAS succeeded
-        for (int i = 0; i < c->n; ++i) {
-            if (i != c->host_id && remote_slot_won[i]) {
-                struct remote_attr *ra = r->ra + i;
-                uint64_t remote_value_addr =
-                    ra->addr + offsetof(typeof(*r->llsc_mem), slots) +
-                    (index * sizeof(struct llsc_slot)) +
-                    offsetof(struct llsc_slot, value);
-
-                struct ibv_sge sge = {
-                    .addr = (uint64_t)&value,
-                    .length = sizeof(uint64_t),
-                    .lkey = r->llsc_mr[0]->lkey
-                };
-
-                struct ibv_send_wr wr = {
-                    .wr_id = i,
-                    .sg_list = &sge,
-                    .num_sge = 1,
-                    .opcode = IBV_WR_RDMA_WRITE,
-                    .send_flags = IBV_SEND_SIGNALED,
-                    .wr.rdma = {
-                        .remote_addr = remote_value_addr,
-                        .rkey = ra->rkey
-                    }
-                };
+            struct ibv_sge sge = {
+                .addr = (uint64_t)&l->stage->value,
+                .length = sizeof(uint64_t),
+                .lkey = l->mr->lkey
+            };
 
-                struct ibv_send_wr *bad_wr;
-                ibv_post_send(r->qp[i], &wr, &bad_wr);
-            }
+            // nothing waits on the write: inlined, it needs no signal
+            struct ibv_send_wr wr = {
+                .wr_id = SYNC_WR_ID(PH_WRITE, gen, i),
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_RDMA_WRITE,
+                .send_flags = (sizeof(uint64_t) <= (size_t)r->max_inline)
+                                  ? 0 : IBV_SEND_SIGNALED,
+                .wr.rdma = {
+                    .remote_addr = remote_value_addr,
+                    .rkey = rkey
+                }
+            };
+
+            rdma_stage(l, i, 0, &wr);
         }
+    }
+    free(remote_slot_won);
 
-        free(remote_slot_won);
+    // If fast quorum achieved, every replica learns the slot as its last
+    if (successes >= FAST_QUORUM(c)) {
+        struct llsc_head *head = &l->stage->head;
+        head->next = new_frontier;
+        head->slot.ballot = ballot | expected_ballot;
+        head->slot.value = value;
+        rdma_llsc_publish(l, g, head, l->mr->lkey, gen);
+        rdma_flush(l);
+
+        rdma_rlease_revoke(l, g);
+        l->sc_path = STAT_FAST_WIN;
         return 0; // SC succeeded (Line 13)
     }
+    rdma_flush(l);
 
     // Check if none of the CAS succeeded (Line 15)
     if (successes == 0) {
-        free(remote_slot_won);
         return -1; // SC fails
     }
 
-    // Slow path: Coordinated recovery (Lines 17-24)
-    free(remote_slot_won);
-    return rdma_llsc_slow_path(r, index, value, thread_id, ballot);
+    // Slow path: Coordinated or leaderless recovery (Lines 17-24)
+    rdma_count(l, undecided, 1);
+    l->sc_path = STAT_RECOVERY;
+    int ret = rdma_llsc_slow_path(l, g, index, value, thread_id, ballot);
+    if (ret == 0) rdma_rlease_revoke(l, g);
+    return ret;
 }
 
-/* RDMA-based Coordinated Recovery (Section 5.1)
- * Called when fast path partially succeeds */
-int rdma_llsc_slow_path(struct rdma_ctx *r, uint32_t slot, uint64_t value,
-                        uint16_t thread_id, uint64_t ballot) {
-    struct config *c = r->c;
-
-    (void)value;  // Unused - value already written during fast path attempt
-    (void)ballot; // Unused - coordinator assigns new ballot
-
-    // Step 1: Remove content in MSj (local spinning area)
-    memset(r->recovery_resp, 0, sizeof(struct recovery_resp));
+static int __llsc_recover(struct rdma_lane *l, struct rdma_region *g,
+                          uint64_t slot, uint64_t ballot) {
+    struct rdma_ctx *r = l->r;
+    uint64_t start = ts_us();
+    uint64_t deadline = start + RECOVERY_TIMEOUT_US;
+
+    // Step 1: Take a response slot MSj[s] (local spinning area)
+    rdma_trace_phase(l, OP_RECOVER);
+    int s;
+    l->idle = 0;
+    while ((s = rdma_recovery_slot(r)) < 0) {
+        if (ts_us() > deadline) return -1;
+        rdma_relax(l);
+    }
 
     // Step 2: Notify coordinator about recovery need
-    // rdma-write(MRc[j], ⟨threadID, t⟩)
-    struct recovery_req req = {
-        .thread_id = thread_id,
-        .slot = slot
-    };
-
-    struct remote_attr *coord_ra = r->ra + COORDINATOR_NODE;
-    uint64_t remote_recovery_addr =
-        coord_ra->addr + (c->host_id * sizeof(struct recovery_req));
-
-    struct ibv_sge sge = {
-        .addr = (uint64_t)&req,
-        .length = sizeof(struct recovery_req),
-        .lkey = r->llsc_mr[1]->lkey
-    };
-
-    struct ibv_send_wr wr = {
-        .wr_id = 0,
-        .sg_list = &sge,
-        .num_sge = 1,
-        .opcode = IBV_WR_RDMA_WRITE,
-        .send_flags = IBV_SEND_SIGNALED,
-        .wr.rdma = {
-            .remote_addr = remote_recovery_addr,
-            .rkey = coord_ra->rkey
-        }
-    };
-
-    struct ibv_send_wr *bad_wr;
-    if (ibv_post_send(r->qp[COORDINATOR_NODE], &wr, &bad_wr)) {
-        FAA_LOG("Failed to notify coordinator for recovery");
-        return -1;
-    }
+    // rdma-write(MRc[j][s], ⟨threadID, t⟩)
+    struct recovery_req *req = &l->stage->req;
+    rdma_recovery_fill(r, s, req, g, slot);
+    uint32_t rkey = 0;
+    uint64_t remote_recovery_addr = rdma_recovery_send(r, s, req, &rkey);
+    if (remote_recovery_addr) {
+        struct ibv_sge sge = {
+            .addr = (uint64_t)req,
+            .length = sizeof(struct recovery_req),
+            .lkey = l->mr->lkey
+        };
 
-    // Wait for write completion
-    struct ibv_wc wc;
-    while (ibv_poll_cq(r->cq, 1, &wc) <= 0);
+        struct ibv_send_wr wr = {
+            .wr_id = SYNC_WR_ID(PH_RECOVERY, rdma_sync_begin(l), COORDINATOR_NODE),
+            .sg_list = &sge,
+            .num_sge = 1,
+            .opcode = IBV_WR_RDMA_WRITE,
+            .send_flags = IBV_SEND_SIGNALED,
+            .wr.rdma = {
+                .remote_addr = remote_recovery_addr,
+                .rkey = rkey
+            }
+        };
 
-    if (wc.status != IBV_WC_SUCCESS) {
-        FAA_LOG("Recovery notification failed");
-        return -1;
-    }
+        rdma_stage(l, COORDINATOR_NODE, 0, &wr);
+        rdma_flush(l);
 
-    // Step 3: Spin-wait on MSj (local spinning)
-    int timeout = 10000000; // 10M iterations ~ 1-10 seconds
-    while (timeout-- > 0) {
-        volatile struct recovery_resp *resp = (volatile struct recovery_resp *)r->recovery_resp;
-        if (resp->valid) {
-            // Step 4: Check if Nj is the winner
-            int won = (resp->thread_id == thread_id);
+        // Wait for write completion
+        struct ibv_wc wc;
+        while (rdma_wait(l, l->cq, 1, &wc) <= 0);
 
-            // Clean up MSj for next use
-            memset(r->recovery_resp, 0, sizeof(struct recovery_resp));
+        if (wc.status != IBV_WC_SUCCESS) {
+            FAA_LOG("Recovery notification failed");
+            rdma_recovery_done(r, s, start);
+            return -1;
+        }
+    }
 
+    // Step 3: Spin-wait on MSj[s] (local spinning)
+    l->idle = 0;
+    while (ts_us() < deadline) {
+        struct recovery_resp *resp = rdma_recovery_poll(r, s, req->seq);
+        if (resp) {
+            // Step 4: Check if this SC's ballot was decided
+            int won = (resp->ballot & BALLOT_MASK) == ballot;
+            rdma_recovery_done(r, s, start);
             return won ? 0 : -1;
         }
-        cpu_relax();
+        rdma_relax(l);
     }
 
-    FAA_LOG("Recovery timeout for slot %u", slot);
+    FAA_LOG("Recovery timeout for slot %llu", (unsigned long long)slot);
+    rdma_recovery_done(r, s, start);
     return -1;
 }
 
-/* Coordinator recovery processing
- * This should be called periodically by the coordinator node
- * to handle recovery requests from other nodes */
-void rdma_llsc_process_recovery(struct rdma_ctx *r) {
-    struct config *c = r->c;
-
-    // Only coordinator processes recovery
-    if (c->host_id != COORDINATOR_NODE) {
-        return;
+int rdma_llsc_outcome(struct config *c, const struct prep_res *p,
+                      uint64_t ballot, uint64_t *proposal, int *from) {
+    int promises = 0;
+    *proposal = 0;
+    *from = -1;
+    for (int i = 0; i < c->n; ++i) {
+        if (!p[i].success) continue;
+        // a replica holding a newer ballot than ours cannot promise
+        if (!p[i].ballot || !rdma_ballot_after(p[i].ballot, ballot))
+            ++promises;
+        if (!p[i].ballot) continue;
+        // a majority holding the ballot decided it, fast path or accept
+        int holders = 0;
+        for (int j = 0; j < c->n; ++j)
+            holders += p[j].success && p[j].ballot == p[i].ballot;
+        if (holders >= CLASSIC_QUORUM(c)) {
+            *proposal = p[i].ballot;
+            *from = i;
+            return p[i].ballot != ballot;
+        }
+        // newest round first; the owner's replica got its value first
+        if (!*proposal || rdma_ballot_after(p[i].ballot, *proposal) ||
+            (p[i].ballot == *proposal && i == BALLOT_NODE(p[i].ballot))) {
+            *proposal = p[i].ballot;
+            *from = i;
+        }
     }
-
-    // Check each node's recovery request
-    for (int j = 0; j < c->n; ++j) {
-        struct recovery_req *req = &r->recovery_reqs[j];
-
-        // Check if there's a pending recovery request
-        if (req->thread_id == 0) {
-            continue; // No request from this node
+    if (promises < CLASSIC_QUORUM(c)) return -1;
+
+    // rounds are per lane, so the newest ballot need not be the one that
+    // won: a ballot on all but n - FAST_QUORUM of the replies may hold a
+    // fast quorum, and goes first
+    int replies = 0;
+    for (int i = 0; i < c->n; ++i) replies += p[i].success;
+    int need = replies - (c->n - FAST_QUORUM(c));
+    uint64_t fast = 0;
+    for (int i = 0; i < c->n; ++i) {
+        if (!p[i].success || !p[i].ballot) continue;
+        // after the first holder, only the owner's replica of it
+        if (fast && (p[i].ballot != fast || i != BALLOT_NODE(fast)))
+            continue;
+        int holders = 0;
+        for (int j = 0; j < c->n; ++j)
+            holders += p[j].success && p[j].ballot == p[i].ballot;
+        if (holders >= need) {
+            fast = *proposal = p[i].ballot;
+            *from = i;
         }
+    }
+    if (!*proposal || *proposal == ballot) {
+        *proposal = ballot;
+        *from = -1;
+    }
+    return 2;
+}
 
-        uint32_t slot = req->slot;
-
-        FAA_LOG("Coordinator processing recovery for node %d, slot %u", j, slot);
-
-        // Step 1: rdma-read(Mi[slot]) from all replicas
-        struct llsc_slot *reads = r->llsc_results;
-        reads[c->host_id] = r->llsc_mem->slots[slot];
-
+/* Leaderless recovery: the proposer runs prepare/accept rounds on the
+ * 16-byte slot itself. The accept phase CASes the ballot word first, then
+ * writes the value where the CAS landed. Returns 0 once the slot is
+ * decided with ballot, -1 once it is decided with another one or after
+ * LEADERLESS_ROUNDS undecided rounds */
+static int __llsc_paxos(struct rdma_lane *l, struct rdma_region *g,
+                        uint64_t slot, uint64_t value, uint64_t ballot) {
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+    struct llsc_slot *reads = l->llsc_results;
+    struct prep_res *p = l->prepares;
+    int inlined = sizeof(uint64_t) <= (size_t)r->max_inline;
+    uint64_t start = ts_us();
+    uint64_t lap = rdma_slot_lap(g, slot);
+    struct llsc_slot *local = rdma_llsc_slot(g, slot);
+    if (!local) return -1;
+
+    for (int round = 0; round < LEADERLESS_ROUNDS && !r->stop; ++round) {
+        if (round) rdma_backoff(g, round - 1);
+        rdma_count(l, slow, 1);
+        rdma_trace_phase(l, OP_PREPARE);
+
+        // Phase 2a (Prepare): read the slot from every replica. Replicas
+        // holding another lap of the slot cannot promise
+        uint32_t gen = rdma_sync_begin(l);
+        memset(p, 0, sizeof(struct prep_res) * c->n);
+        reads[c->host_id] = *(volatile struct llsc_slot *)local;
+        p[c->host_id].success = !rdma_slot_ballot(
+            g, slot, reads[c->host_id].ballot, &p[c->host_id].ballot);
+        int posted = 0;
         for (int i = 0; i < c->n; ++i) {
-            if (i != c->host_id) {
-                struct remote_attr *ra = r->ra + i;
-                uint64_t remote_slot_addr =
-                    ra->addr + offsetof(typeof(*r->llsc_mem), slots) +
-                    (slot * sizeof(struct llsc_slot));
-
-                struct ibv_sge sge = {
-                    .addr = (uint64_t)(reads + i),
-                    .length = sizeof(struct llsc_slot),
-                    .lkey = r->llsc_mr[1]->lkey
-                };
-
-                struct ibv_send_wr wr = {
-                    .wr_id = i,
-                    .sg_list = &sge,
-                    .num_sge = 1,
-                    .opcode = IBV_WR_RDMA_READ,
-                    .send_flags = IBV_SEND_SIGNALED,
-                    .wr.rdma = {
-                        .remote_addr = remote_slot_addr,
-                        .rkey = ra->rkey
-                    }
-                };
-
-                struct ibv_send_wr *bad_wr;
-                ibv_post_send(r->qp[i], &wr, &bad_wr);
-            }
+            if (i == c->host_id) continue;
+            uint32_t rkey;
+            uint64_t addr = rdma_region_raddr(g, i, slot, &rkey);
+            if (!addr) continue;  // chunk not known yet
+            struct ibv_sge sge = {.addr = (uint64_t)(reads + i),
+                                  .length = sizeof(struct llsc_slot),
+                                  .lkey = l->mr->lkey};
+            struct ibv_send_wr wr = {
+                .wr_id = SYNC_WR_ID(PH_PREPARE, gen, i),
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_RDMA_READ,
+                .send_flags = IBV_SEND_SIGNALED,
+                .wr.rdma = {.remote_addr = addr, .rkey = rkey}};
+            rdma_stage(l, i, 0, &wr);
+            ++posted;
         }
+        rdma_flush(l);
 
-        // Step 2: Wait for quorum of reads
         struct ibv_wc wc[c->n];
-        int completed = 0;
-        int num_posted = c->n - 1;
-
-        while (completed < num_posted) {
-            int n = ibv_poll_cq(r->cq, num_posted - completed, wc);
-            if (n > 0) {
-                completed += n;
+        uint64_t proposal;
+        int from;
+        int outcome = rdma_llsc_outcome(c, p, ballot, &proposal, &from);
+        // a decided slot needs no other reply
+        for (int done = 0; done < posted && outcome != 0 && outcome != 1;) {
+            int n = rdma_wait(l, l->cq, c->n, wc);
+            for (int i = 0; i < n; ++i, ++done) {
+                int peer = WR_PEER(wc[i].wr_id);
+                p[peer].success =
+                    wc[i].status == IBV_WC_SUCCESS &&
+                    !rdma_slot_ballot(g, slot, reads[peer].ballot,
+                                      &p[peer].ballot);
             }
+            outcome = rdma_llsc_outcome(c, p, ballot, &proposal, &from);
+            if (r->stop) break;
         }
-
-        // Step 3: Find majority ballot or pick highest ballot
-        struct llsc_slot chosen = {0, 0};
-        uint64_t highest_ballot = 0;
-
-        // Find highest ballot (most recent write)
-        for (int i = 0; i < c->n; ++i) {
-            if (reads[i].ballot > highest_ballot) {
-                highest_ballot = reads[i].ballot;
-                chosen = reads[i];
-            }
+        rdma_trace_quorum(l);
+        if (outcome == 0 || outcome == 1) {
+            // the caller only ends the read leases for its own SC
+            if (outcome) rdma_rlease_revoke(l, g);
+            rdma_recovery_record(r, start);
+            return outcome ? -1 : 0;
         }
-
-        // If no ballot found (all empty), use first non-empty
-        if (chosen.ballot == 0) {
-            for (int i = 0; i < c->n; ++i) {
-                if (reads[i].ballot != 0) {
-                    chosen = reads[i];
-                    break;
-                }
-            }
+        if (outcome == -1) {
+            // the lane's next SCs outrank the ballots that refused this one
+            rdma_ballots_seen(l, p, c->n);
+            continue;
         }
 
-        // Step 4: Write chosen value to all replicas with coordinator's ballot
-        uint64_t coord_ballot = gen_ballot(COORDINATOR_NODE);
-
-        // Keep the existing value if found, otherwise use coordinator's thread_id
-        struct llsc_slot final_slot = {
-            .ballot = coord_ballot,
-            .value = chosen.value
-        };
-
-        // Local write
-        r->llsc_mem->slots[slot] = final_slot;
-
-        // Remote writes
+        // Phase 2b (Accept): CAS the proposal over the prepared ballots
+        rdma_trace_phase(l, OP_ACCEPT);
+        gen = rdma_sync_begin(l);
+        int compact = (proposal & COMPACT_FLAG) != 0;
+        l->stage->value = from < 0 ? value : reads[from].value;
+        uint64_t *accepted = l->results;
+        uint64_t won = 0;
+        if (p[c->host_id].success &&
+            __sync_bool_compare_and_swap(&local->ballot,
+                                         p[c->host_id].ballot | lap,
+                                         proposal | lap)) {
+            if (!compact) local->value = l->stage->value;
+            won |= 1ULL << c->host_id;
+        }
+        posted = 0;
         for (int i = 0; i < c->n; ++i) {
-            if (i != c->host_id) {
-                struct remote_attr *ra = r->ra + i;
-                uint64_t remote_slot_addr =
-                    ra->addr + offsetof(typeof(*r->llsc_mem), slots) +
-                    (slot * sizeof(struct llsc_slot));
-
-                struct ibv_sge sge = {
-                    .addr = (uint64_t)&final_slot,
-                    .length = sizeof(struct llsc_slot),
-                    .lkey = r->llsc_mr[1]->lkey
-                };
-
-                struct ibv_send_wr wr = {
-                    .wr_id = i,
-                    .sg_list = &sge,
-                    .num_sge = 1,
-                    .opcode = IBV_WR_RDMA_WRITE,
-                    .send_flags = IBV_SEND_SIGNALED,
-                    .wr.rdma = {
-                        .remote_addr = remote_slot_addr,
-                        .rkey = ra->rkey
-                    }
-                };
-
-                struct ibv_send_wr *bad_wr;
-                ibv_post_send(r->qp[i], &wr, &bad_wr);
+            if (i == c->host_id || !p[i].success) continue;
+            uint32_t rkey = 0;
+            uint64_t addr = rdma_region_raddr(g, i, slot, &rkey);
+            struct ibv_sge sge = {.addr = (uint64_t)(accepted + i),
+                                  .length = sizeof(uint64_t),
+                                  .lkey = l->mr->lkey};
+            struct ibv_send_wr wr = {
+                .wr_id = SYNC_WR_ID(PH_ACCEPT, gen, i),
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
+                .send_flags = IBV_SEND_SIGNALED,
+                .wr.atomic = {.remote_addr = addr,
+                              .rkey = rkey,
+                              .compare_add = p[i].ballot | lap,
+                              .swap = proposal | lap}};
+            rdma_stage(l, i, 0, &wr);
+            ++posted;
+        }
+        rdma_flush(l);
+
+        // every CAS that landed gets the value before the round ends
+        for (int done = 0; done < posted && !r->stop;) {
+            int n = rdma_wait(l, l->cq, c->n, wc);
+            for (int i = 0; i < n; ++i, ++done) {
+                int peer = WR_PEER(wc[i].wr_id);
+                if (wc[i].status == IBV_WC_SUCCESS &&
+                    accepted[peer] == (p[peer].ballot | lap))
+                    won |= 1ULL << peer;
             }
         }
+        rdma_trace_quorum(l);
+        for (int i = 0; i < c->n && !compact; ++i) {
+            if (i == c->host_id || !(won & (1ULL << i))) continue;
+            uint32_t rkey = 0;
+            uint64_t addr = rdma_region_raddr(g, i, slot, &rkey);
+            struct ibv_sge sge = {.addr = (uint64_t)&l->stage->value,
+                                  .length = sizeof(uint64_t),
+                                  .lkey = l->mr->lkey};
+            struct ibv_send_wr wr = {
+                .wr_id = SYNC_WR_ID(PH_WRITE, gen, i),
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_RDMA_WRITE,
+                .send_flags = inlined ? 0 : IBV_SEND_SIGNALED,
+                .wr.rdma = {
+                    .remote_addr = addr + offsetof(struct llsc_slot, value),
+                    .rkey = rkey}};
+            rdma_stage(l, i, 0, &wr);
+        }
+        if (__builtin_popcountll(won) < CLASSIC_QUORUM(c)) {
+            rdma_flush(l);
+            continue;  // another proposer got in first
+        }
 
-        // Step 5: Notify the requester via MSj
-        // Extract thread_id from the chosen ballot (lower 16 bits)
-        uint16_t winner_thread_id = (chosen.ballot != 0) ? (chosen.ballot & 0xFFFF) : 0;
-
-        struct recovery_resp resp = {
-            .thread_id = winner_thread_id,
-            .value = chosen.value,
-            .ballot = final_slot.ballot,
-            .valid = 1
-        };
-
-        struct remote_attr *req_ra = r->ra + j;
-        uint64_t remote_resp_addr = req_ra->addr; // MSj address
-
-        struct ibv_sge sge_resp = {
-            .addr = (uint64_t)&resp,
-            .length = sizeof(struct recovery_resp),
-            .lkey = r->llsc_mr[1]->lkey
-        };
-
-        struct ibv_send_wr wr_resp = {
-            .wr_id = j,
-            .sg_list = &sge_resp,
-            .num_sge = 1,
-            .opcode = IBV_WR_RDMA_WRITE,
-            .send_flags = IBV_SEND_SIGNALED,
-            .wr.rdma = {
-                .remote_addr = remote_resp_addr,
-                .rkey = req_ra->rkey
-            }
-        };
+        // decided: the slot may be the last one, unless a later one was
+        struct llsc_head *head = &l->stage->head;
+        head->next = slot + 1;
+        head->slot.ballot = proposal | lap;
+        head->slot.value = l->stage->value;
+        if (head->next >= *(volatile uint64_t *)&g->dir->frontier)
+            rdma_llsc_publish(l, g, head, l->mr->lkey, gen);
+        rdma_flush(l);
+        rdma_recovery_record(r, start);
+        if (proposal == ballot) return 0;
+        rdma_rlease_revoke(l, g);
+        return -1;
+    }
 
-        struct ibv_send_wr *bad_wr;
-        ibv_post_send(r->qp[j], &wr_resp, &bad_wr);
+    FAA_LOG("Leaderless recovery of slot %llu undecided",
+            (unsigned long long)slot);
+    rdma_count(l, gave_up, 1);
+    rdma_recovery_record(r, start);
+    return -1;
+}
 
-        // Clear the recovery request
-        memset(req, 0, sizeof(struct recovery_req));
-    }
+/* RDMA-based Coordinated Recovery (Section 5.1)
+ * Called when fast path partially succeeds. The coordinator's engine
+ * (rdma_recovery.c) decides the slot, or the proposer itself in
+ * leaderless mode */
+int rdma_llsc_slow_path(struct rdma_lane *l, struct rdma_region *g,
+                        uint64_t slot, uint64_t value, uint16_t thread_id,
+                        uint64_t ballot) {
+    (void)thread_id; // the ballot tells the winner
+    if (l->r->c->llsc_recovery == LLSC_LEADERLESS)
+        return __llsc_paxos(l, g, slot, value, ballot);
+    return __llsc_recover(l, g, slot, ballot);
 }
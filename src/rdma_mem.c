@@ -0,0 +1,70 @@
+// Slot array allocation.
+// MEM_HUGE_* maps the arrays from hugepages (anonymous or from a hugetlbfs
+// file), pre-faulted so neither the CPU nor the NIC takes a first-touch
+// fault, and optionally locked. Falls back to calloc when that fails.
+
+#include "rdma.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT (26)
+#endif
+
+static void *__map(struct config *c, size_t nb, size_t page) {
+    int flags = MAP_POPULATE, fd = -1;
+    void *p;
+
+    if (c->huge_path) {
+        // hugetlbfs file, unlinked so it goes away with the mapping
+        char name[256];
+        snprintf(name, sizeof(name), "%s/atomic-%d-XXXXXX", c->huge_path,
+                 (int)getpid());
+        if ((fd = mkstemp(name)) < 0) {
+            perror("mkstemp:");
+            return NULL;
+        }
+        unlink(name);
+        if (ftruncate(fd, nb)) {
+            perror("ftruncate:");
+            close(fd);
+            return NULL;
+        }
+        flags |= MAP_SHARED;
+    } else
+        flags |= MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB |
+                 ((page == (1UL << 30) ? 30 : 21) << MAP_HUGE_SHIFT);
+
+    p = mmap(NULL, nb, PROT_READ | PROT_WRITE, flags, fd, 0);
+    if (fd >= 0) close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+void *rdma_mem_alloc(struct config *c, size_t nb, size_t *mapped) {
+    *mapped = 0;
+    if (c->mem_mode != MEM_CALLOC) {
+        size_t page = (c->mem_mode == MEM_HUGE_1G) ? (1UL << 30) : (1UL << 21);
+        size_t len = (nb + page - 1) & ~(page - 1);
+        void *p = __map(c, len, page);
+        if (p) {
+            if (c->mem_lock && mlock(p, len))
+                FAA_LOG("mlock of %zu bytes failed", len);
+            *mapped = len;
+            return p;  // hugepages come zeroed
+        }
+        FAA_LOG("No hugepages for %zu bytes, using calloc", len);
+    }
+    return calloc(1, nb);
+}
+
+void rdma_mem_free(void *p, size_t mapped) {
+    if (!p) return;
+    if (mapped)
+        munmap(p, mapped);
+    else
+        free(p);
+}
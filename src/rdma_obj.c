@@ -0,0 +1,189 @@
+// Named objects.
+// Every object is a slot region of its own, with its own frontier, ring and
+// watermarks, so unrelated counters and registers never contend. A node
+// lists its objects in a registry peers can read. The id of an object is a
+// hash of its name and its entry is the first free one from id on, so a
+// peer finds it by probing the same entries of the owner's registry.
+
+#include "rdma.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define REGISTRY_ACCESS (IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ)
+
+/* FNV-1a of the name. 0 stands for the node's own regions */
+static uint32_t __obj_id(const char *name) {
+    uint32_t h = 2166136261u;
+    for (; *name; ++name) h = (h ^ (uint8_t)*name) * 16777619u;
+    return h ? h : 1;
+}
+
+/* Entry of id in registry, or -1 */
+static int __probe(struct obj_ent *registry, uint32_t id) {
+    for (int k = 0; k < MAX_OBJECTS; ++k) {
+        int e = (id + k) % MAX_OBJECTS;
+        if (!__atomic_load_n(&registry[e].valid, __ATOMIC_ACQUIRE)) break;
+        if (registry[e].id == id) return e;
+    }
+    return -1;
+}
+
+int rdma_obj_init(struct rdma_ctx *r) {
+    // the local registry, then the copy of the last peer registry read
+    size_t nb = 2 * MAX_OBJECTS * sizeof(struct obj_ent);
+    if (!(r->registry = calloc(1, nb)) ||
+        !(r->objs = calloc(MAX_OBJECTS, sizeof(struct rdma_region *))) ||
+        !(r->obj_names = calloc(MAX_OBJECTS, OBJ_NAME_LEN))) {
+        perror("calloc:");
+        goto err;
+    }
+    if (!(r->registry_mr =
+              ibv_reg_mr(r->pd, r->registry, nb, REGISTRY_ACCESS))) {
+        FAA_LOG("Failed to register the object registry");
+        goto err;
+    }
+    pthread_mutex_init(&r->obj_lock, 0);
+    return 0;
+
+err:
+    free(r->registry);
+    free(r->objs);
+    free(r->obj_names);
+    r->registry = NULL;
+    r->objs = NULL;
+    r->obj_names = NULL;
+    return -errno;
+}
+
+void rdma_obj_destroy(struct rdma_ctx *r) {
+    if (!r->registry) return;
+    for (int i = 0; i < MAX_OBJECTS; ++i)
+        if (r->objs[i]) {
+            rdma_region_destroy(r->objs[i]);
+            free(r->objs[i]);
+        }
+    ibv_dereg_mr(r->registry_mr);
+    free(r->registry);
+    free(r->objs);
+    free(r->obj_names);
+    pthread_mutex_destroy(&r->obj_lock);
+    r->registry_mr = NULL;
+    r->registry = NULL;
+    r->objs = NULL;
+    r->obj_names = NULL;
+}
+
+struct rdma_region *rdma_obj_open(struct rdma_ctx *r, const char *name,
+                                  uint8_t kind) {
+    struct config *c = r->c;
+    struct rdma_region *g = NULL;
+    if (!name || !*name || strlen(name) >= OBJ_NAME_LEN || kind > OBJ_LLSC) {
+        errno = EINVAL;
+        return NULL;
+    }
+    uint32_t id = __obj_id(name);
+
+    pthread_mutex_lock(&r->obj_lock);
+    int e = __probe(r->registry, id);
+    if (e >= 0) {
+        // the object itself, or another name with the same id
+        if (strcmp(r->obj_names[e], name) || r->registry[e].kind != kind)
+            errno = EEXIST;
+        else
+            g = r->objs[e];
+        goto exit;
+    }
+    for (int k = 0; k < MAX_OBJECTS && e < 0; ++k)
+        if (!r->registry[(id + k) % MAX_OBJECTS].valid)
+            e = (id + k) % MAX_OBJECTS;
+    if (e < 0) {
+        errno = ENOSPC;
+        goto exit;
+    }
+
+    if (!(g = calloc(1, sizeof(*g)))) goto exit;
+    uint64_t max_slots = c->obj_slots ? c->obj_slots : OBJ_SLOTS;
+    int ret = rdma_region_init(r, g, kind, max_slots);
+    if (ret) {
+        rdma_region_destroy(g);
+        free(g);
+        g = NULL;
+        errno = -ret;
+        goto exit;
+    }
+    g->id = id;
+    strcpy(r->obj_names[e], name);
+
+    // to local threads and the grower, then to peers
+    __atomic_store_n(r->objs + e, g, __ATOMIC_RELEASE);
+    struct obj_ent *ent = r->registry + e;
+    ent->id = id;
+    ent->kind = kind;
+    ent->addr = (uint64_t)g->dir;
+    ent->rkey = g->dir_mr->rkey;
+    __atomic_store_n(&ent->valid, 1, __ATOMIC_RELEASE);
+    FAA_LOG("Opened object %s (id %08x, entry %d)", name, id, e);
+exit:
+    pthread_mutex_unlock(&r->obj_lock);
+    return g;
+}
+
+struct rdma_region *rdma_obj_find(struct rdma_ctx *r, uint32_t id) {
+    if (!id) return &r->llsc;
+    int e = __probe(r->registry, id);
+    return e < 0 ? NULL : __atomic_load_n(r->objs + e, __ATOMIC_ACQUIRE);
+}
+
+/* Read peer's registry into the scratch half of ours */
+static int __read_registry(struct rdma_lane *l, int peer) {
+    struct rdma_ctx *r = l->r;
+    struct remote_attr *ra = r->ra + peer;
+    struct ibv_sge sge = {.addr = (uint64_t)(r->registry + MAX_OBJECTS),
+                          .length = MAX_OBJECTS * sizeof(struct obj_ent),
+                          .lkey = r->registry_mr->lkey};
+    struct ibv_send_wr wr = {
+        .wr_id = SYNC_WR_ID(PH_LOOKUP, rdma_sync_begin(l), peer),
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_RDMA_READ,
+        .send_flags = IBV_SEND_SIGNALED,
+        .wr.rdma = {.remote_addr = ra->oaddr, .rkey = ra->orkey}};
+    rdma_stage(l, peer, 0, &wr);
+    rdma_flush(l);
+
+    struct ibv_wc wc;
+    while (rdma_wait(l, l->cq, 1, &wc) <= 0)
+        if (r->stop) return -1;
+    return wc.status == IBV_WC_SUCCESS ? 0 : -1;
+}
+
+void rdma_obj_resolve(struct rdma_ctx *r) {
+    struct config *c = r->c;
+    struct obj_ent *copy = r->registry + MAX_OBJECTS;
+
+    for (int i = 0; i < c->n; ++i) {
+        if (i == c->host_id) continue;
+        int read = 0;
+        for (int e = 0; e < MAX_OBJECTS; ++e) {
+            struct rdma_region *g = __atomic_load_n(r->objs + e, __ATOMIC_ACQUIRE);
+            if (!g || g->dirs[i].valid) continue;
+            if (!read && (read = __read_registry(r->ctl, i) ? -1 : 1) < 0)
+                break;  // peer unreachable: try again next tick
+
+            int pe = __probe(copy, g->id);
+            if (pe < 0) continue;  // not opened there yet
+            if (copy[pe].kind != g->kind) {
+                FAA_LOG("Object %s has another kind on node %d",
+                        r->obj_names[e], i);
+                continue;
+            }
+            g->dirs[i].addr = copy[pe].addr;
+            g->dirs[i].rkey = copy[pe].rkey;
+            __atomic_store_n(&g->dirs[i].valid, 1, __ATOMIC_RELEASE);
+            FAA_LOG("Found object %s on node %d", r->obj_names[e], i);
+        }
+    }
+}
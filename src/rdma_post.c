@@ -0,0 +1,103 @@
+// Doorbell batching.
+// WRs are staged per QP and posted as one chained list per QP on flush,
+// so a broadcast (or several async ops) rings one doorbell per peer.
+
+#include "rdma.h"
+
+#include <stdio.h>
+#include <string.h>
+
+/* Post every few unsignaled WRs with a signal so the send queue drains */
+#define SIGNAL_EVERY (256)
+
+static inline struct rdma_chain *__chain(struct rdma_lane *l, int peer,
+                                         int frontier) {
+    return l->chains + 2 * peer + frontier;
+}
+
+/* Post one chain with a single doorbell */
+static int __chain_post(struct rdma_lane *l, struct rdma_chain *ch) {
+    struct ibv_send_wr *bad_wr = NULL;
+    if (!ch->len) return 0;
+    for (int i = 0; i + 1 < ch->len; ++i) ch->wr[i].next = ch->wr + i + 1;
+    ch->wr[ch->len - 1].next = NULL;
+    rdma_count(l, posted, ch->len);
+    rdma_count(l, doorbells, 1);
+
+    if (ibv_post_send(ch->qp, ch->wr, &bad_wr)) {
+        FAA_LOG("Failed to post %d WRs", (int)(ch->wr + ch->len - bad_wr));
+        // report the signaled WRs that never made it to the send queue
+        for (; bad_wr; bad_wr = bad_wr->next)
+            if ((bad_wr->send_flags & IBV_SEND_SIGNALED) &&
+                l->nlost < MAX_LOST) {
+                l->lost_cq[l->nlost] = ch->qp->send_cq;
+                l->lost[l->nlost++] =
+                    (struct ibv_wc){.wr_id = bad_wr->wr_id,
+                                    .status = IBV_WC_GENERAL_ERR};
+            }
+    }
+    ch->len = 0;
+    return 1;
+}
+
+int rdma_stage(struct rdma_lane *l, int peer, int frontier,
+               struct ibv_send_wr *wr) {
+    struct rdma_chain *ch = __chain(l, peer, frontier);
+    int doorbells = 0;
+    if (ch->len == POST_DEPTH) doorbells = __chain_post(l, ch);
+
+    struct ibv_send_wr *w = ch->wr + ch->len;
+    struct ibv_sge *sge = ch->sge + ch->len;
+    *w = *wr;
+    if (wr->num_sge) {
+        *sge = *wr->sg_list;
+        w->sg_list = sge;
+        w->num_sge = 1;
+    }
+
+    // small writes are copied into the WQE: no lkey and no DMA read
+    if (w->opcode == IBV_WR_RDMA_WRITE && w->num_sge &&
+        sge->length <= (uint32_t)l->r->max_inline)
+        w->send_flags |= IBV_SEND_INLINE;
+
+    if (w->send_flags & IBV_SEND_SIGNALED)
+        ch->unsignaled = 0;
+    else if (++ch->unsignaled >= SIGNAL_EVERY) {
+        w->wr_id = WR_ID_SIGNAL;
+        w->send_flags |= IBV_SEND_SIGNALED;
+        ch->unsignaled = 0;
+    }
+
+    ++ch->len;
+    return doorbells;
+}
+
+int rdma_flush(struct rdma_lane *l) {
+    int doorbells = 0;
+    for (int i = 0; i < 2 * l->r->c->n; ++i)
+        doorbells += __chain_post(l, l->chains + i);
+    return doorbells;
+}
+
+int rdma_poll(struct rdma_lane *l, struct ibv_cq *cq, int n,
+              struct ibv_wc *wc) {
+    int got = 0;
+    for (int i = 0; i < l->nlost && got < n;)
+        if (l->lost_cq[i] == cq) {
+            wc[got++] = l->lost[i];
+            l->lost[i] = l->lost[--l->nlost];
+            l->lost_cq[i] = l->lost_cq[l->nlost];
+        } else
+            ++i;
+    if (got < n) {
+        int m = ibv_poll_cq(cq, n - got, wc + got);
+        if (m < 0 && !got) return m;
+        if (m > 0) got += m;
+    }
+
+    rdma_count(l, polls, 1);
+    if (!got) rdma_count(l, empty_polls, 1);
+    for (int i = 0; i < got; ++i)
+        if (wc[i].status != IBV_WC_SUCCESS) rdma_count(l, wc_errors, 1);
+    return got;
+}
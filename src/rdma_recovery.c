@@ -0,0 +1,420 @@
+// LL/SC coordinated recovery (Section 5.1).
+// A requester takes one of its RECOVERY_SLOTS response slots, writes its
+// request to the coordinator's matching request slot and spins on the
+// response, so every lane and asynchronous SC of a node can recover at
+// once. The coordinator's engine thread gathers every pending request,
+// reads their slots from all replicas with one doorbell per replica, then
+// writes back every decision, publishes it and answers the requesters,
+// again with one doorbell per replica.
+
+#include "rdma.h"
+#include "arch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define COORDINATOR_NODE (0)
+#define FAST_QUORUM(c) ((c->n * 3 + 3) / 4)
+
+/* Requests the engine decides per round */
+#define RECOVERY_BATCH (64)
+
+/* Empty scans before the engine sleeps, and for how long */
+#define RECOVERY_SPIN (1 << 10)
+#define RECOVERY_IDLE_US (20)
+
+/* The peer field of a read carries its job too */
+#define JOB_PEER(k, i) (((k) << 8) | (i))
+#define JOB_OF(peer) ((peer) >> 8)
+
+int rdma_recovery_slot(struct rdma_ctx *r) {
+    uint64_t avail = __atomic_load_n(&r->recovery_free, __ATOMIC_ACQUIRE);
+    while (avail) {
+        int s = __builtin_ctzll(avail);
+        if (__atomic_compare_exchange_n(&r->recovery_free, &avail,
+                                        avail & ~(1ULL << s), 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+            return s;
+    }
+    return -1;
+}
+
+void rdma_recovery_fill(struct rdma_ctx *r, int s, struct recovery_req *req,
+                        struct rdma_region *g, uint64_t slot) {
+    memset(r->recovery_resp + s, 0, sizeof(struct recovery_resp));
+    req->thread_id = r->c->host_id;
+    req->slot = slot;
+    req->obj = g->id;
+    req->seq = __atomic_add_fetch(&r->recovery_seq, 1, __ATOMIC_RELAXED);
+    req->valid = 1;
+}
+
+uint64_t rdma_recovery_send(struct rdma_ctx *r, int s,
+                            const struct recovery_req *req, uint32_t *rkey) {
+    struct config *c = r->c;
+    size_t off = (c->host_id * RECOVERY_SLOTS + s) * sizeof(*req);
+    if (c->host_id != COORDINATOR_NODE) {
+        *rkey = r->ra[COORDINATOR_NODE].rrkey;
+        return r->ra[COORDINATOR_NODE].raddr + off;
+    }
+    // no QP to ourselves: store it, valid last
+    struct recovery_req *dst = (struct recovery_req *)((uint8_t *)r->recovery_reqs + off);
+    memcpy(dst, req, sizeof(*req) - 1);
+    __atomic_store_n(&dst->valid, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+struct recovery_resp *rdma_recovery_poll(struct rdma_ctx *r, int s,
+                                         uint32_t seq) {
+    struct recovery_resp *resp = r->recovery_resp + s;
+    if (!__atomic_load_n(&resp->valid, __ATOMIC_ACQUIRE)) return NULL;
+    if (resp->seq == seq) return resp;
+    // the late answer of a request that timed out
+    memset(resp, 0, sizeof(*resp));
+    return NULL;
+}
+
+void rdma_recovery_done(struct rdma_ctx *r, int s, uint64_t start) {
+    memset(r->recovery_resp + s, 0, sizeof(struct recovery_resp));
+    __atomic_fetch_or(&r->recovery_free, 1ULL << s, __ATOMIC_RELEASE);
+    rdma_recovery_record(r, start);
+}
+
+void rdma_recovery_record(struct rdma_ctx *r, uint64_t start) {
+    struct rdma_recovery_stats *st = &r->recovery_stats;
+    uint64_t us = ts_us() - start;
+    __atomic_add_fetch(&st->requests, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&st->wait_us, us, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&st->max_us, __ATOMIC_RELAXED);
+    while (us > max &&
+           !__atomic_compare_exchange_n(&st->max_us, &max, us, 0,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Collect up to RECOVERY_BATCH pending requests into the jobs */
+static int __gather(struct rdma_ctx *r) {
+    struct rdma_recoverer *e = &r->recoverer;
+    int nreq = r->c->n * RECOVERY_SLOTS, k = 0;
+    for (int j = 0; j < nreq && k < RECOVERY_BATCH; ++j)
+        if (__atomic_load_n(&r->recovery_reqs[j].valid, __ATOMIC_ACQUIRE)) {
+            if (!e->seen_us[j]) e->seen_us[j] = ts_us();
+            e->jobs[k++] = j;
+        }
+    return k;
+}
+
+/* Region of request j, or NULL if it names no LL/SC object here */
+static struct rdma_region *__job_region(struct rdma_ctx *r, uint32_t j) {
+    struct rdma_region *g = rdma_obj_find(r, r->recovery_reqs[j].obj);
+    return g && g->kind == OBJ_LLSC ? g : NULL;
+}
+
+/* Step 1: read the slot of every job from all replicas. Jobs whose slot
+ * cannot be read get no reads and are answered as lost */
+static void __read_slots(struct rdma_ctx *r, int njobs, int *replied) {
+    struct config *c = r->c;
+    struct rdma_recoverer *e = &r->recoverer;
+    struct rdma_lane *l = e->l;
+    uint32_t gen = rdma_sync_begin(l);
+    int posted = 0;
+
+    memset(replied, 0, sizeof(int) * njobs * c->n);
+    for (int k = 0; k < njobs; ++k) {
+        struct recovery_req *req = r->recovery_reqs + e->jobs[k];
+        struct rdma_region *g = __job_region(r, e->jobs[k]);
+        struct llsc_slot *reads = e->reads + k * c->n;
+        struct llsc_slot *local = g ? rdma_llsc_slot(g, req->slot) : NULL;
+        if (!local) continue;
+        reads[c->host_id] = *(volatile struct llsc_slot *)local;
+        replied[k * c->n + c->host_id] = 1;
+
+        for (int i = 0; i < c->n; ++i) {
+            if (i == c->host_id) continue;
+            uint32_t rkey;
+            uint64_t addr = rdma_region_raddr(g, i, req->slot, &rkey);
+            if (!addr) continue;  // chunk not known yet
+            struct ibv_sge sge = {.addr = (uint64_t)(reads + i),
+                                  .length = sizeof(struct llsc_slot),
+                                  .lkey = e->mr->lkey};
+            struct ibv_send_wr wr = {
+                .wr_id = SYNC_WR_ID(PH_RECOVERY, gen, JOB_PEER(k, i)),
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_RDMA_READ,
+                .send_flags = IBV_SEND_SIGNALED,
+                .wr.rdma = {.remote_addr = addr, .rkey = rkey}};
+            rdma_stage(l, i, 0, &wr);
+            ++posted;
+        }
+    }
+    rdma_flush(l);
+
+    // every read lands before the buffers are reused by the next round
+    struct ibv_wc wc[32];
+    while (posted > 0 && !r->stop) {
+        int n = rdma_wait(l, l->cq, 32, wc);
+        for (int i = 0; i < n; ++i, --posted)
+            if (wc[i].status == IBV_WC_SUCCESS) {
+                int peer = WR_PEER(wc[i].wr_id);
+                replied[JOB_OF(peer) * c->n + (peer & 0xFF)] = 1;
+            }
+    }
+}
+
+/* Step 2: the ballot of the slot, or an empty slot if no replica of a
+ * majority holds one or the slot left the ring here. A ballot that may
+ * hold a fast quorum won its SC and is kept; otherwise the newest ballot
+ * is. -1 without a majority */
+static int __decide(struct rdma_ctx *r, int k, const int *replied,
+                    struct llsc_slot *out) {
+    struct config *c = r->c;
+    struct rdma_recoverer *e = &r->recoverer;
+    struct recovery_req *req = r->recovery_reqs + e->jobs[k];
+    struct rdma_region *g = __job_region(r, e->jobs[k]);
+    struct llsc_slot *reads = e->reads + k * c->n;
+    uint64_t ballots[c->n];
+    int count = 0;
+    uint64_t ballot;
+
+    memset(out, 0, sizeof(*out));
+    if (!g || !replied[k * c->n + c->host_id] ||
+        rdma_slot_ballot(g, req->slot, reads[c->host_id].ballot, &ballot))
+        return 0;  // nothing to decide: answered as lost
+    for (int i = 0; i < c->n; ++i) {
+        ballots[i] = 0;
+        if (!replied[k * c->n + i]) continue;
+        ++count;
+        // other laps hold nothing of this slot
+        if (rdma_slot_ballot(g, req->slot, reads[i].ballot, ballots + i))
+            ballots[i] = 0;
+    }
+    if (count < c->n / 2 + 1) return -1;
+
+    // rounds are per lane, so the newest ballot need not be the one that
+    // won: a ballot on all but n - FAST_QUORUM of the replicas read may
+    // hold a fast quorum, and at most one can
+    int need = count - (c->n - FAST_QUORUM(c));
+    int pick = -1;
+    for (int i = 0; i < c->n && pick < 0; ++i) {
+        if (!ballots[i]) continue;
+        int holders = 0;
+        for (int j = 0; j < c->n; ++j) holders += ballots[j] == ballots[i];
+        if (holders >= need) pick = i;
+    }
+    if (pick < 0)
+        for (int i = 0; i < c->n; ++i)
+            if (ballots[i] &&
+                (pick < 0 || rdma_ballot_after(ballots[i], ballots[pick])))
+                pick = i;
+    if (pick >= 0) {
+        out->ballot = reads[pick].ballot;
+        out->value = rdma_llsc_value(ballots[pick], reads + pick);
+    }
+    return 0;
+}
+
+/* Steps 3-4: write the decisions back, end the read leases they
+ * overturn and answer the requesters. Jobs without a majority stay
+ * pending for the next round */
+static int __answer(struct rdma_ctx *r, int njobs, const int *replied) {
+    struct config *c = r->c;
+    struct rdma_recoverer *e = &r->recoverer;
+    struct rdma_lane *l = e->l;
+    int inline_slot = sizeof(struct llsc_slot) <= (size_t)r->max_inline;
+    int inline_resp = sizeof(struct recovery_resp) <= (size_t)r->max_inline;
+    int answered = 0;
+    uint32_t gen = rdma_sync_begin(l);
+    int8_t ok[RECOVERY_BATCH];
+
+    for (int k = 0; k < njobs; ++k) {
+        struct recovery_req *req = r->recovery_reqs + e->jobs[k];
+        struct rdma_region *g = __job_region(r, e->jobs[k]);
+        struct llsc_slot *d = e->decided + k;
+        if (!(ok[k] = !__decide(r, k, replied, d)) || !d->ballot) continue;
+
+        // requests of several nodes for one slot share the first decision
+        for (int q = 0; q < k; ++q) {
+            struct recovery_req *p = r->recovery_reqs + e->jobs[q];
+            if (ok[q] && p->obj == req->obj && p->slot == req->slot) {
+                *d = e->decided[q];
+                break;
+            }
+        }
+        *rdma_llsc_slot(g, req->slot) = *d;
+        for (int i = 0; i < c->n; ++i) {
+            if (i == c->host_id) continue;
+            uint32_t rkey;
+            uint64_t addr = rdma_region_raddr(g, i, req->slot, &rkey);
+            if (!addr) continue;
+            struct ibv_sge sge = {.addr = (uint64_t)d,
+                                  .length = sizeof(*d),
+                                  .lkey = e->mr->lkey};
+            struct ibv_send_wr wr = {
+                .wr_id = SYNC_WR_ID(PH_WRITE, gen, i),
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_RDMA_WRITE,
+                .send_flags = inline_slot ? 0 : IBV_SEND_SIGNALED,
+                .wr.rdma = {.remote_addr = addr, .rkey = rkey}};
+            rdma_stage(l, i, 0, &wr);
+        }
+
+        // the slot may be the last one, unless a later one was decided
+        struct llsc_head *h = e->heads + k;
+        h->next = req->slot + 1;
+        h->slot = *d;
+        if (h->next >= *(volatile uint64_t *)&g->dir->frontier)
+            rdma_llsc_publish(l, g, h, e->mr->lkey, gen);
+    }
+
+    // the decided slot may be another SC's: end read leases first
+    for (int k = 0; k < njobs; ++k) {
+        struct rdma_region *g = __job_region(r, e->jobs[k]);
+        int first = ok[k] && e->decided[k].ballot;
+        for (int q = 0; first && q < k; ++q)
+            first = !(ok[q] && e->decided[q].ballot &&
+                      __job_region(r, e->jobs[q]) == g);
+        if (first) rdma_rlease_revoke(l, g);
+    }
+
+    uint64_t now = ts_us();
+    for (int k = 0; k < njobs; ++k) {
+        if (!ok[k]) continue;
+        uint32_t j = e->jobs[k];
+        struct recovery_req *req = r->recovery_reqs + j;
+        struct recovery_resp *resp = e->resps + k;
+        int node = j / RECOVERY_SLOTS, s = j % RECOVERY_SLOTS;
+        resp->thread_id = e->decided[k].ballot & 0xFFFF;
+        resp->value = e->decided[k].value;
+        resp->ballot = e->decided[k].ballot;
+        resp->seq = req->seq;
+        resp->valid = 1;
+        memset(req, 0, sizeof(*req));  // before the requester may reuse it
+        r->recovery_stats.serve_us += now - e->seen_us[j];
+        e->seen_us[j] = 0;
+        ++answered;
+
+        if (node == c->host_id) {
+            struct recovery_resp *dst = r->recovery_resp + s;
+            memcpy(dst, resp, sizeof(*resp) - 1);
+            __atomic_store_n(&dst->valid, 1, __ATOMIC_RELEASE);
+            continue;
+        }
+        struct ibv_sge sge = {.addr = (uint64_t)resp,
+                              .length = sizeof(*resp),
+                              .lkey = e->mr->lkey};
+        struct ibv_send_wr wr = {
+            .wr_id = SYNC_WR_ID(PH_WRITE, gen, node),
+            .sg_list = &sge,
+            .num_sge = 1,
+            .opcode = IBV_WR_RDMA_WRITE,
+            .send_flags = inline_resp ? 0 : IBV_SEND_SIGNALED,
+            .wr.rdma = {.remote_addr = r->ra[node].raddr +
+                                       c->n * RECOVERY_SLOTS *
+                                           sizeof(struct recovery_req) +
+                                       s * sizeof(*resp),
+                        .rkey = r->ra[node].rrkey}};
+        rdma_stage(l, node, 0, &wr);
+    }
+    rdma_flush(l);
+    return answered;
+}
+
+static void *__recoverer(void *arg) {
+    struct rdma_ctx *r = arg;
+    struct rdma_recovery_stats *st = &r->recovery_stats;
+    int *replied = calloc(RECOVERY_BATCH * r->c->n, sizeof(int));
+    int idle = 0;
+    if (!replied) {
+        perror("calloc:");
+        return NULL;
+    }
+
+    while (!r->stop) {
+        int njobs = __gather(r);
+        if (!njobs) {
+            if (++idle < RECOVERY_SPIN)
+                cpu_relax();
+            else
+                usleep(RECOVERY_IDLE_US);
+            continue;
+        }
+        idle = 0;
+        __read_slots(r, njobs, replied);
+        int answered = __answer(r, njobs, replied);
+        if (answered) {
+            st->served += answered;
+            ++st->batches;
+        }
+        FAA_LOG("Recovery round: %d requests, %d answered", njobs, answered);
+    }
+    free(replied);
+    return NULL;
+}
+
+int rdma_recoverer_start(struct rdma_ctx *r) {
+    struct config *c = r->c;
+    struct rdma_recoverer *e = &r->recoverer;
+    if (c->host_id != COORDINATOR_NODE ||
+        c->llsc_recovery == LLSC_LEADERLESS)
+        return 0;
+
+    // reads, then per job: the decision, the head and the response
+    size_t nreads = (size_t)RECOVERY_BATCH * c->n * sizeof(struct llsc_slot);
+    size_t njob = sizeof(struct llsc_slot) + sizeof(struct llsc_head) +
+                  sizeof(struct recovery_resp);
+    size_t nb = nreads + RECOVERY_BATCH * njob;
+    uint8_t *buf = calloc(1, nb);
+    if (!buf || !(e->jobs = calloc(RECOVERY_BATCH, sizeof(uint32_t))) ||
+        !(e->seen_us = calloc(c->n * RECOVERY_SLOTS, sizeof(uint64_t)))) {
+        perror("calloc:");
+        goto err;
+    }
+    e->reads = (struct llsc_slot *)buf;
+    e->decided = (struct llsc_slot *)(buf + nreads);
+    e->heads = (struct llsc_head *)(e->decided + RECOVERY_BATCH);
+    e->resps = (struct recovery_resp *)(e->heads + RECOVERY_BATCH);
+    if (!(e->mr = ibv_reg_mr(r->pd, buf, nb, IBV_ACCESS_LOCAL_WRITE))) {
+        FAA_LOG("Failed to register the recovery engine scratch");
+        goto err;
+    }
+    e->l = r->rec;
+    if (pthread_create(&e->thread, NULL, __recoverer, r)) {
+        perror("pthread_create:");
+        goto err;
+    }
+    return 0;
+
+err:
+    if (e->mr) ibv_dereg_mr(e->mr);
+    free(buf);
+    free(e->jobs);
+    free(e->seen_us);
+    memset(e, 0, sizeof(*e));
+    return -1;
+}
+
+void rdma_recoverer_stop(struct rdma_ctx *r) {
+    struct rdma_recoverer *e = &r->recoverer;
+    if (!e->l) return;
+    r->stop = 1;
+    pthread_join(e->thread, NULL);
+    ibv_dereg_mr(e->mr);
+    free(e->reads);
+    free(e->jobs);
+    free(e->seen_us);
+    memset(e, 0, sizeof(*e));
+}
+
+void rdma_recovery_stats(struct rdma_ctx *r, struct rdma_recovery_stats *s) {
+    struct rdma_recovery_stats *st = &r->recovery_stats;
+    s->requests = __atomic_load_n(&st->requests, __ATOMIC_RELAXED);
+    s->wait_us = __atomic_load_n(&st->wait_us, __ATOMIC_RELAXED);
+    s->max_us = __atomic_load_n(&st->max_us, __ATOMIC_RELAXED);
+    s->served = __atomic_load_n(&st->served, __ATOMIC_RELAXED);
+    s->batches = __atomic_load_n(&st->batches, __ATOMIC_RELAXED);
+    s->serve_us = __atomic_load_n(&st->serve_us, __ATOMIC_RELAXED);
+}
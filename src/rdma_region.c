@@ -0,0 +1,441 @@
+// Slot regions.
+// Slots are registered in chunks as they are used. Every node publishes its
+// chunks in a directory that peers read the first time they miss a chunk.
+// A peer that finds the chunk missing writes it to the directory's want
+// word, and the owner's grower thread registers it.
+//
+// A region is a ring. Every tick the grower publishes the lowest slot this
+// node may still use, reads the other nodes' directory heads and resets
+// the slots below everyone's low for their next lap. A slot may be used
+// once every replica has reset its previous lap.
+
+#include "rdma.h"
+#include "arch.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Grower tick */
+#define GROW_PERIOD_US (100)
+
+/* Chunks registered ahead of the highest one used locally */
+#define GROW_AHEAD (1)
+
+#define REGION_ACCESS                                                   \
+    (IBV_ACCESS_LOCAL_WRITE | IBV_ACCESS_REMOTE_READ |                  \
+     IBV_ACCESS_REMOTE_WRITE | IBV_ACCESS_REMOTE_ATOMIC)
+
+int rdma_region_init(struct rdma_ctx *r, struct rdma_region *g, uint8_t kind,
+                     uint64_t max_slots) {
+    struct config *c = r->c;
+
+    g->r = r;
+    g->kind = kind;
+    g->slot_size = kind == OBJ_FAA ? sizeof(uint64_t) : sizeof(struct llsc_slot);
+    g->chunk_slots = c->chunk_slots ? c->chunk_slots : CHUNK_SLOTS;
+    if (g->chunk_slots > max_slots) g->chunk_slots = max_slots;
+    g->max_chunks = (max_slots + g->chunk_slots - 1) / g->chunk_slots;
+    g->capacity = max_slots;
+    g->touched = 0;
+    g->mine = g->low = g->next_reclaim = 0;
+    g->high = max_slots;
+    g->scan = 0;
+    memset(&g->lease, 0, sizeof(g->lease));
+    g->lease.size = MAX_BATCH;
+    pthread_mutex_init(&g->lease.lock, 0);
+    memset(&g->holes, 0, sizeof(g->holes));
+    pthread_mutex_init(&g->holes.lock, 0);
+    memset(&g->rlease, 0, sizeof(g->rlease));
+    pthread_mutex_init(&g->rlease.lock, 0);
+    pthread_mutex_init(&g->grow_lock, 0);
+
+    size_t nb = sizeof(struct region_dir) +
+                g->max_chunks * sizeof(struct chunk_ent);
+    // Load-Link reads the head of the directory as one cache line
+    if (posix_memalign((void **)&g->dir, DIR_ALIGN, nb)) {
+        g->dir = NULL;
+        FAA_LOG("Failed to allocate region directory");
+        return -ENOMEM;
+    }
+    memset(g->dir, 0, nb);
+    if (!(g->chunks = calloc(g->max_chunks, sizeof(uint8_t *))) ||
+        !(g->mrs = calloc(g->max_chunks, sizeof(struct ibv_mr *))) ||
+        !(g->mapped = calloc(g->max_chunks, sizeof(size_t))) ||
+        !(g->peers = calloc((size_t)c->n * g->max_chunks,
+                            sizeof(struct chunk_ent))) ||
+        !(g->lookup = calloc(c->n, sizeof(uint32_t))) ||
+        !(g->dirs = calloc(c->n, sizeof(struct chunk_ent)))) {
+        perror("calloc:");
+        return -errno;
+    }
+    if (!(g->dir_mr = ibv_reg_mr(r->pd, g->dir, nb, REGION_ACCESS))) {
+        FAA_LOG("Failed to register region directory");
+        return -errno;
+    }
+    g->dirs[c->host_id] = (struct chunk_ent){
+        .addr = (uint64_t)g->dir, .rkey = g->dir_mr->rkey, .valid = 1};
+
+    // chunks every node needs from the start
+    uint64_t init = c->init_slots ? c->init_slots : 1;
+    if (init > max_slots) init = max_slots;
+    for (uint32_t k = 0; k * (uint64_t)g->chunk_slots < init; ++k)
+        if (!rdma_region_grow(g, k)) return -ENOMEM;
+    return 0;
+}
+
+void rdma_region_destroy(struct rdma_region *g) {
+    for (uint32_t k = 0; g->chunks && k < g->max_chunks; ++k)
+        if (g->chunks[k]) {
+            ibv_dereg_mr(g->mrs[k]);
+            rdma_mem_free(g->chunks[k], g->mapped[k]);
+        }
+    if (g->dir_mr) ibv_dereg_mr(g->dir_mr);
+    free(g->dir);
+    free(g->chunks);
+    free(g->mrs);
+    free(g->mapped);
+    free(g->peers);
+    free(g->lookup);
+    free(g->dirs);
+    pthread_mutex_destroy(&g->lease.lock);
+    pthread_mutex_destroy(&g->holes.lock);
+    pthread_mutex_destroy(&g->rlease.lock);
+    pthread_mutex_destroy(&g->grow_lock);
+    memset(g, 0, sizeof(*g));
+}
+
+uint8_t *rdma_region_grow(struct rdma_region *g, uint32_t k) {
+    struct rdma_ctx *r = g->r;
+    uint8_t *base;
+
+    if (k >= g->max_chunks) return NULL;
+    pthread_mutex_lock(&g->grow_lock);
+    if ((base = g->chunks[k])) goto exit;
+
+    size_t nb = (size_t)g->chunk_slots * g->slot_size;
+    if (!(base = rdma_mem_alloc(r->c, nb, g->mapped + k))) {
+        FAA_LOG("Failed to allocate chunk %u", k);
+        goto exit;
+    }
+    if (!(g->mrs[k] = ibv_reg_mr(r->pd, base, nb, REGION_ACCESS))) {
+        FAA_LOG("Failed to register chunk %u", k);
+        rdma_mem_free(base, g->mapped[k]);
+        base = NULL;
+        goto exit;
+    }
+
+    // publish to peers, then to local threads
+    struct chunk_ent *e = g->dir->chunk + k;
+    e->addr = (uint64_t)base;
+    e->rkey = g->mrs[k]->rkey;
+    __atomic_store_n(&e->valid, 1, __ATOMIC_RELEASE);
+    g->peers[(size_t)r->c->host_id * g->max_chunks + k] = *e;
+    __atomic_store_n(&g->chunks[k], base, __ATOMIC_RELEASE);
+    FAA_LOG("Registered chunk %u (%zu bytes)", k, nb);
+exit:
+    pthread_mutex_unlock(&g->grow_lock);
+    return base;
+}
+
+/* Read chunk k of peer's directory. If the peer has not registered it yet,
+ * ask for it and keep the lookup queued */
+static void __lookup(struct rdma_lane *l, struct rdma_region *g, int peer,
+                     uint32_t k) {
+    uint32_t rkey, gen = rdma_sync_begin(l);
+    uint64_t dir = rdma_region_dir(g, peer, &rkey);
+    if (!dir) return;  // the peer's object is not known yet
+    struct chunk_ent *ent = (struct chunk_ent *)l->results;
+    struct ibv_sge sge = {.addr = (uint64_t)ent,
+                          .length = sizeof(*ent),
+                          .lkey = l->mr->lkey};
+    struct ibv_send_wr wr = {
+        .wr_id = SYNC_WR_ID(PH_LOOKUP, gen, peer),
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_RDMA_READ,
+        .send_flags = IBV_SEND_SIGNALED,
+        .wr.rdma = {.remote_addr = dir + offsetof(struct region_dir, chunk) +
+                                   k * sizeof(struct chunk_ent),
+                    .rkey = rkey}};
+    rdma_stage(l, peer, 0, &wr);
+    rdma_flush(l);
+
+    struct ibv_wc wc;
+    while (rdma_wait(l, l->cq, 1, &wc) <= 0)
+        if (g->r->stop) return;
+    if (wc.status != IBV_WC_SUCCESS) return;
+
+    if (ent->valid) {
+        struct chunk_ent *e = g->peers + (size_t)peer * g->max_chunks + k;
+        e->addr = ent->addr;
+        e->rkey = ent->rkey;
+        __atomic_store_n(&e->valid, 1, __ATOMIC_RELEASE);
+        __sync_bool_compare_and_swap(g->lookup + peer, k + 1, 0);
+        return;
+    }
+
+    // not there yet: have the peer's grower register it
+    l->stage->want = k;
+    sge = (struct ibv_sge){.addr = (uint64_t)&l->stage->want,
+                           .length = sizeof(uint64_t),
+                           .lkey = l->mr->lkey};
+    wr = (struct ibv_send_wr){
+        .wr_id = SYNC_WR_ID(PH_LOOKUP, gen, peer),
+        .sg_list = &sge,
+        .num_sge = 1,
+        .opcode = IBV_WR_RDMA_WRITE,
+        .send_flags = IBV_SEND_SIGNALED,
+        .wr.rdma = {.remote_addr = dir + offsetof(struct region_dir, want),
+                    .rkey = rkey}};
+    rdma_stage(l, peer, 0, &wr);
+    rdma_flush(l);
+    while (rdma_wait(l, l->cq, 1, &wc) <= 0)
+        if (g->r->stop) return;
+}
+
+static void __tick(struct rdma_region *g) {
+    struct rdma_ctx *r = g->r;
+    struct config *c = r->c;
+
+    // stay ahead of local use and register what peers asked for
+    for (uint32_t k = g->touched + 1;
+         k <= g->touched + GROW_AHEAD && k < g->max_chunks; ++k)
+        if (!g->chunks[k]) rdma_region_grow(g, k);
+    uint64_t want = *(volatile uint64_t *)&g->dir->want;
+    if (want < g->max_chunks && !g->chunks[want])
+        rdma_region_grow(g, want);
+
+    for (int i = 0; i < c->n; ++i) {
+        if (i == c->host_id) continue;
+        uint32_t k = g->lookup[i];
+        if (k) __lookup(r->ctl, g, i, k - 1);
+
+        // learn the chunk in use and the next one of every peer before
+        // they are needed
+        for (k = g->touched; k <= g->touched + 1 && k < g->max_chunks; ++k)
+            if (!g->peers[(size_t)i * g->max_chunks + k].valid)
+                __lookup(r->ctl, g, i, k);
+    }
+}
+
+/* Read the directory head of every peer into head, DIR_HEAD_WORDS per
+ * node. Returns the number of peers that replied */
+static int __read_heads(struct rdma_lane *l, struct rdma_region *g,
+                        uint64_t *head) {
+    struct config *c = g->r->c;
+    uint32_t gen = rdma_sync_begin(l);
+    int posted = 0, replied = 0;
+
+    for (int i = 0; i < c->n; ++i) {
+        if (i == c->host_id) continue;
+        uint32_t rkey;
+        uint64_t dir = rdma_region_dir(g, i, &rkey);
+        if (!dir) continue;  // counts as not replied
+        struct ibv_sge sge = {.addr = (uint64_t)(head + i * DIR_HEAD_WORDS),
+                              .length = DIR_HEAD_WORDS * sizeof(uint64_t),
+                              .lkey = l->mr->lkey};
+        struct ibv_send_wr wr = {.wr_id = SYNC_WR_ID(PH_WATERMARK, gen, i),
+                                 .sg_list = &sge,
+                                 .num_sge = 1,
+                                 .opcode = IBV_WR_RDMA_READ,
+                                 .send_flags = IBV_SEND_SIGNALED,
+                                 .wr.rdma = {.remote_addr = dir, .rkey = rkey}};
+        rdma_stage(l, i, 0, &wr);
+        ++posted;
+    }
+    rdma_flush(l);
+
+    struct ibv_wc wc[c->n];
+    while (posted > 0 && !g->r->stop) {
+        int n = rdma_wait(l, l->cq, c->n, wc);
+        for (int i = 0; i < n; ++i, --posted)
+            replied += wc[i].status == IBV_WC_SUCCESS;
+    }
+    return replied;
+}
+
+/* Lowest slot of g used by a blocking call or an op of this node */
+static uint64_t __floors(struct rdma_region *g, uint64_t low) {
+    struct rdma_ctx *r = g->r;
+    for (int i = 0; i <= r->nlanes; ++i) {  // and the grower's ctl lane
+        struct rdma_lane *l = r->lanes + i;
+        uint64_t f = __atomic_load_n(&l->floor, __ATOMIC_ACQUIRE);
+        if (f < low && __atomic_load_n(&l->held, __ATOMIC_ACQUIRE) == g)
+            low = f;
+        for (int j = 0; j < MAX_OPS; ++j) {
+            f = __atomic_load_n(&l->ops[j].floor, __ATOMIC_ACQUIRE);
+            if (f < low && l->ops[j].g == g) low = f;
+        }
+    }
+    return low;
+}
+
+/* Lowest slot this node may still use. FAA slots are handed out by the
+ * frontier (or this node's stripe), and a lane pins its floor before it
+ * takes a slot, so reading the frontier before the floors bounds every
+ * slot not yet seen. LL/SC slots are indexed by the frontier, which only
+ * moves forward */
+static uint64_t __mine(struct rdma_region *g, const uint64_t *head) {
+    struct rdma_ctx *r = g->r;
+    struct config *c = r->c;
+    uint64_t f = *(volatile uint64_t *)&g->dir->frontier;
+
+    if (g->kind != OBJ_FAA) return f ? f - 1 : 0;
+    if (c->frontier_mode == FRONTIER_STRIPED)
+        f = rdma_stripe_slot(c, f);
+    else if (c->host_id != FRONTIER_NODE)
+        f = head[FRONTIER_NODE * DIR_HEAD_WORDS];
+    if (c->frontier_mode == FRONTIER_LEASED) {
+        // slots left in the lease are still to be handed out
+        uint64_t next = __atomic_load_n(&g->lease.next, __ATOMIC_ACQUIRE);
+        if (next < __atomic_load_n(&g->lease.end, __ATOMIC_ACQUIRE) &&
+            next < f)
+            f = next;
+    }
+    __atomic_add_fetch(&g->scan, 1, __ATOMIC_SEQ_CST);
+    uint64_t mine = __floors(g, f);
+    if (mine < g->mine) mine = g->mine;  // stale floors of late starters
+    __atomic_store_n(&g->mine, mine, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&g->scan, 1, __ATOMIC_SEQ_CST);
+    return mine;
+}
+
+/* An idle stripe would pin the low watermark: move it up to the block the
+ * leading node is in. The rest of our current block is left as a gap */
+static void __stripe_catch_up(struct rdma_region *g, const uint64_t *head) {
+    struct config *c = g->r->c;
+    uint64_t lead = 0;
+    for (int i = 0; i < c->n; ++i)
+        if (i != c->host_id && head[i * DIR_HEAD_WORDS] > lead)
+            lead = head[i * DIR_HEAD_WORDS];
+    lead -= lead % STRIPE_SLOTS;
+
+    uint64_t x = __atomic_load_n(&g->dir->frontier, __ATOMIC_RELAXED);
+    while (x < lead &&
+           !__atomic_compare_exchange_n(&g->dir->frontier, &x, lead, 0,
+                                        __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        ;
+}
+
+/* Reset slots [dir->reclaimed, end) for their next lap */
+static void __reclaim(struct rdma_region *g, uint64_t end) {
+    uint64_t s = g->dir->reclaimed;
+    for (; s < end; ++s) {
+        uint8_t *p = rdma_region_slot(g, s);
+        if (!p) break;
+        memset(p + sizeof(uint64_t), 0, g->slot_size - sizeof(uint64_t));
+        __atomic_store_n((uint64_t *)p, rdma_slot_lap(g, s + g->capacity),
+                         __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&g->dir->reclaimed, s, __ATOMIC_RELEASE);
+}
+
+/* Advance the watermarks of g. They hold while a replica is unreachable */
+static void __watermarks(struct rdma_region *g) {
+    struct rdma_ctx *r = g->r;
+    struct config *c = r->c;
+    uint64_t *head = r->ctl->results;
+
+    if (__read_heads(r->ctl, g, head) < c->n - 1) return;
+    if (g->kind == OBJ_FAA && c->frontier_mode == FRONTIER_STRIPED)
+        __stripe_catch_up(g, head);
+    __atomic_store_n(&g->dir->low, __mine(g, head), __ATOMIC_RELEASE);
+
+    // the low of the previous tick: writes that raced it have landed
+    __reclaim(g, g->next_reclaim);
+
+    uint64_t low = g->dir->low, reclaimed = g->dir->reclaimed;
+    for (int i = 0; i < c->n; ++i) {
+        if (i == c->host_id) continue;
+        uint64_t *h = head + i * DIR_HEAD_WORDS;
+        if (h[2] < low) low = h[2];
+        if (h[3] < reclaimed) reclaimed = h[3];
+    }
+    if (low > g->low) __atomic_store_n(&g->low, low, __ATOMIC_RELEASE);
+    g->next_reclaim = g->low;
+    if (reclaimed + g->capacity > g->high)
+        __atomic_store_n(&g->high, reclaimed + g->capacity, __ATOMIC_RELEASE);
+}
+
+/* One grower tick of region g */
+static void __maintain(struct rdma_region *g) {
+    __tick(g);
+    if (g->kind == OBJ_FAA && g->r->c->frontier_mode == FRONTIER_LEASED)
+        rdma_lease_tick(g);
+    if (g->kind == OBJ_FAA) rdma_holes_tick(g);
+    if (g->kind == OBJ_LLSC && g->r->c->read_lease_us) rdma_rlease_tick(g);
+    __watermarks(g);
+}
+
+static void *__grower(void *arg) {
+    struct rdma_ctx *r = arg;
+    while (!r->stop) {
+        __maintain(&r->faa);
+        __maintain(&r->llsc);
+        rdma_obj_resolve(r);
+        for (int i = 0; i < MAX_OBJECTS && !r->stop; ++i) {
+            struct rdma_region *g = __atomic_load_n(r->objs + i, __ATOMIC_ACQUIRE);
+            if (g) __maintain(g);
+        }
+        usleep(GROW_PERIOD_US);
+    }
+    return NULL;
+}
+
+int rdma_region_wait(struct rdma_lane *l, struct rdma_region *g,
+                     uint64_t end) {
+    uint64_t deadline = 0;
+    l->idle = 0;
+    while (end > __atomic_load_n(&g->high, __ATOMIC_ACQUIRE)) {
+        if (!deadline)
+            deadline = ts_us() + RING_WAIT_US;
+        else if (ts_us() > deadline)
+            return -1;
+        rdma_relax(l);
+    }
+    return 0;
+}
+
+int rdma_region_hold(struct rdma_region *g, uint64_t *floor, uint64_t slot) {
+    __atomic_store_n(floor, slot, __ATOMIC_RELAXED);
+    __sync_synchronize();
+    // a scan in progress may have missed the floor: use its result
+    while (__atomic_load_n(&g->scan, __ATOMIC_ACQUIRE) & 1) cpu_relax();
+    if (slot >= __atomic_load_n(&g->mine, __ATOMIC_ACQUIRE) &&
+        slot < __atomic_load_n(&g->high, __ATOMIC_ACQUIRE))
+        return 0;
+    __atomic_store_n(floor, FLOOR_IDLE, __ATOMIC_RELEASE);
+    return -ERANGE;
+}
+
+int rdma_grower_start(struct rdma_ctx *r) {
+    struct config *c = r->c;
+
+    // learn the chunks registered up front before any operation needs them
+    uint64_t init = c->init_slots ? c->init_slots : 1;
+    struct rdma_region *regions[] = {&r->faa, &r->llsc};
+    for (int i = 0; i < c->n; ++i) {
+        if (i == c->host_id) continue;
+        for (int j = 0; j < 2; ++j) {
+            struct rdma_region *g = regions[j];
+            for (uint32_t k = 0; k < g->max_chunks &&
+                                 k * (uint64_t)g->chunk_slots < init; ++k)
+                __lookup(r->ctl, g, i, k);
+        }
+    }
+
+    r->stop = 0;
+    if (pthread_create(&r->grower, NULL, __grower, r)) {
+        perror("pthread_create:");
+        return -errno;
+    }
+    return 0;
+}
+
+void rdma_grower_stop(struct rdma_ctx *r) {
+    r->stop = 1;
+    pthread_join(r->grower, NULL);
+}
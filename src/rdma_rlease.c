@@ -0,0 +1,220 @@
+// LL/SC read leases.
+// A node that reads a register far more often than it is written serves
+// Load-Link locally. It first sets its bit in the readers word of every
+// replica, then clears its revoked word and caches a quorum Load-Link,
+// valid for read_lease_us from before the read. A Store-Conditional that
+// decided its slot checks its local readers word and sets the revoked word
+// of every reader before it returns, or waits out the lease of a reader it
+// cannot reach. A cached Load-Link that missed the slot was read before
+// the slot was decided, so its lease ends before the writer returns.
+
+#include "rdma.h"
+
+#include <stdio.h>
+
+/* A lease left unused this long is dropped and the node unregisters */
+#define RLEASE_IDLE_US (1000000)
+
+/* Mask of every node */
+#define ALL_NODES(c) ((c)->n >= 64 ? ~0ULL : (1ULL << (c)->n) - 1)
+
+/* Set (or clear) this node's bit in the readers word of the replicas in
+ * mask with CAS rounds, so a retried CAS that already applied changes
+ * nothing. Returns the replicas whose word holds the bit as asked */
+static uint64_t __readers_mark(struct rdma_lane *l, struct rdma_region *g,
+                               uint64_t mask, int set) {
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+    uint64_t bit = 1ULL << c->host_id;
+    uint64_t done = 0;
+    uint64_t expect[c->n];  // each replica's word as last seen
+
+    if (mask & bit) {
+        if (set)
+            __atomic_or_fetch(&g->dir->readers, bit, __ATOMIC_SEQ_CST);
+        else
+            __atomic_and_fetch(&g->dir->readers, ~bit, __ATOMIC_SEQ_CST);
+        done |= bit;
+    }
+    mask &= ~bit;
+    for (int i = 0; i < c->n; ++i) expect[i] = set ? 0 : bit;
+
+    while (mask && !r->stop) {
+        uint32_t gen = rdma_sync_begin(l);
+        int posted = 0;
+        for (int i = 0; i < c->n; ++i) {
+            if (!(mask & (1ULL << i))) continue;
+            uint32_t rkey;
+            uint64_t dir = rdma_region_dir(g, i, &rkey);
+            if (!dir) {
+                mask &= ~(1ULL << i);  // object not found there yet
+                continue;
+            }
+            struct ibv_sge sge = {.addr = (uint64_t)(l->results + i),
+                                  .length = sizeof(uint64_t),
+                                  .lkey = l->mr->lkey};
+            struct ibv_send_wr wr = {
+                .wr_id = SYNC_WR_ID(PH_RLEASE, gen, i),
+                .sg_list = &sge,
+                .num_sge = 1,
+                .opcode = IBV_WR_ATOMIC_CMP_AND_SWP,
+                .send_flags = IBV_SEND_SIGNALED,
+                .wr.atomic = {
+                    .remote_addr = dir + offsetof(struct region_dir, readers),
+                    .rkey = rkey,
+                    .compare_add = expect[i],
+                    .swap = set ? expect[i] | bit : expect[i] & ~bit}};
+            rdma_stage(l, i, 0, &wr);
+            ++posted;
+        }
+        rdma_flush(l);
+
+        // a replica that failed is left out; one whose word moved under
+        // the CAS is tried again with the word it returned
+        struct ibv_wc wc[c->n];
+        while (posted > 0 && !r->stop) {
+            int n = rdma_wait(l, l->cq, c->n, wc);
+            for (int i = 0; i < n; ++i, --posted) {
+                int peer = WR_PEER(wc[i].wr_id);
+                uint64_t word = l->results[peer];
+                if (wc[i].status != IBV_WC_SUCCESS) {
+                    mask &= ~(1ULL << peer);
+                } else if (word == expect[peer] || !(word & bit) == !set) {
+                    done |= 1ULL << peer;
+                    mask &= ~(1ULL << peer);
+                } else
+                    expect[peer] = word;
+            }
+        }
+    }
+    return done;
+}
+
+/* Load-Link from the lease. -1 if it does not hold at now */
+static int __lease_read(struct rdma_region *g, uint64_t now,
+                        uint64_t *index, uint64_t *value) {
+    struct rdma_rlease *s = &g->rlease;
+    uint32_t seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+    if (seq & 1) return -1;
+    uint64_t until = __atomic_load_n(&s->until, __ATOMIC_RELAXED);
+    uint64_t i = __atomic_load_n(&s->index, __ATOMIC_RELAXED);
+    uint64_t v = __atomic_load_n(&s->value, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&s->seq, __ATOMIC_RELAXED) != seq || now >= until ||
+        __atomic_load_n(&g->dir->revoked, __ATOMIC_ACQUIRE))
+        return -1;
+    *index = i;
+    *value = v;
+    return 0;
+}
+
+int rdma_rlease_load_link(struct rdma_lane *l, struct rdma_region *g,
+                          uint64_t *out_index, uint64_t *out_value) {
+    struct rdma_rlease *s = &g->rlease;
+    struct config *c = l->r->c;
+    uint64_t now = ts_us();
+    if (!__lease_read(g, now, out_index, out_value)) {
+        __atomic_store_n(&s->used_us, now, __ATOMIC_RELAXED);
+        return 0;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    int ret = 0;
+    if (!__lease_read(g, ts_us(), out_index, out_value))
+        goto exit;  // another lane renewed it meanwhile
+
+    // every replica must know the reader, or a writer may miss it
+    if (s->registered != ALL_NODES(c))
+        s->registered |=
+            __readers_mark(l, g, ALL_NODES(c) & ~s->registered, 1);
+    if (s->registered != ALL_NODES(c)) {
+        ret = rdma_llsc_read(l, g, out_index, out_value);
+        goto exit;
+    }
+
+    // a revocation landing from here on is for a slot the read sees
+    __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&g->dir->revoked, 0, __ATOMIC_SEQ_CST);
+    uint64_t start = ts_us();
+    ret = rdma_llsc_read(l, g, out_index, out_value);
+    __atomic_store_n(&s->index, *out_index, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->value, *out_value, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->until, ret ? 0 : start + c->read_lease_us,
+                     __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->seq, 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&s->used_us, start, __ATOMIC_RELAXED);
+
+exit:
+    pthread_mutex_unlock(&s->lock);
+    return ret;
+}
+
+void rdma_rlease_revoke(struct rdma_lane *l, struct rdma_region *g) {
+    struct rdma_ctx *r = l->r;
+    struct config *c = r->c;
+    uint64_t readers = rdma_rlease_readers(g);
+    if (!readers) return;
+
+    if (readers & (1ULL << c->host_id)) {
+        __atomic_store_n(&g->dir->revoked, 1, __ATOMIC_SEQ_CST);
+        readers &= ~(1ULL << c->host_id);
+    }
+
+    rdma_trace_phase(l, OP_REVOKE);
+    uint64_t *flag = &l->stage->revoked;
+    *flag = 1;
+    uint32_t gen = rdma_sync_begin(l);
+    int posted = 0;
+    for (int i = 0; i < c->n; ++i) {
+        if (!(readers & (1ULL << i))) continue;
+        uint32_t rkey;
+        uint64_t dir = rdma_region_dir(g, i, &rkey);
+        if (!dir) continue;  // stays in readers: waited out
+        struct ibv_sge sge = {.addr = (uint64_t)flag,
+                              .length = sizeof(uint64_t),
+                              .lkey = l->mr->lkey};
+        struct ibv_send_wr wr = {
+            .wr_id = SYNC_WR_ID(PH_RLEASE, gen, i),
+            .sg_list = &sge,
+            .num_sge = 1,
+            .opcode = IBV_WR_RDMA_WRITE,
+            .send_flags = IBV_SEND_SIGNALED,
+            .wr.rdma = {.remote_addr = dir + offsetof(struct region_dir, revoked),
+                        .rkey = rkey}};
+        rdma_stage(l, i, 0, &wr);
+        ++posted;
+    }
+    rdma_flush(l);
+
+    struct ibv_wc wc[c->n];
+    while (posted > 0 && !r->stop) {
+        int n = rdma_wait(l, l->cq, c->n, wc);
+        for (int i = 0; i < n; ++i, --posted)
+            if (wc[i].status == IBV_WC_SUCCESS)
+                readers &= ~(1ULL << WR_PEER(wc[i].wr_id));
+    }
+    rdma_trace_quorum(l);
+    if (!readers) return;
+
+    // an unreachable reader keeps its lease until it runs out
+    FAA_LOG("Waiting out read leases %llx", (unsigned long long)readers);
+    uint64_t until = ts_us() + RLEASE_WAIT_US(c->read_lease_us);
+    l->idle = 0;
+    while (ts_us() < until && !r->stop) rdma_relax(l);
+}
+
+void rdma_rlease_tick(struct rdma_region *g) {
+    struct rdma_rlease *s = &g->rlease;
+    if (!s->registered || pthread_mutex_trylock(&s->lock)) return;
+    if (ts_us() - __atomic_load_n(&s->used_us, __ATOMIC_RELAXED) <
+        RLEASE_IDLE_US)
+        goto exit;
+
+    // writers stop revoking once the bit is gone everywhere
+    __atomic_add_fetch(&s->seq, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&s->until, 0, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s->seq, 1, __ATOMIC_RELEASE);
+    s->registered &= ~__readers_mark(g->r->ctl, g, s->registered, 0);
+exit:
+    pthread_mutex_unlock(&s->lock);
+}
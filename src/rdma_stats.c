@@ -0,0 +1,66 @@
+// Counters and latency histograms.
+// Every lane keeps operation counters and one log-linear histogram per
+// primitive and per path on cache lines of its own, written only by the
+// thread holding the lane. A snapshot sums them without stopping the
+// writers: a counter may miss the operation in flight, never tear.
+
+#include "rdma.h"
+
+#include <string.h>
+
+uint64_t rdma_hist_value(uint32_t bucket) {
+    if (bucket < (1U << HIST_SUB_BITS)) return bucket;
+    int shift = (bucket >> HIST_SUB_BITS) - 1;
+    uint64_t sub = bucket & ((1U << HIST_SUB_BITS) - 1);
+    return (((1ULL << HIST_SUB_BITS) + sub + 1) << shift) - 1;
+}
+
+void rdma_counters_snapshot(struct rdma_ctx *r, struct rdma_counters *s) {
+    enum { N = sizeof(struct rdma_counters) / sizeof(uint64_t) };
+    uint64_t *dst = (uint64_t *)s;
+    memset(s, 0, sizeof(*s));
+    for (int i = 0; i < r->nlanes + SYS_LANES; ++i) {
+        uint64_t *src = (uint64_t *)&r->lanes[i].stats->c;
+        for (int k = 0; k < N; ++k)
+            dst[k] += __atomic_load_n(src + k, __ATOMIC_RELAXED);
+    }
+}
+
+void rdma_stats_snapshot(struct rdma_ctx *r, struct rdma_stats *s) {
+    memset(s, 0, sizeof(*s));
+    rdma_counters_snapshot(r, &s->c);
+    for (int i = 0; i < r->nlanes; ++i) {
+        struct rdma_stats *ls = r->lanes[i].stats;
+        for (int p = 0; p < STAT_PRIMS; ++p)
+            for (int q = 0; q < STAT_PATHS; ++q) {
+                struct rdma_hist *src = &ls->h[p][q], *dst = &s->h[p][q];
+                uint64_t count = __atomic_load_n(&src->count, __ATOMIC_RELAXED);
+                if (!count) continue;
+                dst->count += count;
+                dst->sum_ns += __atomic_load_n(&src->sum_ns, __ATOMIC_RELAXED);
+                uint64_t max = __atomic_load_n(&src->max_ns, __ATOMIC_RELAXED);
+                if (max > dst->max_ns) dst->max_ns = max;
+                for (int b = 0; b < HIST_BUCKETS; ++b)
+                    dst->buckets[b] +=
+                        __atomic_load_n(src->buckets + b, __ATOMIC_RELAXED);
+            }
+    }
+}
+
+uint64_t rdma_hist_quantile(const struct rdma_hist *h, double q) {
+    uint64_t total = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b) total += h->buckets[b];
+    if (!total) return 0;
+
+    // the rank of q, counted from 1
+    uint64_t rank = (uint64_t)(q * total + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > total) rank = total;
+    uint64_t seen = 0;
+    for (int b = 0; b < HIST_BUCKETS; ++b)
+        if ((seen += h->buckets[b]) >= rank) {
+            uint64_t v = rdma_hist_value(b);
+            return v < h->max_ns ? v : h->max_ns;
+        }
+    return h->max_ns;
+}
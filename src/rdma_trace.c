@@ -0,0 +1,122 @@
+// Phase-level tracing.
+// With config.trace_every set, every lane samples one operation in
+// trace_every and records when it starts, each phase it posts, the
+// phase's first completion, the end of its quorum wait and its decision.
+// Events go to a per-lane ring written only by the lane's holder. A dump
+// copies the rings without stopping the writers and keeps only the events
+// no writer can have overwritten meanwhile.
+
+#include "rdma.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+/* Traced ops of a lane that can be open at once */
+#define TRACE_OPEN (4 * MAX_OPS)
+
+static const char *__prims[] = {"FAA", "TAS", "LL", "SC"};
+static const char *__paths[] = {"fast win", "fast loss", "slow", "retried",
+                                "recovery"};
+static const char *__phases[] = {"", "slot", "fast", "prepare", "accept",
+                                 "recovery", "ring", "revoke", ""};
+
+/* Ops being dumped: the op, its primitive and phase (-1 if none) */
+struct open_op {
+  uint32_t op;
+  uint8_t prim;
+  int8_t phase;
+};
+
+/* One async slice event of op on lane l */
+static void __emit(FILE *f, int *first, int pid, int l, uint32_t op,
+                   const char *ph, const char *name, uint64_t ns,
+                   const char *args) {
+    fprintf(f,
+            "%s\n{\"name\":\"%s\",\"cat\":\"op\",\"ph\":\"%s\","
+            "\"id\":\"%d.%u\",\"pid\":%d,\"tid\":%d,\"ts\":%lu.%03lu%s%s}",
+            *first ? "" : ",", name, ph, l, op, pid, l, ns / 1000, ns % 1000,
+            args ? ",\"args\":" : "", args ? args : "");
+    *first = 0;
+}
+
+/* Copy the events of a lane still in its ring. Returns their number */
+static uint64_t __copy(struct rdma_trace *t, struct trace_rec *out,
+                       uint64_t *from) {
+    uint64_t head = __atomic_load_n(&t->head, __ATOMIC_ACQUIRE);
+    uint64_t start = head > TRACE_EVENTS ? head - TRACE_EVENTS : 0;
+    for (uint64_t i = start; i < head; ++i)
+        out[i % TRACE_EVENTS] = t->ev[i % TRACE_EVENTS];
+
+    // event i was overwritten once event i + TRACE_EVENTS was started
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    uint64_t now = __atomic_load_n(&t->head, __ATOMIC_RELAXED);
+    if (now >= TRACE_EVENTS && now - TRACE_EVENTS + 1 > start)
+        start = now - TRACE_EVENTS + 1;
+    *from = start;
+    return head > start ? head - start : 0;
+}
+
+int rdma_trace_dump(struct rdma_ctx *r, FILE *f) {
+    int pid = r->c->host_id, first = 1;
+    struct trace_rec *ev = malloc(sizeof(struct trace_rec) * TRACE_EVENTS);
+    struct open_op *open = malloc(sizeof(struct open_op) * TRACE_OPEN);
+    if (!ev || !open) {
+        free(ev);
+        free(open);
+        return -ENOMEM;
+    }
+
+    fprintf(f, "{\"traceEvents\":[");
+    for (int l = 0; l < r->nlanes; ++l) {
+        struct rdma_trace *t = r->lanes[l].trace;
+        if (!t) continue;
+        uint64_t from, n = __copy(t, ev, &from);
+        for (int i = 0; i < TRACE_OPEN; ++i) open[i].op = 0;
+
+        for (uint64_t i = from; i < from + n; ++i) {
+            struct trace_rec *e = ev + i % TRACE_EVENTS;
+            struct open_op *o = open + e->op % TRACE_OPEN;
+            char args[64];
+            if (e->ev == TRACE_BEGIN) {
+                o->op = e->op;
+                o->prim = e->arg % STAT_PRIMS;
+                o->phase = -1;
+                __emit(f, &first, pid, l, e->op, "b", __prims[o->prim], e->ns,
+                       NULL);
+                continue;
+            }
+            if (o->op != e->op) continue;  // began before the ring's start
+            switch (e->ev) {
+            case TRACE_PHASE:
+                if (o->phase >= 0)
+                    __emit(f, &first, pid, l, e->op, "e",
+                           __phases[o->phase], e->ns, NULL);
+                o->phase = e->arg < OP_DONE ? e->arg : 0;
+                __emit(f, &first, pid, l, e->op, "b", __phases[o->phase],
+                       e->ns, NULL);
+                break;
+            case TRACE_FIRST:
+            case TRACE_QUORUM:
+                __emit(f, &first, pid, l, e->op, "n",
+                       e->ev == TRACE_FIRST ? "first" : "quorum", e->ns,
+                       NULL);
+                break;
+            case TRACE_END:
+                if (o->phase >= 0)
+                    __emit(f, &first, pid, l, e->op, "e",
+                           __phases[o->phase], e->ns, NULL);
+                snprintf(args, sizeof(args), "{\"path\":\"%s\"}",
+                         __paths[e->arg % STAT_PATHS]);
+                __emit(f, &first, pid, l, e->op, "e", __prims[o->prim], e->ns,
+                       args);
+                o->op = 0;
+                break;
+            }
+        }
+    }
+    fprintf(f, "\n]}\n");
+
+    free(ev);
+    free(open);
+    return ferror(f) ? -EIO : 0;
+}
@@ -0,0 +1,71 @@
+// Completion waits.
+// Blocking calls busy-poll their CQ for the lane's spin limit, then arm it
+// and sleep on the lane's completion channel (unless the mode is POLL_SPIN).
+
+#include "rdma.h"
+
+#include <unistd.h>
+
+#include "arch.h"
+
+/* Shortest spin of an adaptive lane */
+#define SPIN_MIN (64)
+
+/* Sleep of a wait on memory past the spin limit */
+#define NAP_US (50)
+
+static void __sleep(struct rdma_lane *l) {
+    struct ibv_cq *ev_cq;
+    void *ev_ctx;
+    uint64_t start = cpu_cycles();
+    if (ibv_get_cq_event(l->channel, &ev_cq, &ev_ctx)) {
+        FAA_LOG("ibv_get_cq_event failed");
+        return;
+    }
+    ibv_ack_cq_events(ev_cq, 1);
+    if (ev_cq == l->armed) l->armed = NULL;
+    l->block_cycles += cpu_cycles() - start;
+    ++l->blocks;
+
+    // waits keep sleeping: spin less before the next one
+    if (l->r->c->poll_mode == POLL_ADAPTIVE)
+        l->spin_limit = (l->spin_limit / 2 > SPIN_MIN) ? l->spin_limit / 2
+                                                       : SPIN_MIN;
+}
+
+void rdma_idle(struct rdma_lane *l, struct ibv_cq *cq) {
+    if (!l->channel || ++l->idle < l->spin_limit) return;
+    if (l->armed != cq) {
+        // poll once more before sleeping: a completion that raced with
+        // arming raises no event
+        if (ibv_req_notify_cq(cq, 0)) {
+            FAA_LOG("ibv_req_notify_cq failed");
+            return;
+        }
+        l->armed = cq;
+        return;
+    }
+    __sleep(l);
+}
+
+void rdma_wait_done(struct rdma_lane *l) {
+    struct config *c = l->r->c;
+    uint32_t budget = c->spin_budget ? c->spin_budget : SPIN_BUDGET;
+
+    // the wait ended while spinning: spin longer before the next sleep
+    if (c->poll_mode == POLL_ADAPTIVE && l->idle < l->spin_limit)
+        l->spin_limit =
+            (l->spin_limit * 2 < budget) ? l->spin_limit * 2 : budget;
+    l->idle = 0;
+}
+
+void rdma_relax(struct rdma_lane *l) {
+    if (!l->channel || ++l->idle < l->spin_limit) {
+        cpu_relax();
+        return;
+    }
+    uint64_t start = cpu_cycles();
+    usleep(NAP_US);
+    l->block_cycles += cpu_cycles() - start;
+    ++l->blocks;
+}
@@ -26,23 +26,35 @@
 #endif
 
 /* Convert remote attribute struct from host order to network order */
-#define RA_TO_NET(r)                   \
-    do {                               \
-        (r)->addr = htonll((r)->addr); \
-        (r)->rkey = htonl((r)->rkey);  \
-        (r)->lid = htons((r)->lid);    \
-        (r)->qpn = htonl((r)->qpn);    \
-        (r)->psn = htonl((r)->psn);    \
+#define RA_TO_NET(r)                     \
+    do {                                 \
+        (r)->addr = htonll((r)->addr);   \
+        (r)->rkey = htonl((r)->rkey);    \
+        (r)->laddr = htonll((r)->laddr); \
+        (r)->lrkey = htonl((r)->lrkey);  \
+        (r)->raddr = htonll((r)->raddr); \
+        (r)->rrkey = htonl((r)->rrkey);  \
+        (r)->oaddr = htonll((r)->oaddr); \
+        (r)->orkey = htonl((r)->orkey);  \
+        (r)->lid = htons((r)->lid);      \
+        (r)->qpn = htonl((r)->qpn);      \
+        (r)->psn = htonl((r)->psn);      \
     } while (0)
 
 /* Convert remote attribute struct from network order to host order */
-#define RA_FROM_NET(r)                 \
-    do {                               \
-        (r)->addr = ntohll((r)->addr); \
-        (r)->rkey = ntohl((r)->rkey);  \
-        (r)->lid = ntohs((r)->lid);    \
-        (r)->qpn = ntohl((r)->qpn);    \
-        (r)->psn = ntohl((r)->psn);    \
+#define RA_FROM_NET(r)                   \
+    do {                                 \
+        (r)->addr = ntohll((r)->addr);   \
+        (r)->rkey = ntohl((r)->rkey);    \
+        (r)->laddr = ntohll((r)->laddr); \
+        (r)->lrkey = ntohl((r)->lrkey);  \
+        (r)->raddr = ntohll((r)->raddr); \
+        (r)->rrkey = ntohl((r)->rrkey);  \
+        (r)->oaddr = ntohll((r)->oaddr); \
+        (r)->orkey = ntohl((r)->orkey);  \
+        (r)->lid = ntohs((r)->lid);      \
+        (r)->qpn = ntohl((r)->qpn);      \
+        (r)->psn = ntohl((r)->psn);      \
     } while (0)
 
 /* Thread args for the RDMA handshake */
@@ -52,21 +64,27 @@ struct rdma_xchg_args {
     int ret;
 };
 
-// Get local attributes for a given peer on this host
-void __get_local_attr(struct rdma_ctx *r, struct remote_attr *p, int id,
-                      int frontier) {
-    p->addr = (uint64_t)r->mr[0]->addr;
-    p->rkey = r->mr[0]->rkey;
+// Get local attributes for a given QP on this host
+void __get_local_attr(struct rdma_ctx *r, struct remote_attr *p,
+                      struct ibv_qp *qp) {
+    p->addr = (uint64_t)r->faa.dir;
+    p->rkey = r->faa.dir_mr->rkey;
+    p->laddr = (uint64_t)r->llsc.dir;
+    p->lrkey = r->llsc.dir_mr->rkey;
+    p->raddr = (uint64_t)r->recovery_reqs;
+    p->rrkey = r->recovery_mr->rkey;
+    p->oaddr = (uint64_t)r->registry;
+    p->orkey = r->registry_mr->rkey;
     p->lid = r->lid;
-    p->qpn = (frontier ? r->fqp[id] : r->qp[id])->qp_num;
+    p->qpn = qp->qp_num;
     p->psn = 0;
 #pragma GCC unroll 16
     for (int i = 0; i < 16; ++i) p->gid[i] = r->gid[i];
 }
 
 // Connect local QP using remote QP info
-int __qp_connect(struct rdma_ctx *r, struct node_config *c,
-                 struct remote_attr *ra, int frontier) {
+int __qp_connect(struct ibv_qp *qp, struct node_config *c,
+                 struct remote_attr *ra) {
     int ret = 0;
     uint16_t ib_port = c->ib_port;
     uint16_t gid_index = c->gid_index;
@@ -90,7 +108,7 @@ int __qp_connect(struct rdma_ctx *r, struct node_config *c,
     for (int i = 0; i < 16; ++i) rtr_attr.ah_attr.grh.dgid.raw[i] = ra->gid[i];
 
     // set QP to RTR state
-    ret = ibv_modify_qp(frontier ? r->fqp[c->id] : r->qp[c->id], &rtr_attr,
+    ret = ibv_modify_qp(qp, &rtr_attr,
                         IBV_QP_STATE | IBV_QP_AV | IBV_QP_PATH_MTU |
                             IBV_QP_DEST_QPN | IBV_QP_RQ_PSN |
                             IBV_QP_MAX_DEST_RD_ATOMIC | IBV_QP_MIN_RNR_TIMER);
@@ -109,7 +127,7 @@ int __qp_connect(struct rdma_ctx *r, struct node_config *c,
     rts_attr.max_rd_atomic = MAX_RD_ATOMIC;
 
     // set QP to RTS state
-    ret = ibv_modify_qp(frontier ? r->fqp[c->id] : r->qp[c->id], &rts_attr,
+    ret = ibv_modify_qp(qp, &rts_attr,
                         IBV_QP_STATE | IBV_QP_TIMEOUT | IBV_QP_RETRY_CNT |
                             IBV_QP_RNR_RETRY | IBV_QP_SQ_PSN |
                             IBV_QP_MAX_QP_RD_ATOMIC);
@@ -118,9 +136,51 @@ int __qp_connect(struct rdma_ctx *r, struct node_config *c,
     return ret;
 }
 
+// Exchange and connect the consensus and frontier QPs of every lane (and
+// the grower's and the recoverer's) with peer id. Both ends write their attributes before
+// reading the peer's.
+int __xchg_lanes(struct rdma_ctx *r, int fd, int id) {
+    struct remote_attr local, remote;
+    for (int k = 0; k < r->nlanes + SYS_LANES; ++k) {
+        struct rdma_lane *l = r->lanes + k;
+        for (int frontier = 0; frontier < 2; ++frontier) {
+            struct ibv_qp *qp = frontier ? l->fqp[id] : l->qp[id];
+
+            // write local attributes to peer
+            __get_local_attr(r, &local, qp);
+            RA_TO_NET(&local);
+            if (write(fd, &local, RX_LEN) != RX_LEN) {
+                perror("write");
+                return -errno;
+            }
+
+            // read remote attributes from peer
+            if (recv(fd, &remote, RX_LEN, MSG_WAITALL) != RX_LEN) {
+                perror("read");
+                return -errno;
+            }
+            RA_FROM_NET(&remote);
+            if (!k && !frontier) {
+                r->ra[id] = remote;
+                r->faa.dirs[id] = (struct chunk_ent){
+                    .addr = remote.addr, .rkey = remote.rkey, .valid = 1};
+                r->llsc.dirs[id] = (struct chunk_ent){
+                    .addr = remote.laddr, .rkey = remote.lrkey, .valid = 1};
+            }
+
+            // connect queue pairs
+            if (__qp_connect(qp, r->c->c + id, &remote)) {
+                FAA_LOG("QP connection failed");
+                return 2;
+            }
+        }
+        FAA_LOG("[%hu] Connected lane %d QPs to node %d", r->c->host_id, k, id);
+    }
+    return 0;
+}
+
 // Server loop: accepts connections from higher-ranked peers
 void *__server_thread(void *ptr) {
-    struct remote_attr local;
     struct sockaddr_in server, client;
     socklen_t clientlen = sizeof(client);
     int serverfd, clientfd, nbytes, optval = 1;
@@ -175,64 +235,10 @@ void *__server_thread(void *ptr) {
             id = ntohs(id);
             FAA_LOG("Server received client ID = %d", id);
 
-            // get local attributes for this host
-            __get_local_attr(r, &local, id, 0);
-
-            // write local attributes to remote peer
-            RA_TO_NET(&local);
-            if ((nbytes = write(clientfd, &local, RX_LEN)) != RX_LEN) {
-                perror("write");
-                close(clientfd);
-                *ret = errno;
-                goto err;
-            }
-
-            // read remote attributes from remote peer
-            if ((nbytes = read(clientfd, r->ra + id, RX_LEN)) != RX_LEN) {
-                perror("read");
+            if ((*ret = __xchg_lanes(r, clientfd, id))) {
                 close(clientfd);
-                *ret = errno;
                 goto err;
             }
-            RA_FROM_NET(r->ra + id);
-
-            if (__qp_connect(r, c->c + id, r->ra + id, 0)) {
-                FAA_LOG("QP connection failed");
-                close(clientfd);
-                *ret = 2;
-                goto err;
-            }
-
-            // get frontier attributes for this host
-            __get_local_attr(r, &local, id, 1);
-            // write frontier attributes to remote peer
-            RA_TO_NET(&local);
-            if ((nbytes = write(clientfd, &local, RX_LEN)) != RX_LEN) {
-                perror("write");
-                close(clientfd);
-                *ret = errno;
-                goto err;
-            }
-            FAA_LOG("[%hu] Sent frontier attributes to node %hu\n", c->host_id,
-                    id);
-            memset(&local, 0, sizeof(local));
-            // read frontier attributes from remote peer
-            if ((nbytes = read(clientfd, &local, RX_LEN)) != RX_LEN) {
-                perror("read");
-                close(clientfd);
-                *ret = errno;
-                goto err;
-            }
-            RA_FROM_NET(&local);
-            // connect queue pairs
-            if (__qp_connect(r, c->c + id, &local, 1)) {
-                FAA_LOG("QP connection failed");
-                close(clientfd);
-                *ret = 2;
-                goto err;
-            }
-            FAA_LOG("[%hu] Connected frontier QP to node %hu\n", c->host_id,
-                    id);
 
             FAA_LOG("RDMA exchange with node %d success", id);
             close(clientfd);
@@ -251,7 +257,6 @@ err:
 // Client thread connects to a lower ranked peer
 void *__client_thread(void *ptr) {
     int i, sockfd, nbytes;
-    struct remote_attr local;
     struct sockaddr_in serveraddr;
     struct rdma_ctx *r = ((struct rdma_xchg_args *)ptr)->r;
     int id = ((struct rdma_xchg_args *)ptr)->id;
@@ -298,59 +303,7 @@ void *__client_thread(void *ptr) {
         goto exit;
     }
 
-    // local attributes for this host
-    __get_local_attr(r, &local, id, 0);
-    // write local attributes to peer
-    RA_TO_NET(&local);
-    if ((nbytes = write(sockfd, &local, RX_LEN)) != RX_LEN) {
-        perror("write");
-        *ret = errno;
-        goto exit;
-    }
-    // read remote attributes from peer
-    if ((nbytes = read(sockfd, r->ra + id, RX_LEN)) != RX_LEN) {
-        perror("read");
-        *ret = errno;
-        goto exit;
-    }
-    RA_FROM_NET(r->ra + id);
-    // connect queue pairs
-    if (__qp_connect(r, c->c + id, r->ra + id, 0)) {
-        FAA_LOG("QP connection failed");
-        *ret = 2;
-        goto exit;
-    }
-
-    // local attributes for this host
-    __get_local_attr(r, &local, id, 1);
-
-    // write local attributes to peer
-    RA_TO_NET(&local);
-    if ((nbytes = write(sockfd, &local, RX_LEN)) != RX_LEN) {
-        perror("write");
-        *ret = errno;
-        goto exit;
-    }
-
-    memset(&local, 0, sizeof(local));
-
-    // read remote attributes from peer
-    if ((nbytes = read(sockfd, &local, RX_LEN)) != RX_LEN) {
-        perror("read");
-        *ret = errno;
-        goto exit;
-    }
-    RA_FROM_NET(&local);
-    FAA_LOG("[%hu] Received frontier RA from node %d", c->host_id, id);
-
-    // connect queue pairs
-    if (__qp_connect(r, c->c + id, &local, 1)) {
-        FAA_LOG("QP connection failed");
-        *ret = 2;
-        goto exit;
-    }
-
-    FAA_LOG("[%hu] connected frontier QP to node %d", c->host_id, id);
+    if ((*ret = __xchg_lanes(r, sockfd, id))) goto exit;
 
     FAA_LOG("RDMA exchange with node %d success", id);
 exit:
@@ -371,32 +324,38 @@ int rdma_handshake(struct rdma_ctx *r) {
     }
 
     /* Connect to lower peers */
-    for (size_t i = 0; i < c->host_id; ++i) {
-        ca[i].r = r;
-        ca[i].id = i;
-        ca[i].ret = 0;
-        if (pthread_create(ct + i, NULL, __client_thread, (void *)(ca + i))) {
+    int ret = 0;
+    size_t clients = 0;
+    for (; clients < c->host_id; ++clients) {
+        ca[clients].r = r;
+        ca[clients].id = clients;
+        ca[clients].ret = 0;
+        if (pthread_create(ct + clients, NULL, __client_thread,
+                           (void *)(ca + clients))) {
             perror("pthread_create:");
-            return -errno;
+            ret = -errno;
+            break;
         }
     }
 
-    /* Client threads block here */
-    for (size_t i = 0; i < c->host_id; ++i) {
+    /* Client threads block here. All of them are joined before a failure
+     * returns: they use this frame */
+    for (size_t i = 0; i < clients; ++i) {
         pthread_join(ct[i], NULL);
         FAA_LOG("Client thread exited with status %d", ca[i].ret);
-        if (ca[i].ret) {
-            return ca[i].ret;
-        }
+        if (ca[i].ret && !ret) ret = ca[i].ret;
     }
 
     /* Server loop blocks here */
     if (server) pthread_join(st, NULL);
+    if (ret) return ret;
 
-    /* Setup loopback connection for frontier FAA */
-    if (!sa.ret) {
-        __get_local_attr(r, r->ra + c->host_id, c->host_id, 1);
-        return __qp_connect(r, c->c + c->host_id, r->ra + c->host_id, 1);
+    /* Setup loopback connection for frontier FAA on every lane */
+    for (int k = 0; !sa.ret && k < r->nlanes + SYS_LANES; ++k) {
+        struct ibv_qp *qp = r->lanes[k].fqp[c->host_id];
+        __get_local_attr(r, r->ra + c->host_id, qp);
+        if ((sa.ret = __qp_connect(qp, c->c + c->host_id, r->ra + c->host_id)))
+            break;
     }
 
     return sa.ret;
@@ -22,6 +22,7 @@ void *worker_thread(void *arg) {
     CPU_ZERO(&cpuset);
     CPU_SET(args->host_id * 16 + args->thread_id, &cpuset);
     pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+    node_lane_acquire(args->ctx);
 
     for (int i = 0; i < args->requests_per_thread; ++i) {
         uint64_t start_time = ts_us();
@@ -34,12 +35,16 @@ void *worker_thread(void *arg) {
             break;
     }
 
+    node_lane_release(args->ctx);
     return NULL;
 }
 
 int main(int argc, char *argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <host_id> <num_threads>\n", argv[0]);
+    if (argc < 3 || argc > 5) {
+        fprintf(stderr,
+                "Usage: %s <host_id> <num_threads> [poll_mode] "
+                "[frontier_mode]\n",
+                argv[0]);
         return 1;
     }
 
@@ -52,6 +57,9 @@ int main(int argc, char *argv[]) {
         .n = npeers,
         .host_id = host_id,
         .rdma_device = 0,
+        .lanes = num_threads,
+        .poll_mode = argc >= 4 ? atoi(argv[3]) : POLL_SPIN,
+        .frontier_mode = argc == 5 ? atoi(argv[4]) : FRONTIER_CENTRAL,
         .c = (struct node_config *)net_cfg,
     };
 
@@ -73,6 +81,11 @@ int main(int argc, char *argv[]) {
     free(threads);
     free(args);
 
+    struct rdma_wait_stats ws;
+    node_wait_stats(&n, &ws);
+    fprintf(stderr, "poll cycles %lu, blocked cycles %lu, blocks %lu\n",
+            ws.poll_cycles, ws.block_cycles, ws.blocks);
+
 #ifdef TRACK_SLOTS
     DUMP_CSV(stdout, &n);
 #endif
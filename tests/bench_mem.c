@@ -0,0 +1,73 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "net_map.h"
+#include "node.h"
+
+#define ITERS (100000)
+
+static int __cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+/* rdma_bcas latency over random slots of the whole slot range, with the
+ * slot arrays on the heap and on 2 MB hugepages. Run on every node */
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <host id>\n", argv[0]);
+        return 1;
+    }
+
+    int host_id = atoi(argv[1]);
+    const uint8_t modes[] = {MEM_CALLOC, MEM_HUGE_2M};
+    const char *names[] = {"calloc", "hugepages"};
+    uint64_t *lat = malloc(ITERS * sizeof(uint64_t));
+    assert(lat);
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(host_id, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+    fprintf(stderr, "Host ID,Mode,p50 (ns),p99 (ns),p99.9 (ns)\n");
+    for (int m = 0; m < 2; ++m) {
+        struct node_ctx n;
+        struct config c = {
+            .n = sizeof(net_cfg) / sizeof(net_cfg[0]),
+            .host_id = host_id,
+            .rdma_device = 0,
+            .mem_mode = modes[m],
+            .init_slots = MAX_SLOTS,  // measure the slots, not their growth
+            .mem_lock = 1,
+            .c = (struct node_config *)net_cfg,
+        };
+        assert(!node_init(&n, &c));
+        int lane = node_lane_acquire(&n);
+        assert(lane >= 0);
+        struct rdma_lane *l = n.r.lanes + lane;
+
+        uint32_t seed = host_id + 1;
+        for (int i = 0; i < ITERS; ++i) {
+            uint32_t slot = rand_r(&seed) % MAX_SLOTS;
+            uint64_t start = ts_ns();
+            rdma_bcas(l, &n.r.faa, slot, gen_ballot(l));
+            lat[i] = ts_ns() - start;
+        }
+
+        qsort(lat, ITERS, sizeof(uint64_t), __cmp);
+        fprintf(stderr, "%d,%s,%lu,%lu,%lu\n", host_id, names[m],
+                lat[ITERS / 2], lat[ITERS * 99 / 100], lat[ITERS * 999 / 1000]);
+
+        node_lane_release(&n);
+        // let the other nodes finish before tearing down the QPs
+        sleep(5);
+        node_destroy(&n);
+    }
+
+    free(lat);
+    return 0;
+}
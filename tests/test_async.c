@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "net_map.h"
+#include "node.h"
+
+#define DEPTH (64)
+
+struct request {
+    struct node_ctx *ctx;
+    uint64_t start;
+    int *inflight;
+    int *done;
+};
+
+static void on_faa(struct rdma_op *op, int64_t result, void *arg) {
+    struct request *req = arg;
+    (void)op;
+    --*req->inflight;
+    if (result < 0)
+        *req->done = 1;
+    else
+        fprintf(stderr, "%hu,%ld,%lu\n", req->ctx->id, result,
+                ts_us() - req->start);
+    free(req);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <host id>\n", argv[0]);
+        return 1;
+    }
+
+    int host_id = atoi(argv[1]);
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(host_id, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+    struct node_ctx n;
+    struct config c = {
+        .n = sizeof(net_cfg) / sizeof(net_cfg[0]),
+        .host_id = host_id,
+        .rdma_device = 0,
+        .c = (struct node_config *)net_cfg,
+    };
+
+    assert(!node_init(&n, &c));
+
+    fprintf(stderr, "Host ID,Slot,Elapsed\n");
+    int inflight = 0, done = 0;
+    while (!done || inflight) {
+        // keep DEPTH FAAs in flight on this thread's lane
+        while (!done && inflight < DEPTH) {
+            struct request *req = malloc(sizeof(*req));
+            *req = (struct request){.ctx = &n,
+                                    .start = ts_us(),
+                                    .inflight = &inflight,
+                                    .done = &done};
+            ++inflight;
+            if (!faa_submit(&n, on_faa, req)) {
+                --inflight;
+                free(req);
+                break;
+            }
+        }
+        node_progress(&n, DEPTH);
+    }
+
+    node_destroy(&n);
+    return 0;
+}
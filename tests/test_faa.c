@@ -42,6 +42,35 @@ int main(int argc, char *argv[]) {
     DUMP_CSV(stdout, &n);
 #endif
 
+    static const char *paths[] = {"fast win", "fast loss", "slow", "retried",
+                                  "recovery"};
+    struct rdma_stats *st = malloc(sizeof(*st));
+    assert(st);
+    node_stats_snapshot(&n, st);
+    for (int p = 0; p < STAT_PATHS; ++p) {
+        struct rdma_hist *h = &st->h[STAT_FAA][p];
+        if (!h->count) continue;
+        fprintf(stderr, "Node %hu FAA %s: %lu, p50 %lu p99 %lu p999 %lu ns\n",
+                host_id, paths[p], h->count, node_stats_quantile(h, 0.5),
+                node_stats_quantile(h, 0.99), node_stats_quantile(h, 0.999));
+    }
+    free(st);
+
+    struct rdma_conflicts cs;
+    node_conflict_stats(&n, &n.r.faa, &cs);
+    fprintf(stderr, "Node %hu: %lu of %lu FAAs conflicted, %lu fast paths "
+                    "skipped, undecided rate %.2f\n",
+            host_id, cs.conflicts, cs.ops, cs.fast_skips,
+            (double)cs.fast_rate / CONFLICT_ONE);
+
+    struct rdma_counters ct;
+    node_stats(&n, &ct);
+    assert(ct.fast >= ct.undecided && ct.polls >= ct.empty_polls);
+    fprintf(stderr, "Node %hu: %lu fast rounds (%lu undecided), %lu slow, "
+                    "%lu WRs in %lu doorbells, %lu wc errors\n",
+            host_id, ct.fast, ct.undecided, ct.slow, ct.posted, ct.doorbells,
+            ct.wc_errors);
+
     node_destroy(&n);
     return 0;
 }
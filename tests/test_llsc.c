@@ -10,8 +10,8 @@
 #define NUM_INCREMENTS (100)
 
 int main(int argc, char *argv[]) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <host id>\n", argv[0]);
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <host id> [leaderless]\n", argv[0]);
         return 1;
     }
 
@@ -28,6 +28,7 @@ int main(int argc, char *argv[]) {
         .n = sizeof(net_cfg) / sizeof(net_cfg[0]),
         .host_id = host_id,
         .rdma_device = 0,
+        .llsc_recovery = argc == 3 ? LLSC_LEADERLESS : LLSC_COORDINATED,
         .c = (struct node_config *)net_cfg,
     };
 
@@ -37,6 +38,7 @@ int main(int argc, char *argv[]) {
 
     int successful_increments = 0;
     int total_attempts = 0;
+    uint32_t failed = 0;
 
     while (successful_increments < NUM_INCREMENTS) {
         uint64_t start = ts_us();
@@ -61,14 +63,15 @@ int main(int argc, char *argv[]) {
 
         // Log result
         const char *result_str = (sc_ret == 0) ? "SUCCESS" : "FAILED";
-        fprintf(stderr, "%d,%d,%u,%lu,%s,%lu\n",
-                host_id, total_attempts, ctx.my_index, value, result_str, elapsed);
+        fprintf(stderr, "%d,%d,%lu,%lu,%s,%lu\n",
+                host_id, total_attempts, node_ll_index(&ctx), value, result_str, elapsed);
 
         if (sc_ret == 0) {
             successful_increments++;
+            failed = 0;
         } else {
             // SC failed, retry with backoff
-            usleep(10 + (rand() % 100));
+            node_backoff(&ctx, &ctx.r.llsc, failed++);
         }
     }
 
@@ -78,6 +81,23 @@ int main(int argc, char *argv[]) {
     fprintf(stderr, "  Success rate: %.2f%%\n",
             100.0 * successful_increments / total_attempts);
 
+    struct rdma_recovery_stats rs;
+    node_recovery_stats(&ctx, &rs);
+    fprintf(stderr, "  Recoveries: %lu, %.1f us avg, %lu us max\n",
+            rs.requests, rs.requests ? (double)rs.wait_us / rs.requests : 0.0,
+            rs.max_us);
+    if (rs.served)
+        fprintf(stderr, "  Served: %lu in %lu rounds, %.1f us avg\n",
+                rs.served, rs.batches, (double)rs.serve_us / rs.served);
+
+    struct rdma_conflicts cs;
+    node_conflict_stats(&ctx, &ctx.r.llsc, &cs);
+    fprintf(stderr, "  Conflicts: %lu of %lu SCs, %lu backoffs, %.1f us avg, "
+                    "rate %.2f\n",
+            cs.conflicts, cs.ops, cs.backoffs,
+            cs.backoffs ? cs.backoff_ns / 1000.0 / cs.backoffs : 0.0,
+            (double)cs.rate / CONFLICT_ONE);
+
     node_destroy(&ctx);
     return 0;
 }
@@ -0,0 +1,106 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "net_map.h"
+#include "node.h"
+
+/* Two threads of one node increment the register with LL/SC on lanes of
+ * their own. Both load the same index and value and store the same
+ * increment, so their SCs race with equal values: only one of them may
+ * win each index */
+#define NUM_THREADS (2)
+#define NUM_INCREMENTS (1000)
+
+struct thread_args {
+    struct node_ctx *ctx;
+    int thread_id;
+    uint64_t won[NUM_INCREMENTS];  // indices of the successful SCs
+    int attempts;
+};
+
+static void *increment_thread(void *arg) {
+    struct thread_args *args = (struct thread_args *)arg;
+    struct node_ctx *ctx = args->ctx;
+    assert(node_lane_acquire(ctx) >= 0);
+
+    uint32_t failed = 0;
+    for (int done = 0; done < NUM_INCREMENTS;) {
+        uint64_t value;
+        if (load_link(ctx, &value)) {
+            usleep(100);
+            continue;
+        }
+        ++args->attempts;
+        uint64_t index = node_ll_index(ctx);
+        if (!store_conditional(ctx, value + 1)) {
+            args->won[done++] = index;
+            failed = 0;
+        } else
+            node_backoff(ctx, &ctx->r.llsc, failed++);
+    }
+
+    node_lane_release(ctx);
+    return NULL;
+}
+
+static int __cmp(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <host id> [leaderless]\n", argv[0]);
+        return 1;
+    }
+
+    int host_id = atoi(argv[1]);
+    struct node_ctx ctx;
+    struct config c = {
+        .n = sizeof(net_cfg) / sizeof(net_cfg[0]),
+        .host_id = host_id,
+        .rdma_device = 0,
+        .lanes = NUM_THREADS,
+        .llsc_recovery = argc == 3 ? LLSC_LEADERLESS : LLSC_COORDINATED,
+        .c = (struct node_config *)net_cfg,
+    };
+
+    assert(!node_init(&ctx, &c));
+
+    static struct thread_args args[NUM_THREADS];
+    pthread_t threads[NUM_THREADS];
+    for (int i = 0; i < NUM_THREADS; ++i) {
+        args[i].ctx = &ctx;
+        args[i].thread_id = i;
+        assert(!pthread_create(threads + i, NULL, increment_thread, args + i));
+    }
+    for (int i = 0; i < NUM_THREADS; ++i) pthread_join(threads[i], NULL);
+
+    // an index won twice is an update lost
+    static uint64_t won[NUM_THREADS * NUM_INCREMENTS];
+    int attempts = 0;
+    for (int i = 0; i < NUM_THREADS; ++i) {
+        memcpy(won + i * NUM_INCREMENTS, args[i].won, sizeof(args[i].won));
+        attempts += args[i].attempts;
+    }
+    qsort(won, NUM_THREADS * NUM_INCREMENTS, sizeof(uint64_t), __cmp);
+    int dups = 0;
+    for (int i = 1; i < NUM_THREADS * NUM_INCREMENTS; ++i)
+        if (won[i] == won[i - 1]) {
+            fprintf(stderr, "Index %lu won twice\n", won[i]);
+            ++dups;
+        }
+
+    fprintf(stderr, "\nNode %d Summary:\n", host_id);
+    fprintf(stderr, "  Successful increments: %d in %d attempts\n",
+            NUM_THREADS * NUM_INCREMENTS, attempts);
+    fprintf(stderr, "  Indices won twice: %d\n", dups);
+
+    node_destroy(&ctx);
+    return dups ? 1 : 0;
+}
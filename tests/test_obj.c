@@ -0,0 +1,76 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "net_map.h"
+#include "node.h"
+
+#define NUM_COUNTERS (8)
+#define NUM_OPS (1000)
+
+/* FAAs spread over NUM_COUNTERS named counters, then LL/SC increments of a
+ * named register. Every counter hands out its own slots from 0 */
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <host id>\n", argv[0]);
+        return 1;
+    }
+
+    int host_id = atoi(argv[1]);
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(host_id, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+    struct node_ctx n;
+    struct config c = {
+        .n = sizeof(net_cfg) / sizeof(net_cfg[0]),
+        .host_id = host_id,
+        .rdma_device = 0,
+        .c = (struct node_config *)net_cfg,
+    };
+
+    assert(!node_init(&n, &c));
+
+    struct rdma_region *counters[NUM_COUNTERS];
+    char name[OBJ_NAME_LEN];
+    for (int i = 0; i < NUM_COUNTERS; ++i) {
+        snprintf(name, sizeof(name), "counter-%d", i);
+        assert((counters[i] = node_obj_open(&n, name, OBJ_FAA)));
+        assert(node_obj_open(&n, name, OBJ_FAA) == counters[i]);
+    }
+    assert(!node_obj_open(&n, "counter-0", OBJ_LLSC) && errno == EEXIST);
+    struct rdma_region *reg = node_obj_open(&n, "register", OBJ_LLSC);
+    assert(reg);
+    assert(fetch_and_add_obj(&n, reg) == -EINVAL);
+
+    fprintf(stderr, "Host ID,Counter,Slot,Elapsed\n");
+    for (int i = 0; i < NUM_OPS; ++i) {
+        int k = i % NUM_COUNTERS;
+        uint64_t start_time = ts_us();
+        int64_t ret = fetch_and_add_obj(&n, counters[k]);
+        uint64_t elapsed = ts_us() - start_time;
+        if (ret == -ENOMEM) break;
+        fprintf(stderr, "%hu,%d,%ld,%lu\n", host_id, k, ret, elapsed);
+    }
+
+    int won = 0;
+    for (int i = 0; i < NUM_OPS / 10; ++i) {
+        uint64_t value;
+        if (load_link_obj(&n, reg, &value)) continue;
+        if (!store_conditional(&n, value + 1)) {
+            fprintf(stderr, "SC on the node's register after an LL on an "
+                            "object succeeded\n");
+            return 1;
+        }
+        won += !store_conditional_obj(&n, reg, value + 1);
+    }
+    fprintf(stderr, "Node %d: %d register increments\n", host_id, won);
+
+    node_destroy(&n);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "net_map.h"
+#include "node.h"
+
+#define NUM_INCREMENTS (100)
+#define READS_PER_WRITE (50)
+#define READ_LEASE_US (1000)
+
+/* Read-heavy LL/SC increments under read leases. A Load-Link after this
+ * node's own successful SC must see that SC, lease or not */
+int main(int argc, char *argv[]) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <host id>\n", argv[0]);
+        return 1;
+    }
+
+    int host_id = atoi(argv[1]);
+
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(host_id, &cpuset);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+
+    struct node_ctx ctx;
+    struct config c = {
+        .n = sizeof(net_cfg) / sizeof(net_cfg[0]),
+        .host_id = host_id,
+        .rdma_device = 0,
+        .read_lease_us = READ_LEASE_US,
+        .c = (struct node_config *)net_cfg,
+    };
+
+    assert(!node_init(&ctx, &c));
+
+    uint64_t read_us = 0, reads = 0;
+    int won = 0;
+    uint32_t failed = 0;
+    while (won < NUM_INCREMENTS) {
+        uint64_t value = 0;
+        for (int i = 0; i < READS_PER_WRITE; ++i) {
+            uint64_t start = ts_us();
+            if (load_link(&ctx, &value)) continue;
+            read_us += ts_us() - start;
+            ++reads;
+        }
+        if (load_link(&ctx, &value) || store_conditional(&ctx, value + 1)) {
+            node_backoff(&ctx, &ctx.r.llsc, failed++);
+            continue;
+        }
+        ++won;
+        failed = 0;
+
+        uint64_t seen = 0;
+        assert(!load_link(&ctx, &seen));
+        if (seen < value + 1) {
+            fprintf(stderr, "Load-Link returned %lu after SC of %lu\n", seen,
+                    value + 1);
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "Node %d: %d increments, %lu Load-Links, %.2f us each\n",
+            host_id, won, reads, reads ? (double)read_us / reads : 0.0);
+
+    node_destroy(&ctx);
+    return 0;
+}